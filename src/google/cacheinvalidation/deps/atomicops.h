@@ -0,0 +1,31 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GOOGLE_CACHEINVALIDATION_DEPS_ATOMICOPS_H_
+#define GOOGLE_CACHEINVALIDATION_DEPS_ATOMICOPS_H_
+
+#include "base/atomicops.h"
+
+namespace invalidation {
+
+using ::base::subtle::AtomicWord;
+using ::base::subtle::Acquire_CompareAndSwap;
+using ::base::subtle::Acquire_Load;
+using ::base::subtle::Barrier_AtomicIncrement;
+using ::base::subtle::NoBarrier_AtomicIncrement;
+using ::base::subtle::NoBarrier_Load;
+using ::base::subtle::Release_CompareAndSwap;
+}  // invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_DEPS_ATOMICOPS_H_
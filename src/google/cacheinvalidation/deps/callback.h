@@ -17,7 +17,13 @@
 #ifndef GOOGLE_CACHEINVALIDATION_DEPS_CALLBACK_H_
 #define GOOGLE_CACHEINVALIDATION_DEPS_CALLBACK_H_
 
+#include <stddef.h>
+
+#include <new>
+
 #include "base/callback.h"
+#include "google/cacheinvalidation/deps/atomicops.h"
+#include "google/cacheinvalidation/deps/mutex.h"
 
 #define INVALIDATION_CALLBACK1_TYPE(Arg1) ::Callback1<Arg1>
 
@@ -77,6 +83,311 @@ Closure* NewPermanentCallback(
   return new CallbackWrapper<ArgType>(callback, arg);
 }
 
+// Closures for scheduler tasks whose storage is recycled through a free list,
+// so that steady-state scheduling does not allocate from the heap for the
+// closure itself. Bound arguments are copied into the closure, so arguments
+// that own heap storage (strings, ObjectId, AckHandle, ...) still allocate
+// when copied. They are drop-in replacements for NewPermanentCallback on
+// member functions: the scheduler deletes them after running them, as usual.
+
+// Allocator of closure-sized blocks. Freed blocks are kept, up to a bound, on
+// per-size free lists shared by all threads: a closure is usually created on
+// the internal thread and deleted on the listener or shard thread that ran it,
+// so per-thread lists would fill up on the threads that free and stay empty on
+// the one that allocates.
+//
+// The lists are guarded by a single mutex, held for a few pointer operations.
+// Every pooled closure also passes through a scheduler queue, which must
+// already synchronize the scheduling thread with the running thread, so the
+// pool adds no serialization point beyond what scheduling a task costs.
+class ClosurePool {
+ public:
+  // Blocks are handed out in multiples of this many bytes.
+  static const size_t kBlockGranularity = 16;
+
+  // Largest block served from the free lists; larger requests go to the heap.
+  static const size_t kMaxBlockSize = 128;
+
+  // Maximum number of free blocks kept per block size.
+  static const int kMaxFreeBlocksPerSize = 1024;
+
+  // Returns storage for an object of size bytes.
+  static void* Allocate(size_t size);
+
+  // Releases block, which was returned by Allocate(size).
+  static void Free(void* block, size_t size);
+
+  // Returns the number of free blocks of the size class holding size bytes.
+  static int GetFreeBlockCountForTest(size_t size);
+
+ private:
+  // Number of block sizes served from free lists.
+  static const size_t kNumSizeClasses = kMaxBlockSize / kBlockGranularity;
+
+  // A free block; the link is stored in the block itself.
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  ClosurePool() {
+    for (size_t i = 0; i < kNumSizeClasses; ++i) {
+      free_lists_[i] = NULL;
+      free_counts_[i] = 0;
+    }
+  }
+
+  // Returns the pool shared by all closures. It is created on first use and
+  // never destroyed, so closures created or deleted during static
+  // initialization or destruction still find it. A function-local static
+  // with a dynamic initializer may be constructed twice when threads race on
+  // first use, so the pool is published through an atomic word instead: as a
+  // POD with a constant initializer, that word is set before any code runs.
+  static ClosurePool* GetInstance() {
+    static AtomicWord instance = 0;
+    AtomicWord pool = Acquire_Load(&instance);
+    if (pool == 0) {
+      ClosurePool* new_pool = new ClosurePool();
+      if (Release_CompareAndSwap(
+              &instance, 0, reinterpret_cast<AtomicWord>(new_pool)) == 0) {
+        return new_pool;
+      }
+      // Another thread published its pool first.
+      delete new_pool;
+      pool = Acquire_Load(&instance);
+    }
+    return reinterpret_cast<ClosurePool*>(pool);
+  }
+
+  // Returns the size class holding size bytes. REQUIRES: size <= kMaxBlockSize.
+  static size_t GetSizeClass(size_t size) {
+    return (size == 0) ? 0 : (size - 1) / kBlockGranularity;
+  }
+
+  // Protects the free lists (see the class comment for why one lock suffices).
+  Mutex lock_;
+
+  // Free blocks for each size class, and their counts.
+  FreeBlock* free_lists_[kNumSizeClasses];
+  int free_counts_[kNumSizeClasses];
+};
+
+inline void* ClosurePool::Allocate(size_t size) {
+  if (size > kMaxBlockSize) {
+    return ::operator new(size);
+  }
+  size_t size_class = GetSizeClass(size);
+  ClosurePool* pool = GetInstance();
+  {
+    MutexLock m(&pool->lock_);
+    FreeBlock* block = pool->free_lists_[size_class];
+    if (block != NULL) {
+      pool->free_lists_[size_class] = block->next;
+      --pool->free_counts_[size_class];
+      return block;
+    }
+  }
+  return ::operator new((size_class + 1) * kBlockGranularity);
+}
+
+inline void ClosurePool::Free(void* block, size_t size) {
+  if (block == NULL) {
+    return;
+  }
+  if (size <= kMaxBlockSize) {
+    size_t size_class = GetSizeClass(size);
+    ClosurePool* pool = GetInstance();
+    MutexLock m(&pool->lock_);
+    if (pool->free_counts_[size_class] < kMaxFreeBlocksPerSize) {
+      FreeBlock* free_block = static_cast<FreeBlock*>(block);
+      free_block->next = pool->free_lists_[size_class];
+      pool->free_lists_[size_class] = free_block;
+      ++pool->free_counts_[size_class];
+      return;
+    }
+  }
+  ::operator delete(block);
+}
+
+inline int ClosurePool::GetFreeBlockCountForTest(size_t size) {
+  ClosurePool* pool = GetInstance();
+  MutexLock m(&pool->lock_);
+  return pool->free_counts_[GetSizeClass(size)];
+}
+
+// Base class of closures allocated from ClosurePool. Because Closure has a
+// virtual destructor, deleting a pooled closure through a Closure* returns its
+// storage to the pool.
+class PooledClosure : public Closure {
+ public:
+  static void* operator new(size_t size) {
+    return ClosurePool::Allocate(size);
+  }
+
+  static void operator delete(void* block, size_t size) {
+    ClosurePool::Free(block, size);
+  }
+
+  virtual bool IsRepeatable() const {
+    return true;
+  }
+};
+
+// Type used to store a bound argument that a method takes as ParamType.
+template<typename ParamType>
+struct PooledArgument {
+  typedef ParamType Type;
+};
+
+template<typename ParamType>
+struct PooledArgument<const ParamType&> {
+  typedef ParamType Type;
+};
+
+template<typename ParamType>
+struct PooledArgument<ParamType&> {
+  typedef ParamType Type;
+};
+
+template<typename Class>
+class PooledMethodClosure0 : public PooledClosure {
+ public:
+  PooledMethodClosure0(Class* object, void (Class::*method)())
+      : object_(object), method_(method) {}
+
+  virtual void Run() {
+    (object_->*method_)();
+  }
+
+ private:
+  Class* object_;
+  void (Class::*method_)();
+};
+
+template<typename Class, typename P1>
+class PooledMethodClosure1 : public PooledClosure {
+ public:
+  PooledMethodClosure1(Class* object, void (Class::*method)(P1),
+                       const typename PooledArgument<P1>::Type& arg1)
+      : object_(object), method_(method), arg1_(arg1) {}
+
+  virtual void Run() {
+    (object_->*method_)(arg1_);
+  }
+
+ private:
+  Class* object_;
+  void (Class::*method_)(P1);
+  typename PooledArgument<P1>::Type arg1_;
+};
+
+template<typename Class, typename P1, typename P2>
+class PooledMethodClosure2 : public PooledClosure {
+ public:
+  PooledMethodClosure2(Class* object, void (Class::*method)(P1, P2),
+                       const typename PooledArgument<P1>::Type& arg1,
+                       const typename PooledArgument<P2>::Type& arg2)
+      : object_(object), method_(method), arg1_(arg1), arg2_(arg2) {}
+
+  virtual void Run() {
+    (object_->*method_)(arg1_, arg2_);
+  }
+
+ private:
+  Class* object_;
+  void (Class::*method_)(P1, P2);
+  typename PooledArgument<P1>::Type arg1_;
+  typename PooledArgument<P2>::Type arg2_;
+};
+
+template<typename Class, typename P1, typename P2, typename P3>
+class PooledMethodClosure3 : public PooledClosure {
+ public:
+  PooledMethodClosure3(Class* object, void (Class::*method)(P1, P2, P3),
+                       const typename PooledArgument<P1>::Type& arg1,
+                       const typename PooledArgument<P2>::Type& arg2,
+                       const typename PooledArgument<P3>::Type& arg3)
+      : object_(object), method_(method), arg1_(arg1), arg2_(arg2),
+        arg3_(arg3) {}
+
+  virtual void Run() {
+    (object_->*method_)(arg1_, arg2_, arg3_);
+  }
+
+ private:
+  Class* object_;
+  void (Class::*method_)(P1, P2, P3);
+  typename PooledArgument<P1>::Type arg1_;
+  typename PooledArgument<P2>::Type arg2_;
+  typename PooledArgument<P3>::Type arg3_;
+};
+
+template<typename Class, typename P1, typename P2, typename P3, typename P4>
+class PooledMethodClosure4 : public PooledClosure {
+ public:
+  PooledMethodClosure4(Class* object, void (Class::*method)(P1, P2, P3, P4),
+                       const typename PooledArgument<P1>::Type& arg1,
+                       const typename PooledArgument<P2>::Type& arg2,
+                       const typename PooledArgument<P3>::Type& arg3,
+                       const typename PooledArgument<P4>::Type& arg4)
+      : object_(object), method_(method), arg1_(arg1), arg2_(arg2),
+        arg3_(arg3), arg4_(arg4) {}
+
+  virtual void Run() {
+    (object_->*method_)(arg1_, arg2_, arg3_, arg4_);
+  }
+
+ private:
+  Class* object_;
+  void (Class::*method_)(P1, P2, P3, P4);
+  typename PooledArgument<P1>::Type arg1_;
+  typename PooledArgument<P2>::Type arg2_;
+  typename PooledArgument<P3>::Type arg3_;
+  typename PooledArgument<P4>::Type arg4_;
+};
+
+// Returns a permanent closure that runs method on object with the given
+// arguments, which are copied into the closure. Object may be a subclass of the
+// class declaring method.
+template<typename Object, typename Class>
+Closure* NewPooledCallback(Object* object, void (Class::*method)()) {
+  return new PooledMethodClosure0<Class>(object, method);
+}
+
+template<typename Object, typename Class, typename P1>
+Closure* NewPooledCallback(Object* object, void (Class::*method)(P1),
+                           const typename PooledArgument<P1>::Type& arg1) {
+  return new PooledMethodClosure1<Class, P1>(object, method, arg1);
+}
+
+template<typename Object, typename Class, typename P1, typename P2>
+Closure* NewPooledCallback(Object* object, void (Class::*method)(P1, P2),
+                           const typename PooledArgument<P1>::Type& arg1,
+                           const typename PooledArgument<P2>::Type& arg2) {
+  return new PooledMethodClosure2<Class, P1, P2>(object, method, arg1, arg2);
+}
+
+template<typename Object, typename Class, typename P1, typename P2,
+         typename P3>
+Closure* NewPooledCallback(Object* object, void (Class::*method)(P1, P2, P3),
+                           const typename PooledArgument<P1>::Type& arg1,
+                           const typename PooledArgument<P2>::Type& arg2,
+                           const typename PooledArgument<P3>::Type& arg3) {
+  return new PooledMethodClosure3<Class, P1, P2, P3>(
+      object, method, arg1, arg2, arg3);
+}
+
+template<typename Object, typename Class, typename P1, typename P2,
+         typename P3, typename P4>
+Closure* NewPooledCallback(Object* object,
+                           void (Class::*method)(P1, P2, P3, P4),
+                           const typename PooledArgument<P1>::Type& arg1,
+                           const typename PooledArgument<P2>::Type& arg2,
+                           const typename PooledArgument<P3>::Type& arg3,
+                           const typename PooledArgument<P4>::Type& arg4) {
+  return new PooledMethodClosure4<Class, P1, P2, P3, P4>(
+      object, method, arg1, arg2, arg3, arg4);
+}
+
 }  // namespace invalidation
 
 #endif  // GOOGLE_CACHEINVALIDATION_DEPS_CALLBACK_H_
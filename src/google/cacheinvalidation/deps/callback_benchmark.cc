@@ -0,0 +1,115 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reports scheduler task throughput with and without pooled closures. Not run
+// as part of the unit tests.
+
+#include <stdio.h>
+#include <time.h>
+
+#include <deque>
+#include <string>
+
+#include "google/cacheinvalidation/deps/callback.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::deque;
+using INVALIDATION_STL_NAMESPACE::string;
+
+// Target of the benchmarked tasks.
+class TaskTarget {
+ public:
+  TaskTarget() : count_(0) {}
+
+  void Append(const string& value, int times) {
+    for (int i = 0; i < times; ++i) {
+      log_ += value;
+    }
+    ++count_;
+  }
+
+  int count() const {
+    return count_;
+  }
+
+ private:
+  int count_;
+  string log_;
+};
+
+// Runs and deletes every task in tasks, in order, like a scheduler.
+static void RunAll(deque<Closure*>* tasks) {
+  while (!tasks->empty()) {
+    Closure* task = tasks->front();
+    tasks->pop_front();
+    task->Run();
+    delete task;
+  }
+}
+
+// Returns the tasks per second for seconds spent on num_tasks tasks.
+static double TasksPerSecond(int num_tasks, double seconds) {
+  return num_tasks / (seconds > 0 ? seconds : 1e-9);
+}
+
+// Reports the number of tasks per second that can be created, queued, run and
+// deleted with NewPermanentCallback and with NewPooledCallback.
+static int RunBenchmark() {
+  const int kNumRounds = 200;
+  const int kTasksPerRound = 1000;
+  const string kValue = "payload";
+  TaskTarget target;
+  deque<Closure*> tasks;
+
+  clock_t start = clock();
+  for (int round = 0; round < kNumRounds; ++round) {
+    for (int i = 0; i < kTasksPerRound; ++i) {
+      tasks.push_back(NewPermanentCallback(
+          &target, &TaskTarget::Append, kValue, 0));
+    }
+    RunAll(&tasks);
+  }
+  double permanent_seconds =
+      static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  for (int round = 0; round < kNumRounds; ++round) {
+    for (int i = 0; i < kTasksPerRound; ++i) {
+      tasks.push_back(NewPooledCallback(
+          &target, &TaskTarget::Append, kValue, 0));
+    }
+    RunAll(&tasks);
+  }
+  double pooled_seconds =
+      static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+
+  const int kNumTasks = kNumRounds * kTasksPerRound;
+  if (target.count() != 2 * kNumTasks) {
+    fprintf(stderr, "Ran %d of %d tasks\n", target.count(), 2 * kNumTasks);
+    return 1;
+  }
+  printf("NewPermanentCallback: %.0f tasks/sec\n",
+         TasksPerSecond(kNumTasks, permanent_seconds));
+  printf("NewPooledCallback: %.0f tasks/sec\n",
+         TasksPerSecond(kNumTasks, pooled_seconds));
+  return 0;
+}
+
+}  // namespace invalidation
+
+int main(int argc, char** argv) {
+  return invalidation::RunBenchmark();
+}
@@ -0,0 +1,99 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests pooled closures.
+
+#include <deque>
+#include <string>
+
+#include "google/cacheinvalidation/deps/callback.h"
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::deque;
+using INVALIDATION_STL_NAMESPACE::string;
+
+class PooledClosureTest : public testing::Test {
+ public:
+  PooledClosureTest() : count_(0) {}
+
+  void Increment() {
+    ++count_;
+  }
+
+  void Append(const string& value, int times) {
+    for (int i = 0; i < times; ++i) {
+      log_ += value;
+    }
+    ++count_;
+  }
+
+  // Runs and deletes every task in tasks, in order, like a scheduler.
+  static void RunAll(deque<Closure*>* tasks) {
+    while (!tasks->empty()) {
+      Closure* task = tasks->front();
+      tasks->pop_front();
+      task->Run();
+      delete task;
+    }
+  }
+
+  int count_;
+  string log_;
+};
+
+// Tests that bound arguments are copied into the closure and passed on Run.
+TEST_F(PooledClosureTest, RunsWithBoundArguments) {
+  string value = "ab";
+  Closure* closure =
+      NewPooledCallback(this, &PooledClosureTest::Append, value, 3);
+  value = "changed";
+  EXPECT_TRUE(closure->IsRepeatable());
+  closure->Run();
+  closure->Run();
+  delete closure;
+  EXPECT_EQ("abababababab", log_);
+  EXPECT_EQ(2, count_);
+}
+
+// Tests that the storage of a deleted closure is reused by the next one.
+TEST_F(PooledClosureTest, ReusesStorage) {
+  Closure* first = NewPooledCallback(this, &PooledClosureTest::Increment);
+  int free_blocks = ClosurePool::GetFreeBlockCountForTest(
+      sizeof(PooledMethodClosure0<PooledClosureTest>));
+  delete first;
+  EXPECT_EQ(free_blocks + 1, ClosurePool::GetFreeBlockCountForTest(
+      sizeof(PooledMethodClosure0<PooledClosureTest>)));
+  Closure* second = NewPooledCallback(this, &PooledClosureTest::Increment);
+  EXPECT_EQ(static_cast<void*>(first), static_cast<void*>(second));
+  delete second;
+}
+
+// Tests that the free list of a size class stops growing at
+// kMaxFreeBlocksPerSize blocks, and that blocks past it go back to the heap.
+TEST_F(PooledClosureTest, BoundsFreeBlocks) {
+  const size_t kSize = sizeof(PooledMethodClosure0<PooledClosureTest>);
+  const int kMaxFreeBlocks = ClosurePool::kMaxFreeBlocksPerSize;
+  deque<Closure*> tasks;
+  for (int i = 0; i < kMaxFreeBlocks + 10; ++i) {
+    tasks.push_back(NewPooledCallback(this, &PooledClosureTest::Increment));
+  }
+  RunAll(&tasks);
+  EXPECT_EQ(kMaxFreeBlocks + 10, count_);
+  EXPECT_EQ(kMaxFreeBlocks, ClosurePool::GetFreeBlockCountForTest(kSize));
+}
+
+}  // namespace invalidation
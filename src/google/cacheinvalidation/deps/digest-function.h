@@ -17,8 +17,11 @@
 #ifndef GOOGLE_CACHEINVALIDATION_DEPS_DIGEST_FUNCTION_H_
 #define GOOGLE_CACHEINVALIDATION_DEPS_DIGEST_FUNCTION_H_
 
+#include <string.h>
+
 #include <string>
 
+#include "base/basictypes.h"
 #include "google/cacheinvalidation/deps/stl-namespace.h"
 
 namespace invalidation {
@@ -35,10 +38,48 @@ class DigestFunction {
   /* Adds data to the digest being computed. */
   virtual void Update(const string& data) = 0;
 
+  /* Adds the length bytes at data to the digest being computed. The default
+   * implementation copies the bytes into a string; implementations should
+   * override it to hash the bytes in place.
+   */
+  virtual void UpdateBuffer(const void* data, size_t length) {
+    Update(string(static_cast<const char*>(data), length));
+  }
+
   /* Stores the digest of the data added by Update. After this call has been
    * made, reset must be called before Update and GetDigest can be called.
    */
   virtual string GetDigest() = 0;
+
+  /* Like GetDigest(), but writes the first length bytes of the digest to
+   * digest (zero-filling if the digest is shorter) instead of allocating a
+   * string. The default implementation goes through GetDigest().
+   */
+  virtual void GetDigestToBuffer(uint8* digest, size_t length) {
+    string result = GetDigest();
+    size_t to_copy = result.size() < length ? result.size() : length;
+    memcpy(digest, result.data(), to_copy);
+    memset(digest + to_copy, 0, length - to_copy);
+  }
+
+  /* Computes the digests of count messages stored back to back at data, the
+   * i-th being lengths[i] bytes long, and writes the first digest_length bytes
+   * of the i-th digest at digests + i * digest_length, as GetDigestToBuffer
+   * does. Discards any data added by Update. The default implementation
+   * hashes the messages one at a time through the methods above;
+   * implementations may override it to avoid the per-message calls.
+   */
+  virtual void GetDigestsToBuffer(const uint8* data, const size_t* lengths,
+                                  size_t count, uint8* digests,
+                                  size_t digest_length) {
+    for (size_t i = 0; i < count; ++i) {
+      Reset();
+      UpdateBuffer(data, lengths[i]);
+      GetDigestToBuffer(digests + i * digest_length, digest_length);
+      data += lengths[i];
+    }
+    Reset();
+  }
 };
 
 }  // namespace invalidation
@@ -12,11 +12,457 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Interface to SHA1 digest computation.
+// Self-contained SHA-1 (FIPS 180-4) implementation of DigestFunction. On x86
+// processors with the SHA extensions, the compression function uses the SHA-NI
+// instructions; the processor is checked at run time, so the library need not
+// be compiled with -msha. Otherwise it falls back to portable code. Embedders
+// may still replace this file with their own SHA-1 based DigestFunction.
 
 #ifndef GOOGLE_CACHEINVALIDATION_DEPS_SHA1_DIGEST_FUNCTION_H_
 #define GOOGLE_CACHEINVALIDATION_DEPS_SHA1_DIGEST_FUNCTION_H_
 
-#error Replace this file with an implementation of DigestFunction based on SHA1.
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define INVALIDATION_SHA1_USE_SHA_NI 1
+#if defined(__SHA__) && defined(__SSE4_1__)
+#define INVALIDATION_SHA1_SHA_NI_TARGET
+#else
+// Compiles the SHA-NI code for processors the build does not otherwise target.
+#define INVALIDATION_SHA1_SHA_NI_TARGET __attribute__((target("sha,sse4.1")))
+#endif
+#endif
+
+#include "base/basictypes.h"
+#include "google/cacheinvalidation/deps/digest-function.h"
+
+namespace invalidation {
+
+class Sha1DigestFunction : public DigestFunction {
+ public:
+  /* Length of a SHA-1 digest in bytes. */
+  static const int kDigestLength = 20;
+
+  Sha1DigestFunction() {
+#ifdef INVALIDATION_SHA1_USE_SHA_NI
+    use_sha_ni_ = ProcessorSupportsShaNi();
+#endif
+    Reset();
+  }
+
+  virtual ~Sha1DigestFunction() {}
+
+  virtual void Reset() {
+    state_[0] = 0x67452301;
+    state_[1] = 0xEFCDAB89;
+    state_[2] = 0x98BADCFE;
+    state_[3] = 0x10325476;
+    state_[4] = 0xC3D2E1F0;
+    total_length_ = 0;
+    buffer_length_ = 0;
+  }
+
+  virtual void Update(const string& data) {
+    UpdateBytes(reinterpret_cast<const uint8*>(data.data()), data.size());
+  }
+
+  virtual void UpdateBuffer(const void* data, size_t length) {
+    UpdateBytes(static_cast<const uint8*>(data), length);
+  }
+
+  virtual string GetDigest() {
+    uint8 digest[kDigestLength];
+    Finish(digest);
+    return string(reinterpret_cast<const char*>(digest), kDigestLength);
+  }
+
+  virtual void GetDigestToBuffer(uint8* digest, size_t length) {
+    FinishToBuffer(digest, length);
+  }
+
+  /* Hashes the messages one after the other without going through the
+   * virtual methods, choosing the compression code once for the batch.
+   */
+  virtual void GetDigestsToBuffer(const uint8* data, const size_t* lengths,
+                                  size_t count, uint8* digests,
+                                  size_t digest_length) {
+    for (size_t i = 0; i < count; ++i) {
+      Reset();
+      UpdateBytes(data, lengths[i]);
+      FinishToBuffer(digests + i * digest_length, digest_length);
+      data += lengths[i];
+    }
+    Reset();
+  }
+
+  /* Makes this function use the portable compression code even if the
+   * processor supports SHA-NI.
+   */
+  void UsePortableCodeForTest() {
+#ifdef INVALIDATION_SHA1_USE_SHA_NI
+    use_sha_ni_ = false;
+#endif
+  }
+
+ private:
+  /* Size of a SHA-1 message block in bytes. */
+  static const size_t kBlockLength = 64;
+
+  /* Adds length bytes at data to the message. */
+  void UpdateBytes(const uint8* data, size_t length) {
+    total_length_ += length;
+    if (buffer_length_ > 0) {
+      size_t to_copy = kBlockLength - buffer_length_;
+      if (to_copy > length) {
+        to_copy = length;
+      }
+      memcpy(buffer_ + buffer_length_, data, to_copy);
+      buffer_length_ += to_copy;
+      data += to_copy;
+      length -= to_copy;
+      if (buffer_length_ < kBlockLength) {
+        return;
+      }
+      ProcessBlocks(state_, buffer_, 1);
+      buffer_length_ = 0;
+    }
+    // Hash whole blocks straight from the input.
+    size_t num_blocks = length / kBlockLength;
+    if (num_blocks > 0) {
+      ProcessBlocks(state_, data, num_blocks);
+      data += num_blocks * kBlockLength;
+      length -= num_blocks * kBlockLength;
+    }
+    memcpy(buffer_, data, length);
+    buffer_length_ = length;
+  }
+
+  /* Like Finish, but writes the first length bytes of the digest to digest,
+   * zero-filling past the digest length.
+   */
+  void FinishToBuffer(uint8* digest, size_t length) {
+    if (length == static_cast<size_t>(kDigestLength)) {
+      Finish(digest);
+      return;
+    }
+    uint8 full_digest[kDigestLength];
+    Finish(full_digest);
+    size_t to_copy = length < static_cast<size_t>(kDigestLength) ?
+        length : kDigestLength;
+    memcpy(digest, full_digest, to_copy);
+    memset(digest + to_copy, 0, length - to_copy);
+  }
+
+  /* Pads the message, writes the big-endian digest to digest and leaves the
+   * function in a state that requires Reset before further use.
+   */
+  void Finish(uint8 digest[kDigestLength]) {
+    uint64 bit_length = total_length_ * 8;
+    buffer_[buffer_length_++] = 0x80;
+    if (buffer_length_ > kBlockLength - 8) {
+      memset(buffer_ + buffer_length_, 0, kBlockLength - buffer_length_);
+      ProcessBlocks(state_, buffer_, 1);
+      buffer_length_ = 0;
+    }
+    memset(buffer_ + buffer_length_, 0, kBlockLength - 8 - buffer_length_);
+    for (int i = 0; i < 8; ++i) {
+      buffer_[kBlockLength - 1 - i] = static_cast<uint8>(bit_length >> (8 * i));
+    }
+    ProcessBlocks(state_, buffer_, 1);
+    for (int i = 0; i < 5; ++i) {
+      digest[4 * i] = static_cast<uint8>(state_[i] >> 24);
+      digest[4 * i + 1] = static_cast<uint8>(state_[i] >> 16);
+      digest[4 * i + 2] = static_cast<uint8>(state_[i] >> 8);
+      digest[4 * i + 3] = static_cast<uint8>(state_[i]);
+    }
+  }
+
+  static uint32 RotateLeft(uint32 value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+  }
+
+  /* Runs the compression function over num_blocks blocks. */
+  void ProcessBlocks(uint32 state[5], const uint8* data, size_t num_blocks) {
+#ifdef INVALIDATION_SHA1_USE_SHA_NI
+    if (use_sha_ni_) {
+      ProcessBlocksWithShaNi(state, data, num_blocks);
+      return;
+    }
+#endif
+    ProcessBlocksPortable(state, data, num_blocks);
+  }
+
+#ifdef INVALIDATION_SHA1_USE_SHA_NI
+  /* Returns whether the processor supports the SHA extensions and SSE4.1. */
+  static bool ProcessorSupportsShaNi() {
+#if defined(__SHA__) && defined(__SSE4_1__)
+    return true;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || ((ecx & bit_SSE4_1) == 0) ||
+        (__get_cpuid_max(0, NULL) < 7)) {
+      return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0;  // SHA, in leaf 7.
+#endif
+  }
+
+  /* Runs the compression function over num_blocks blocks using SHA-NI. */
+  INVALIDATION_SHA1_SHA_NI_TARGET
+  static void ProcessBlocksWithShaNi(uint32 state[5], const uint8* data,
+                                     size_t num_blocks) {
+    const __m128i kByteSwap =
+        _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    __m128i e1;
+    __m128i msg0, msg1, msg2, msg3;
+
+    for (; num_blocks > 0; --num_blocks, data += kBlockLength) {
+      __m128i abcd_save = abcd;
+      __m128i e0_save = e0;
+
+      // Rounds 0-3.
+      msg0 = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(data)), kByteSwap);
+      e0 = _mm_add_epi32(e0, msg0);
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+      // Rounds 4-7.
+      msg1 = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(data + 16)), kByteSwap);
+      e1 = _mm_sha1nexte_epu32(e1, msg1);
+      e0 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+      msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+      // Rounds 8-11.
+      msg2 = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(data + 32)), kByteSwap);
+      e0 = _mm_sha1nexte_epu32(e0, msg2);
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+      msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+      msg0 = _mm_xor_si128(msg0, msg2);
+
+      // Rounds 12-15.
+      msg3 = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(data + 48)), kByteSwap);
+      e1 = _mm_sha1nexte_epu32(e1, msg3);
+      e0 = abcd;
+      msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+      msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+      msg1 = _mm_xor_si128(msg1, msg3);
+
+      // Rounds 16-19.
+      e0 = _mm_sha1nexte_epu32(e0, msg0);
+      e1 = abcd;
+      msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+      msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+      msg2 = _mm_xor_si128(msg2, msg0);
+
+      // Rounds 20-23.
+      e1 = _mm_sha1nexte_epu32(e1, msg1);
+      e0 = abcd;
+      msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+      msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+      msg3 = _mm_xor_si128(msg3, msg1);
+
+      // Rounds 24-27.
+      e0 = _mm_sha1nexte_epu32(e0, msg2);
+      e1 = abcd;
+      msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+      msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+      msg0 = _mm_xor_si128(msg0, msg2);
+
+      // Rounds 28-31.
+      e1 = _mm_sha1nexte_epu32(e1, msg3);
+      e0 = abcd;
+      msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+      msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+      msg1 = _mm_xor_si128(msg1, msg3);
+
+      // Rounds 32-35.
+      e0 = _mm_sha1nexte_epu32(e0, msg0);
+      e1 = abcd;
+      msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+      msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+      msg2 = _mm_xor_si128(msg2, msg0);
+
+      // Rounds 36-39.
+      e1 = _mm_sha1nexte_epu32(e1, msg1);
+      e0 = abcd;
+      msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+      msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+      msg3 = _mm_xor_si128(msg3, msg1);
+
+      // Rounds 40-43.
+      e0 = _mm_sha1nexte_epu32(e0, msg2);
+      e1 = abcd;
+      msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+      msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+      msg0 = _mm_xor_si128(msg0, msg2);
+
+      // Rounds 44-47.
+      e1 = _mm_sha1nexte_epu32(e1, msg3);
+      e0 = abcd;
+      msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+      msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+      msg1 = _mm_xor_si128(msg1, msg3);
+
+      // Rounds 48-51.
+      e0 = _mm_sha1nexte_epu32(e0, msg0);
+      e1 = abcd;
+      msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+      msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+      msg2 = _mm_xor_si128(msg2, msg0);
+
+      // Rounds 52-55.
+      e1 = _mm_sha1nexte_epu32(e1, msg1);
+      e0 = abcd;
+      msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+      msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+      msg3 = _mm_xor_si128(msg3, msg1);
+
+      // Rounds 56-59.
+      e0 = _mm_sha1nexte_epu32(e0, msg2);
+      e1 = abcd;
+      msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+      msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+      msg0 = _mm_xor_si128(msg0, msg2);
+
+      // Rounds 60-63.
+      e1 = _mm_sha1nexte_epu32(e1, msg3);
+      e0 = abcd;
+      msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+      msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+      msg1 = _mm_xor_si128(msg1, msg3);
+
+      // Rounds 64-67.
+      e0 = _mm_sha1nexte_epu32(e0, msg0);
+      e1 = abcd;
+      msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+      msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+      msg2 = _mm_xor_si128(msg2, msg0);
+
+      // Rounds 68-71.
+      e1 = _mm_sha1nexte_epu32(e1, msg1);
+      e0 = abcd;
+      msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+      msg3 = _mm_xor_si128(msg3, msg1);
+
+      // Rounds 72-75.
+      e0 = _mm_sha1nexte_epu32(e0, msg2);
+      e1 = abcd;
+      msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+      // Rounds 76-79.
+      e1 = _mm_sha1nexte_epu32(e1, msg3);
+      e0 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+      // Add this block's result to the running state.
+      e0 = _mm_sha1nexte_epu32(e0, e0_save);
+      abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+                     _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+  }
+#endif  // INVALIDATION_SHA1_USE_SHA_NI
+
+  /* Runs the compression function over num_blocks blocks in portable code. */
+  static void ProcessBlocksPortable(uint32 state[5], const uint8* data,
+                                    size_t num_blocks) {
+    uint32 w[80];
+    for (; num_blocks > 0; --num_blocks, data += kBlockLength) {
+      for (int i = 0; i < 16; ++i) {
+        w[i] = (static_cast<uint32>(data[4 * i]) << 24) |
+            (static_cast<uint32>(data[4 * i + 1]) << 16) |
+            (static_cast<uint32>(data[4 * i + 2]) << 8) |
+            static_cast<uint32>(data[4 * i + 3]);
+      }
+      for (int i = 16; i < 80; ++i) {
+        w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+      }
+      uint32 a = state[0];
+      uint32 b = state[1];
+      uint32 c = state[2];
+      uint32 d = state[3];
+      uint32 e = state[4];
+      for (int i = 0; i < 80; ++i) {
+        uint32 f;
+        uint32 k;
+        if (i < 20) {
+          f = (b & c) | (~b & d);
+          k = 0x5A827999;
+        } else if (i < 40) {
+          f = b ^ c ^ d;
+          k = 0x6ED9EBA1;
+        } else if (i < 60) {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8F1BBCDC;
+        } else {
+          f = b ^ c ^ d;
+          k = 0xCA62C1D6;
+        }
+        uint32 temp = RotateLeft(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = RotateLeft(b, 30);
+        b = a;
+        a = temp;
+      }
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+    }
+  }
+
+#ifdef INVALIDATION_SHA1_USE_SHA_NI
+  /* Whether ProcessBlocks uses the SHA-NI code. */
+  bool use_sha_ni_;
+#endif
+
+  /* Intermediate hash value. */
+  uint32 state_[5];
+
+  /* Number of bytes added since the last Reset. */
+  uint64 total_length_;
+
+  /* Bytes of the current, incomplete block. */
+  uint8 buffer_[kBlockLength];
+
+  /* Number of valid bytes in buffer_. */
+  size_t buffer_length_;
+
+  DISALLOW_COPY_AND_ASSIGN(Sha1DigestFunction);
+};
+
+}  // namespace invalidation
 
 #endif  // GOOGLE_CACHEINVALIDATION_DEPS_SHA1_DIGEST_FUNCTION_H_
@@ -0,0 +1,158 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the SHA-1 digest function against the FIPS 180 test vectors, with both
+// the SHA-NI (if the processor supports it) and the portable compression code.
+
+#include <string>
+#include <vector>
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/sha1-digest-function.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::string;
+using INVALIDATION_STL_NAMESPACE::vector;
+
+class Sha1DigestFunctionTest : public testing::TestWithParam<bool> {
+ public:
+  virtual void SetUp() {
+    if (GetParam()) {
+      digest_fn_.UsePortableCodeForTest();
+    }
+  }
+
+  // Returns the lowercase hexadecimal encoding of data.
+  static string ToHex(const string& data) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    string result;
+    for (size_t i = 0; i < data.size(); ++i) {
+      unsigned char byte = static_cast<unsigned char>(data[i]);
+      result += kHexDigits[byte >> 4];
+      result += kHexDigits[byte & 0xf];
+    }
+    return result;
+  }
+
+  // Returns the hex digest of input, added with a single Update call.
+  string DigestWithUpdate(const string& input) {
+    digest_fn_.Reset();
+    digest_fn_.Update(input);
+    return ToHex(digest_fn_.GetDigest());
+  }
+
+  // Returns the hex digest of input, added with UpdateBuffer calls of
+  // chunk_size bytes each and read with GetDigestToBuffer.
+  string DigestWithChunks(const string& input, size_t chunk_size) {
+    digest_fn_.Reset();
+    for (size_t i = 0; i < input.size(); i += chunk_size) {
+      size_t length = input.size() - i;
+      if (length > chunk_size) {
+        length = chunk_size;
+      }
+      digest_fn_.UpdateBuffer(input.data() + i, length);
+    }
+    uint8 digest[Sha1DigestFunction::kDigestLength];
+    digest_fn_.GetDigestToBuffer(digest, sizeof(digest));
+    return ToHex(string(reinterpret_cast<const char*>(digest),
+                        sizeof(digest)));
+  }
+
+  // Checks that input hashes to expected_hex however it is added.
+  void CheckDigest(const string& input, const string& expected_hex) {
+    EXPECT_EQ(expected_hex, DigestWithUpdate(input));
+    // Chunk sizes around the 64-byte block size exercise the partial-block
+    // buffering.
+    static const size_t kChunkSizes[] = { 1, 3, 55, 63, 64, 65, 1000 };
+    for (size_t i = 0; i < arraysize(kChunkSizes); ++i) {
+      EXPECT_EQ(expected_hex, DigestWithChunks(input, kChunkSizes[i]))
+          << "chunk size " << kChunkSizes[i];
+    }
+  }
+
+  Sha1DigestFunction digest_fn_;
+};
+
+// Tests the one-block message from FIPS 180.
+TEST_P(Sha1DigestFunctionTest, OneBlock) {
+  CheckDigest("abc", "a9993e364706816aba3e25717850c26c9cd0d89d");
+}
+
+// Tests the empty message.
+TEST_P(Sha1DigestFunctionTest, Empty) {
+  CheckDigest("", "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+}
+
+// Tests the 448-bit message from FIPS 180, whose padding needs a second block.
+TEST_P(Sha1DigestFunctionTest, TwoBlocks) {
+  CheckDigest("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+              "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+}
+
+// Tests the message of one million 'a' characters from FIPS 180.
+TEST_P(Sha1DigestFunctionTest, MillionA) {
+  CheckDigest(string(1000000, 'a'),
+              "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+// Tests that a shorter buffer gets a prefix of the digest and a longer one is
+// zero-filled.
+TEST_P(Sha1DigestFunctionTest, DigestToBufferLength) {
+  digest_fn_.Update("abc");
+  uint8 digest[24];
+  digest_fn_.GetDigestToBuffer(digest, sizeof(digest));
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d00000000",
+            ToHex(string(reinterpret_cast<const char*>(digest),
+                         sizeof(digest))));
+
+  digest_fn_.Reset();
+  digest_fn_.Update("abc");
+  digest_fn_.GetDigestToBuffer(digest, 4);
+  EXPECT_EQ("a9993e36",
+            ToHex(string(reinterpret_cast<const char*>(digest), 4)));
+}
+
+// Tests that a batch of messages of lengths around the block size hashes to
+// the digests of the messages taken one at a time.
+TEST_P(Sha1DigestFunctionTest, DigestsToBuffer) {
+  string data;
+  vector<size_t> lengths;
+  for (size_t length = 0; length <= 130; ++length) {
+    data += string(length, static_cast<char>('a' + length % 26));
+    lengths.push_back(length);
+  }
+  vector<uint8> digests(lengths.size() * Sha1DigestFunction::kDigestLength);
+  digest_fn_.Update("discarded");
+  digest_fn_.GetDigestsToBuffer(reinterpret_cast<const uint8*>(data.data()),
+                                &lengths[0], lengths.size(), &digests[0],
+                                Sha1DigestFunction::kDigestLength);
+  size_t offset = 0;
+  for (size_t i = 0; i < lengths.size(); ++i) {
+    string expected = DigestWithUpdate(data.substr(offset, lengths[i]));
+    EXPECT_EQ(expected, ToHex(string(
+        reinterpret_cast<const char*>(
+            &digests[i * Sha1DigestFunction::kDigestLength]),
+        Sha1DigestFunction::kDigestLength))) << "length " << lengths[i];
+    offset += lengths[i];
+  }
+}
+
+// Runs every test with the default compression code and with the portable
+// code.
+INSTANTIATE_TEST_CASE_P(CompressionCode, Sha1DigestFunctionTest,
+                        testing::Bool());
+
+}  // namespace invalidation
@@ -33,7 +33,32 @@ BasicSystemResources::BasicSystemResources(
   storage_->SetSystemResources(this);
 }
 
+BasicSystemResources::BasicSystemResources(
+    Logger* logger, Scheduler* internal_scheduler,
+    Scheduler* listener_scheduler,
+    const vector<Scheduler*>& listener_shard_schedulers,
+    NetworkChannel* network, Storage* storage, const string& platform)
+    : logger_(logger),
+      internal_scheduler_(internal_scheduler),
+      listener_scheduler_(listener_scheduler),
+      network_(network),
+      storage_(storage),
+      listener_shard_schedulers_(listener_shard_schedulers),
+      platform_(platform) {
+  logger_->SetSystemResources(this);
+  internal_scheduler_->SetSystemResources(this);
+  listener_scheduler_->SetSystemResources(this);
+  for (size_t i = 0; i < listener_shard_schedulers_.size(); ++i) {
+    listener_shard_schedulers_[i]->SetSystemResources(this);
+  }
+  network_->SetSystemResources(this);
+  storage_->SetSystemResources(this);
+}
+
 BasicSystemResources::~BasicSystemResources() {
+  for (size_t i = 0; i < listener_shard_schedulers_.size(); ++i) {
+    delete listener_shard_schedulers_[i];
+  }
 }
 
 void BasicSystemResources::Start() {
@@ -67,6 +92,15 @@ Scheduler* BasicSystemResources::listener_scheduler() {
   return listener_scheduler_.get();
 }
 
+int BasicSystemResources::listener_shard_count() {
+  return listener_shard_schedulers_.size();
+}
+
+Scheduler* BasicSystemResources::listener_shard_scheduler(int shard) {
+  CHECK((shard >= 0) && (shard < listener_shard_count()));
+  return listener_shard_schedulers_[shard];
+}
+
 NetworkChannel* BasicSystemResources::network() {
   return network_.get();
 }
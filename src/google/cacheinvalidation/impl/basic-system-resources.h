@@ -18,12 +18,17 @@
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_BASIC_SYSTEM_RESOURCES_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_BASIC_SYSTEM_RESOURCES_H_
 
+#include <vector>
+
 #include "google/cacheinvalidation/include/system-resources.h"
 #include "google/cacheinvalidation/deps/scoped_ptr.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
 #include "google/cacheinvalidation/impl/run-state.h"
 
 namespace invalidation {
 
+using INVALIDATION_STL_NAMESPACE::vector;
+
 class BasicSystemResources : public SystemResources {
  public:
   // Constructs an instance from resource components.  Ownership of all
@@ -33,6 +38,15 @@ class BasicSystemResources : public SystemResources {
       Scheduler* listener_scheduler, NetworkChannel* network,
       Storage* storage, const string& platform);
 
+  // As above, but invalidation events for distinct objects are spread across
+  // |listener_shard_schedulers|, each of which must run its closures in order.
+  // Ownership of the shard schedulers is also transferred.
+  BasicSystemResources(
+      Logger* logger, Scheduler* internal_scheduler,
+      Scheduler* listener_scheduler,
+      const vector<Scheduler*>& listener_shard_schedulers,
+      NetworkChannel* network, Storage* storage, const string& platform);
+
   virtual ~BasicSystemResources();
 
   // Overrides from SystemResources.
@@ -43,6 +57,8 @@ class BasicSystemResources : public SystemResources {
   virtual Logger* logger();
   virtual Scheduler* internal_scheduler();
   virtual Scheduler* listener_scheduler();
+  virtual int listener_shard_count();
+  virtual Scheduler* listener_shard_scheduler(int shard);
   virtual NetworkChannel* network();
   virtual Storage* storage();
   virtual string platform() const;
@@ -56,6 +72,9 @@ class BasicSystemResources : public SystemResources {
   scoped_ptr<NetworkChannel> network_;
   scoped_ptr<Storage> storage_;
 
+  // Schedulers for invalidation events sharded by object (owned).
+  vector<Scheduler*> listener_shard_schedulers_;
+
   // The state of the resources.
   RunState run_state_;
 
@@ -0,0 +1,112 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reports the heap allocations made per invalidation on the receive and ack
+// paths. Replaces the global operator new, so it is built as its own program
+// and not run as part of the unit tests.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/protocol-handler.h"
+#include "google/cacheinvalidation/test/test-logger.h"
+
+namespace {
+
+// Number of calls to operator new so far.
+int allocation_count = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocation_count;
+  void* block = malloc(size == 0 ? 1 : size);
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void operator delete(void* block) throw() {
+  free(block);
+}
+
+namespace invalidation {
+
+// Reports operator new calls per invalidation when receiving a message with
+// 10000 invalidations, and when acking them.
+static int RunBenchmark() {
+  const int kNumInvalidations = 10000;
+  ServerToClientMessage server_message;
+  InvalidationMessage* invalidations =
+      server_message.mutable_invalidation_message();
+  for (int i = 0; i < kNumInvalidations; ++i) {
+    InvalidationP* invalidation = invalidations->add_invalidation();
+    invalidation->mutable_object_id()->set_source(4);
+    invalidation->mutable_object_id()->set_name(StringPrintf("object-%d", i));
+    invalidation->set_is_known_version(true);
+    invalidation->set_version(i);
+  }
+  string serialized_server_message;
+  server_message.SerializeToString(&serialized_server_message);
+
+  // Receive: parse the message and hand it to a ParsedMessage, as
+  // ProtocolHandler::HandleIncomingMessage does.
+  int start_count = allocation_count;
+  {
+    ServerToClientMessage message;
+    message.ParseFromString(serialized_server_message);
+    ParsedMessage parsed_message;
+    parsed_message.InitFrom(&message);
+    if (parsed_message.invalidation_message->invalidation_size() !=
+        kNumInvalidations) {
+      fprintf(stderr, "Parsed the wrong number of invalidations\n");
+      return 1;
+    }
+  }
+  int receive_count = allocation_count - start_count;
+
+  // Ack: batch every invalidation, then build and serialize the message.
+  TestLogger logger;
+  Statistics statistics;
+  Batcher batcher(&logger, &statistics);
+  start_count = allocation_count;
+  for (int i = 0; i < kNumInvalidations; ++i) {
+    batcher.AddAck(server_message.invalidation_message().invalidation(i));
+  }
+  {
+    ClientToServerMessage message;
+    if (!batcher.ToBuilder(&message, true)) {
+      fprintf(stderr, "Batcher had nothing to send\n");
+      return 1;
+    }
+    string serialized;
+    message.SerializeToString(&serialized);
+  }
+  int ack_count = allocation_count - start_count;
+
+  printf("Allocations per invalidation: %.2f to receive, %.2f to ack\n",
+         static_cast<double>(receive_count) / kNumInvalidations,
+         static_cast<double>(ack_count) / kNumInvalidations);
+  return 0;
+}
+
+}  // namespace invalidation
+
+int main(int argc, char** argv) {
+  return invalidation::RunBenchmark();
+}
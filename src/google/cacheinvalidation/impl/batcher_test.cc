@@ -0,0 +1,88 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the batching of acks and registration subtrees.
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/protocol-handler.h"
+#include "google/cacheinvalidation/test/test-logger.h"
+
+namespace invalidation {
+
+class BatcherTest : public testing::Test {
+ public:
+  BatcherTest() : batcher_(&logger_, &statistics_) {}
+
+  // Returns an invalidation of an object whose name is derived from index.
+  static InvalidationP MakeInvalidation(int index, int64 version) {
+    InvalidationP invalidation;
+    invalidation.mutable_object_id()->set_source(4);
+    invalidation.mutable_object_id()->set_name(
+        StringPrintf("object-%d", index));
+    invalidation.set_is_known_version(true);
+    invalidation.set_version(version);
+    return invalidation;
+  }
+
+  TestLogger logger_;
+  Statistics statistics_;
+  Batcher batcher_;
+};
+
+// Tests that duplicate acks are sent once, in order.
+TEST_F(BatcherTest, SendsEachAckOnce) {
+  batcher_.AddAck(MakeInvalidation(2, 7));
+  batcher_.AddAck(MakeInvalidation(1, 7));
+  batcher_.AddAck(MakeInvalidation(2, 7));
+  batcher_.AddAck(MakeInvalidation(2, 8));
+
+  ClientToServerMessage message;
+  ASSERT_TRUE(batcher_.ToBuilder(&message, true));
+  const InvalidationMessage& acks = message.invalidation_ack_message();
+  ASSERT_EQ(3, acks.invalidation_size());
+  EXPECT_EQ("object-1", acks.invalidation(0).object_id().name());
+  EXPECT_EQ("object-2", acks.invalidation(1).object_id().name());
+  EXPECT_EQ(7, acks.invalidation(1).version());
+  EXPECT_EQ(8, acks.invalidation(2).version());
+
+  // The batcher is empty again.
+  ClientToServerMessage next_message;
+  ASSERT_TRUE(batcher_.ToBuilder(&next_message, true));
+  EXPECT_FALSE(next_message.has_invalidation_ack_message());
+
+  // Pending acks are freed with the batcher.
+  batcher_.AddAck(MakeInvalidation(3, 1));
+}
+
+// Tests that a registration subtree that is already pending is not queued
+// again, while distinct subtrees are sent in the order they were added.
+TEST_F(BatcherTest, SendsEachRegSubtreeOnce) {
+  RegistrationSubtree first;
+  first.add_registered_object()->CopyFrom(MakeInvalidation(2, 1).object_id());
+  RegistrationSubtree second;
+  second.add_registered_object()->CopyFrom(MakeInvalidation(1, 1).object_id());
+  batcher_.AddRegSubtree(first);
+  batcher_.AddRegSubtree(second);
+  batcher_.AddRegSubtree(first);
+
+  ClientToServerMessage message;
+  ASSERT_TRUE(batcher_.ToBuilder(&message, true));
+  const RegistrationSyncMessage& sync = message.registration_sync_message();
+  ASSERT_EQ(2, sync.subtree_size());
+  EXPECT_EQ("object-2", sync.subtree(0).registered_object(0).name());
+  EXPECT_EQ("object-1", sync.subtree(1).registered_object(0).name());
+}
+
+}  // namespace invalidation
@@ -0,0 +1,75 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Chooses the delay after which batched data is sent to the server.
+
+#include "google/cacheinvalidation/impl/batching-delay-controller.h"
+
+#include <algorithm>
+
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::max;
+using INVALIDATION_STL_NAMESPACE::min;
+
+const double BatchingDelayController::kIntervalSmoothingFactor = 0.25;
+
+BatchingDelayController::BatchingDelayController(
+    TimeDelta min_delay, TimeDelta max_delay, TimeDelta target_latency)
+    : min_delay_(min_delay), max_delay_(max_delay),
+      target_latency_(target_latency), has_enqueued_(false),
+      average_interval_ms_(-1) {
+}
+
+void BatchingDelayController::RecordEnqueue(Time now) {
+  if (has_enqueued_) {
+    double interval_ms = (now - last_enqueue_time_).InMilliseconds();
+    average_interval_ms_ = (average_interval_ms_ < 0) ? interval_ms :
+        (kIntervalSmoothingFactor * interval_ms) +
+        ((1 - kIntervalSmoothingFactor) * average_interval_ms_);
+  }
+  has_enqueued_ = true;
+  last_enqueue_time_ = now;
+}
+
+TimeDelta BatchingDelayController::GetDelay(double throttle_headroom) const {
+  double min_ms = min_delay_.InMilliseconds();
+  double max_ms = max_delay_.InMilliseconds();
+  double target_ms = target_latency_.InMilliseconds();
+
+  // Number of enqueues expected within the target latency, and the resulting
+  // load, from 0 (idle) towards 1 (busy).
+  double expected_enqueues = (average_interval_ms_ < 0) ? 0 :
+      target_ms / max(average_interval_ms_, 1.0);
+  double load = expected_enqueues / (1 + expected_enqueues);
+  double delay_ms = min_ms + ((target_ms - min_ms) * load);
+
+  // Stretch the delay towards the maximum as the rate limits run out.
+  double headroom = min(max(throttle_headroom, 0.0), 1.0);
+  delay_ms += (max_ms - delay_ms) * (1 - headroom);
+
+  delay_ms = min(max(delay_ms, min_ms), max_ms);
+  return TimeDelta::FromMilliseconds(static_cast<int64>(delay_ms));
+}
+
+int BatchingDelayController::GetEnqueueRatePerMinute() const {
+  if (average_interval_ms_ < 0) {
+    return 0;
+  }
+  return static_cast<int>(60 * 1000 / max(average_interval_ms_, 1.0));
+}
+
+}  // namespace invalidation
@@ -0,0 +1,78 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Chooses the delay after which batched data is sent to the server. A client
+// that batches data rarely gains nothing from waiting, so its data is sent
+// after the minimum delay. As the rate at which data is batched grows, the
+// delay approaches the target latency, so that each message carries more. As
+// the headroom left under the rate limits shrinks, the delay is stretched
+// towards the maximum, since sending sooner would mostly be throttled anyway.
+
+#ifndef GOOGLE_CACHEINVALIDATION_IMPL_BATCHING_DELAY_CONTROLLER_H_
+#define GOOGLE_CACHEINVALIDATION_IMPL_BATCHING_DELAY_CONTROLLER_H_
+
+#include "google/cacheinvalidation/deps/time.h"
+
+namespace invalidation {
+
+class BatchingDelayController {
+ public:
+  /* Creates a controller that chooses delays between min_delay and max_delay,
+   * approaching target_latency under load.
+   */
+  BatchingDelayController(TimeDelta min_delay, TimeDelta max_delay,
+                          TimeDelta target_latency);
+
+  /* Records that data was batched at time now. */
+  void RecordEnqueue(Time now);
+
+  /* Returns the delay after which the data batched so far should be sent,
+   * given the fraction throttle_headroom (between 0 and 1) of the rate limits
+   * that is still available.
+   */
+  TimeDelta GetDelay(double throttle_headroom) const;
+
+  /* Returns the estimated number of enqueues per minute. */
+  int GetEnqueueRatePerMinute() const;
+
+ private:
+  /* Weight of the latest interval in the average interval between enqueues. */
+  static const double kIntervalSmoothingFactor;
+
+  /* Smallest delay returned. */
+  TimeDelta min_delay_;
+
+  /* Largest delay returned. */
+  TimeDelta max_delay_;
+
+  /* Delay approached as the enqueue rate grows, when the rate limits leave
+   * room.
+   */
+  TimeDelta target_latency_;
+
+  /* Whether any enqueue has been recorded. */
+  bool has_enqueued_;
+
+  /* Time of the last enqueue. */
+  Time last_enqueue_time_;
+
+  /* Exponentially weighted average of the interval between enqueues, in
+   * milliseconds; negative until two enqueues have been recorded.
+   */
+  double average_interval_ms_;
+};
+
+}  // namespace invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_IMPL_BATCHING_DELAY_CONTROLLER_H_
@@ -0,0 +1,82 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the batching delay controller.
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/time.h"
+#include "google/cacheinvalidation/impl/batching-delay-controller.h"
+
+namespace invalidation {
+
+class BatchingDelayControllerTest : public testing::Test {
+ public:
+  BatchingDelayControllerTest()
+      : controller_(TimeDelta::FromMilliseconds(kMinDelayMs),
+                    TimeDelta::FromMilliseconds(kMaxDelayMs),
+                    TimeDelta::FromMilliseconds(kTargetLatencyMs)) {}
+
+  // Records |count| enqueues, |interval_ms| apart.
+  void Enqueue(int count, int interval_ms) {
+    for (int i = 0; i < count; ++i) {
+      now_ += TimeDelta::FromMilliseconds(interval_ms);
+      controller_.RecordEnqueue(now_);
+    }
+  }
+
+  static const int kMinDelayMs;
+  static const int kMaxDelayMs;
+  static const int kTargetLatencyMs;
+
+  Time now_;
+  BatchingDelayController controller_;
+};
+
+const int BatchingDelayControllerTest::kMinDelayMs = 50;
+const int BatchingDelayControllerTest::kMaxDelayMs = 2000;
+const int BatchingDelayControllerTest::kTargetLatencyMs = 500;
+
+// Tests that data batched rarely is sent after about the minimum delay.
+TEST_F(BatchingDelayControllerTest, QuietClient) {
+  ASSERT_EQ(kMinDelayMs, controller_.GetDelay(1.0).InMilliseconds());
+  Enqueue(10, 60 * 1000);
+  ASSERT_EQ(1, controller_.GetEnqueueRatePerMinute());
+  ASSERT_GT(kMinDelayMs + 10, controller_.GetDelay(1.0).InMilliseconds());
+}
+
+// Tests that the delay approaches the target latency as the rate grows, without
+// exceeding it while the rate limits leave room.
+TEST_F(BatchingDelayControllerTest, BusyClient) {
+  Enqueue(20, 100);
+  int64 moderate_delay_ms = controller_.GetDelay(1.0).InMilliseconds();
+  Enqueue(50, 5);
+  int64 busy_delay_ms = controller_.GetDelay(1.0).InMilliseconds();
+  ASSERT_LT(kMinDelayMs, moderate_delay_ms);
+  ASSERT_LT(moderate_delay_ms, busy_delay_ms);
+  ASSERT_GE(kTargetLatencyMs, busy_delay_ms);
+  ASSERT_LT(kTargetLatencyMs - 10, busy_delay_ms);
+}
+
+// Tests that the delay stretches towards the maximum as the rate limits run
+// out.
+TEST_F(BatchingDelayControllerTest, NoHeadroom) {
+  Enqueue(20, 100);
+  int64 delay_ms = controller_.GetDelay(1.0).InMilliseconds();
+  int64 constrained_delay_ms = controller_.GetDelay(0.5).InMilliseconds();
+  ASSERT_LT(delay_ms, constrained_delay_ms);
+  ASSERT_GT(kMaxDelayMs, constrained_delay_ms);
+  ASSERT_EQ(kMaxDelayMs, controller_.GetDelay(0.0).InMilliseconds());
+}
+
+}  // namespace invalidation
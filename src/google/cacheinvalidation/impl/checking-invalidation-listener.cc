@@ -14,8 +14,14 @@
 
 // InvalidationListener wrapper that ensures that a delegate listener is called
 // on the proper thread and calls the listener method on the listener thread.
+// Known-version invalidations that are still waiting for the listener thread
+// are coalesced per object, so that only the highest version is delivered.
+// If the listener falls too far behind, invalidations are downgraded to
+// unknown-version and eventually collapsed into a single InvalidateAll.
+// Per-object invalidations may be spread across several listener shards.
 
 #include "google/cacheinvalidation/impl/checking-invalidation-listener.h"
+#include "google/cacheinvalidation/deps/callback.h"
 #include "google/cacheinvalidation/impl/log-macro.h"
 
 namespace invalidation {
@@ -23,12 +29,21 @@ namespace invalidation {
 CheckingInvalidationListener::CheckingInvalidationListener(
     InvalidationListener* delegate, Statistics* statistics,
     Scheduler* internal_scheduler, Scheduler* listener_scheduler,
-    Logger* logger)
+    const vector<Scheduler*>& shard_schedulers, Logger* logger,
+    int backlog_high_watermark)
     : delegate_(delegate),
       statistics_(statistics),
       internal_scheduler_(internal_scheduler),
       listener_scheduler_(listener_scheduler),
-      logger_(logger) {
+      shard_schedulers_(shard_schedulers),
+      logger_(logger),
+      backlog_high_watermark_(backlog_high_watermark),
+      unacked_invalidations_(0),
+      collapsing_(false),
+      pending_collapse_barriers_(0),
+      outstanding_upcalls_(0),
+      max_outstanding_upcalls_(0),
+      publish_gauges_scheduled_(false) {
   CHECK(delegate != NULL);
   CHECK(statistics != NULL);
   CHECK(internal_scheduler_ != NULL);
@@ -41,11 +56,64 @@ void CheckingInvalidationListener::Invalidate(
     const AckHandle& ack_handle) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(Statistics::ListenerEventType_INVALIDATE);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
-          delegate_, &InvalidationListener::Invalidate, client, invalidation,
-          ack_handle));
+  NoteUnackedInvalidation(ack_handle);
+  if (MaybeCollapse(client, ack_handle)) {
+    return;
+  }
+  ObjectKey key(invalidation.object_id().source(),
+                invalidation.object_id().name());
+  bool downgrade = (backlog_high_watermark_ > 0) &&
+      (GetBacklog() >= backlog_high_watermark_ / 2);
+
+  // If an invalidation for the same object is still waiting for the listener
+  // thread, keep only the higher version and ack the other one ourselves: the
+  // application would refetch the object only once anyway.
+  bool coalesced = false;
+  string superseded_handle_data;
+  {
+    MutexLock m(&lock_);
+    map<ObjectKey, PendingInvalidation>::iterator iter =
+        pending_invalidations_.find(key);
+    if (iter != pending_invalidations_.end()) {
+      coalesced = true;
+      PendingInvalidation* pending = &iter->second;
+      if (invalidation.version() > pending->invalidation.version()) {
+        superseded_handle_data = pending->ack_handle.handle_data();
+        pending->invalidation = invalidation;
+        pending->ack_handle = ack_handle;
+      } else {
+        superseded_handle_data = ack_handle.handle_data();
+      }
+    } else if (!downgrade) {
+      pending_invalidations_.insert(
+          make_pair(key, PendingInvalidation(invalidation, ack_handle)));
+    }
+  }
+  if (coalesced) {
+    TLOG(logger_, FINE, "Coalesced invalidation for pending object: %s",
+         invalidation.object_id().name().c_str());
+    statistics_->RecordListenerEvent(
+        Statistics::ListenerEventType_INVALIDATE_COALESCED);
+    client->Acknowledge(AckHandle(superseded_handle_data));
+    return;
+  }
+  if (downgrade) {
+    // The listener is falling behind: drop the version and payload so that
+    // queued upcalls stay small.
+    statistics_->RecordListenerEvent(
+        Statistics::ListenerEventType_INVALIDATE_DOWNGRADED);
+    ScheduleUpcall(
+        GetSchedulerForObject(invalidation.object_id()),
+        NewPooledCallback(
+            delegate_, &InvalidationListener::InvalidateUnknownVersion, client,
+            invalidation.object_id(), ack_handle));
+    return;
+  }
+  ScheduleUpcall(
+      GetSchedulerForObject(invalidation.object_id()),
+      NewPooledCallback(
+          this, &CheckingInvalidationListener::DeliverPendingInvalidation,
+          client, key));
 }
 
 void CheckingInvalidationListener::InvalidateUnknownVersion(
@@ -54,9 +122,13 @@ void CheckingInvalidationListener::InvalidateUnknownVersion(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(
       Statistics::ListenerEventType_INVALIDATE_UNKNOWN);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
+  NoteUnackedInvalidation(ack_handle);
+  if (MaybeCollapse(client, ack_handle)) {
+    return;
+  }
+  ScheduleUpcall(
+      GetSchedulerForObject(object_id),
+      NewPooledCallback(
           delegate_, &InvalidationListener::InvalidateUnknownVersion, client,
           object_id, ack_handle));
 }
@@ -66,9 +138,16 @@ void CheckingInvalidationListener::InvalidateAll(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(
       Statistics::ListenerEventType_INVALIDATE_ALL);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
+  // The application will refetch everything, so earlier invalidations that it
+  // has not acked yet no longer count towards the backlog.
+  unacked_invalidations_ = 0;
+  NoteUnackedInvalidation(ack_handle);
+  if (MaybeCollapse(client, ack_handle)) {
+    return;
+  }
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(
           delegate_, &InvalidationListener::InvalidateAll, client,
           ack_handle));
 }
@@ -79,9 +158,9 @@ void CheckingInvalidationListener::InformRegistrationFailure(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(
       Statistics::ListenerEventType_INFORM_REGISTRATION_FAILURE);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(
           delegate_, &InvalidationListener::InformRegistrationFailure, client,
           object_id, is_transient, error_message));
 }
@@ -92,9 +171,9 @@ void CheckingInvalidationListener::InformRegistrationStatus(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(
       Statistics::ListenerEventType_INFORM_REGISTRATION_STATUS);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(
           delegate_, &InvalidationListener::InformRegistrationStatus, client,
           object_id, reg_state));
 }
@@ -104,9 +183,9 @@ void CheckingInvalidationListener::ReissueRegistrations(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(
       Statistics::ListenerEventType_REISSUE_REGISTRATIONS);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(
           delegate_, &InvalidationListener::ReissueRegistrations,
           client, prefix, prefix_len));
 }
@@ -116,18 +195,230 @@ void CheckingInvalidationListener::InformError(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   statistics_->RecordListenerEvent(
       Statistics::ListenerEventType_INFORM_ERROR);
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(
           delegate_, &InvalidationListener::InformError, client, error_info));
 }
 
 void CheckingInvalidationListener::Ready(InvalidationClient* client) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   TLOG(logger_, INFO, "Informing app that ticl is ready");
-  listener_scheduler_->Schedule(
-      Scheduler::NoDelay(),
-      NewPermanentCallback(delegate_, &InvalidationListener::Ready, client));
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(delegate_, &InvalidationListener::Ready, client));
+}
+
+int CheckingInvalidationListener::GetOutstandingUpcallsForTest() {
+  MutexLock m(&lock_);
+  return outstanding_upcalls_;
+}
+
+void CheckingInvalidationListener::HandleAcknowledge(
+    const AckHandle& ack_handle) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  if (!ack_handle.IsNoOp() && (unacked_invalidations_ > 0)) {
+    --unacked_invalidations_;
+  }
+}
+
+int CheckingInvalidationListener::GetBacklog() {
+  MutexLock m(&lock_);
+  return (outstanding_upcalls_ > unacked_invalidations_) ?
+      outstanding_upcalls_ : unacked_invalidations_;
+}
+
+void CheckingInvalidationListener::NoteUnackedInvalidation(
+    const AckHandle& ack_handle) {
+  if (!ack_handle.IsNoOp()) {
+    ++unacked_invalidations_;
+  }
+}
+
+bool CheckingInvalidationListener::MaybeCollapse(
+    InvalidationClient* client, const AckHandle& ack_handle) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  if (!collapsing_) {
+    if ((backlog_high_watermark_ <= 0) ||
+        (GetBacklog() < backlog_high_watermark_)) {
+      return false;
+    }
+    // Start a collapse episode: everything from now on is covered by a single
+    // InvalidateAll. Per-object upcalls may be queued on the shards as well as
+    // on the listener thread, so a barrier is queued behind each of them; the
+    // InvalidateAll is scheduled once all of these have run.
+    TLOG(logger_, WARNING,
+         "Listener backlog reached %d; collapsing invalidations",
+         backlog_high_watermark_);
+    collapsing_ = true;
+    pending_collapse_barriers_ = 1 + static_cast<int>(shard_schedulers_.size());
+    ScheduleUpcall(
+        listener_scheduler_,
+        NewPooledCallback(
+            this, &CheckingInvalidationListener::PassCollapseBarrier, client));
+    for (size_t i = 0; i < shard_schedulers_.size(); ++i) {
+      ScheduleUpcall(
+          shard_schedulers_[i],
+          NewPooledCallback(
+              this, &CheckingInvalidationListener::PassCollapseBarrier,
+              client));
+    }
+  }
+  statistics_->RecordListenerEvent(
+      Statistics::ListenerEventType_INVALIDATE_COLLAPSED);
+  if (ack_handle.IsNoOp()) {
+    return true;
+  }
+  // Hold the ack back until the application has caught up, so that the server
+  // paces its sends to the rate at which the listener drains. Past the cap,
+  // leave the invalidation unacked; the server will resend it.
+  if (deferred_acks_.size() < static_cast<size_t>(backlog_high_watermark_)) {
+    deferred_acks_.push_back(ack_handle.handle_data());
+  } else {
+    --unacked_invalidations_;
+  }
+  PublishGauges();
+  return true;
+}
+
+void CheckingInvalidationListener::PassCollapseBarrier(
+    InvalidationClient* client) {
+  internal_scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), Scheduler::HIGH_PRIORITY,
+      NewPooledCallback(
+          this, &CheckingInvalidationListener::HandleCollapseBarrier, client));
+}
+
+void CheckingInvalidationListener::HandleCollapseBarrier(
+    InvalidationClient* client) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  CHECK(pending_collapse_barriers_ > 0);
+  if (--pending_collapse_barriers_ == 0) {
+    FinishCollapse(client);
+  }
+}
+
+void CheckingInvalidationListener::FinishCollapse(InvalidationClient* client) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  TLOG(logger_, INFO, "Listener caught up; delivering InvalidateAll for %d "
+       "deferred acks", static_cast<int>(deferred_acks_.size()));
+
+  // Invalidations that arrive from now on are queued behind the InvalidateAll,
+  // so they need not be folded into it.
+  collapsing_ = false;
+  vector<string> acks;
+  acks.swap(deferred_acks_);
+  PublishGauges();
+  ScheduleUpcall(
+      listener_scheduler_,
+      NewPooledCallback(
+          this, &CheckingInvalidationListener::DeliverCollapsedInvalidateAll,
+          client, acks));
+}
+
+void CheckingInvalidationListener::DeliverCollapsedInvalidateAll(
+    InvalidationClient* client, const vector<string>& acks) {
+  delegate_->InvalidateAll(client, AckHandle(""));
+  internal_scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), Scheduler::HIGH_PRIORITY,
+      NewPooledCallback(
+          this, &CheckingInvalidationListener::ReleaseCollapsedAcks, client,
+          acks));
+}
+
+void CheckingInvalidationListener::ReleaseCollapsedAcks(
+    InvalidationClient* client, const vector<string>& acks) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  // Each released ack lowers the count of unacked invalidations once the
+  // client hands it to HandleAcknowledge. Handles delivered before the
+  // collapse still count until the application acks them.
+  for (size_t i = 0; i < acks.size(); ++i) {
+    client->Acknowledge(AckHandle(acks[i]));
+  }
+}
+
+Scheduler* CheckingInvalidationListener::GetSchedulerForObject(
+    const ObjectId& object_id) {
+  if (shard_schedulers_.empty()) {
+    return listener_scheduler_;
+  }
+  uint32 hash = static_cast<uint32>(object_id.source());
+  const string& name = object_id.name();
+  for (size_t i = 0; i < name.size(); ++i) {
+    hash = (hash * 31) + static_cast<unsigned char>(name[i]);
+  }
+  return shard_schedulers_[hash % shard_schedulers_.size()];
+}
+
+void CheckingInvalidationListener::ScheduleUpcall(
+    Scheduler* scheduler, Closure* upcall) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  {
+    MutexLock m(&lock_);
+    ++outstanding_upcalls_;
+    if (outstanding_upcalls_ > max_outstanding_upcalls_) {
+      max_outstanding_upcalls_ = outstanding_upcalls_;
+    }
+  }
+  PublishGauges();
+
+  // Do not hold lock_ here: the listener scheduler may run the upcall inline.
+  scheduler->ScheduleWithPriority(
+      Scheduler::NoDelay(), Scheduler::HIGH_PRIORITY,
+      NewPooledCallback(
+          this, &CheckingInvalidationListener::RunUpcall, upcall));
+}
+
+void CheckingInvalidationListener::RunUpcall(Closure* upcall) {
+  upcall->Run();
+  delete upcall;
+  {
+    MutexLock m(&lock_);
+    --outstanding_upcalls_;
+    if (publish_gauges_scheduled_) {
+      // The queued call will read the new depth.
+      return;
+    }
+    publish_gauges_scheduled_ = true;
+  }
+  // The statistics belong to the internal thread, so the lower depth is
+  // published from there.
+  internal_scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), Scheduler::LOW_PRIORITY,
+      NewPooledCallback(this, &CheckingInvalidationListener::PublishGauges));
+}
+
+void CheckingInvalidationListener::PublishGauges() {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  int depth;
+  int max_depth;
+  {
+    MutexLock m(&lock_);
+    publish_gauges_scheduled_ = false;
+    depth = outstanding_upcalls_;
+    max_depth = max_outstanding_upcalls_;
+  }
+  statistics_->SetGauge(Statistics::GaugeType_LISTENER_QUEUE_DEPTH, depth);
+  statistics_->SetGauge(Statistics::GaugeType_LISTENER_QUEUE_MAX_DEPTH,
+                        max_depth);
+  statistics_->SetGauge(Statistics::GaugeType_LISTENER_DEFERRED_ACKS,
+                        static_cast<int>(deferred_acks_.size()));
+}
+
+void CheckingInvalidationListener::DeliverPendingInvalidation(
+    InvalidationClient* client, ObjectKey key) {
+  Invalidation invalidation;
+  string handle_data;
+  {
+    MutexLock m(&lock_);
+    map<ObjectKey, PendingInvalidation>::iterator iter =
+        pending_invalidations_.find(key);
+    CHECK(iter != pending_invalidations_.end());
+    invalidation = iter->second.invalidation;
+    handle_data = iter->second.ack_handle.handle_data();
+    pending_invalidations_.erase(iter);
+  }
+  delegate_->Invalidate(client, invalidation, AckHandle(handle_data));
 }
 
 }  // namespace invalidation
@@ -14,10 +14,21 @@
 
 // InvalidationListener wrapper that ensures that a delegate listener is called
 // on the proper thread and calls the listener method on the listener thread.
+// Known-version invalidations that are still waiting for the listener thread
+// are coalesced per object, so that only the highest version is delivered.
+// If the listener falls too far behind, invalidations are downgraded to
+// unknown-version and eventually collapsed into a single InvalidateAll.
+// Per-object invalidations may be spread across several listener shards.
 
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_CHECKING_INVALIDATION_LISTENER_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_CHECKING_INVALIDATION_LISTENER_H_
 
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "google/cacheinvalidation/deps/mutex.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
 #include "google/cacheinvalidation/include/invalidation-client.h"
 #include "google/cacheinvalidation/include/invalidation-listener.h"
 #include "google/cacheinvalidation/include/system-resources.h"
@@ -26,12 +37,25 @@
 
 namespace invalidation {
 
+using INVALIDATION_STL_NAMESPACE::make_pair;
+using INVALIDATION_STL_NAMESPACE::map;
+using INVALIDATION_STL_NAMESPACE::pair;
+using INVALIDATION_STL_NAMESPACE::vector;
+
 class CheckingInvalidationListener : public InvalidationListener {
  public:
+  /* Creates a listener that forwards upcalls to delegate on
+   * listener_scheduler. Invalidate and InvalidateUnknownVersion upcalls are
+   * instead sent to one of shard_schedulers (if any), chosen by object id, so
+   * that distinct objects can be processed in parallel while each object's
+   * upcalls stay in order. backlog_high_watermark bounds the listener backlog
+   * (see GetBacklog); a value <= 0 means unbounded.
+   */
   CheckingInvalidationListener(
       InvalidationListener* delegate, Statistics* statistics,
       Scheduler* internal_scheduler, Scheduler* listener_scheduler,
-      Logger* logger);
+      const vector<Scheduler*>& shard_schedulers, Logger* logger,
+      int backlog_high_watermark);
 
   virtual ~CheckingInvalidationListener() {}
 
@@ -67,7 +91,94 @@ class CheckingInvalidationListener : public InvalidationListener {
 
   virtual void Ready(InvalidationClient* client);
 
+  /* Returns the number of upcalls scheduled on the listener thread that have
+   * not yet completed.
+   */
+  int GetOutstandingUpcallsForTest();
+
+  /* Informs this listener that the application acknowledged ack_handle. Must
+   * be called on the internal thread.
+   */
+  void HandleAcknowledge(const AckHandle& ack_handle);
+
  private:
+  /* Key under which pending invalidations are coalesced: (source, name). */
+  typedef pair<int, string> ObjectKey;
+
+  /* A known-version invalidation waiting to be delivered to the delegate. */
+  struct PendingInvalidation {
+    PendingInvalidation(const Invalidation& invalidation_arg,
+                        const AckHandle& ack_handle_arg)
+        : invalidation(invalidation_arg), ack_handle(ack_handle_arg) {}
+
+    Invalidation invalidation;
+    AckHandle ack_handle;
+  };
+
+  /* Schedules upcall on scheduler and updates the queue depth statistics.
+   * Takes ownership of upcall. Must be called on the internal thread.
+   */
+  void ScheduleUpcall(Scheduler* scheduler, Closure* upcall);
+
+  /* Returns the scheduler on which upcalls for object_id are made. */
+  Scheduler* GetSchedulerForObject(const ObjectId& object_id);
+
+  /* Runs and deletes upcall on the listener thread. */
+  void RunUpcall(Closure* upcall);
+
+  /* Copies the queue depth and deferred ack counts to the statistics, which
+   * may only be accessed on the internal thread.
+   */
+  void PublishGauges();
+
+  /* Delivers the pending invalidation for key (if any) to the delegate. Runs
+   * on the listener thread.
+   */
+  void DeliverPendingInvalidation(InvalidationClient* client, ObjectKey key);
+
+  /* Returns the larger of the number of outstanding upcalls and the number of
+   * invalidations that have not been acknowledged yet.
+   */
+  int GetBacklog();
+
+  /* Records that an invalidation with ack_handle has been handed to this
+   * listener and will eventually be acknowledged.
+   */
+  void NoteUnackedInvalidation(const AckHandle& ack_handle);
+
+  /* If the backlog is at or above the high watermark (or an earlier collapse
+   * has not yet been scheduled), folds the invalidation with ack_handle into a
+   * single InvalidateAll upcall and returns true. Its ack is deferred until
+   * the application has processed the InvalidateAll.
+   */
+  bool MaybeCollapse(InvalidationClient* client, const AckHandle& ack_handle);
+
+  /* Tells the internal thread that the calling listener or shard thread has
+   * drained the upcalls queued before the current collapse started.
+   */
+  void PassCollapseBarrier(InvalidationClient* client);
+
+  /* Counts a passed collapse barrier and finishes the collapse once every
+   * listener and shard thread has passed its barrier.
+   */
+  void HandleCollapseBarrier(InvalidationClient* client);
+
+  /* Ends a collapse episode by scheduling the InvalidateAll standing in for
+   * the collapsed invalidations.
+   */
+  void FinishCollapse(InvalidationClient* client);
+
+  /* Delivers the InvalidateAll standing in for the collapsed invalidations
+   * whose ack handle data is acks, then has the internal thread release those
+   * acks. Runs on the listener thread.
+   */
+  void DeliverCollapsedInvalidateAll(InvalidationClient* client,
+                                     const vector<string>& acks);
+
+  /* Acknowledges the collapsed invalidations whose ack handle data is acks. */
+  void ReleaseCollapsedAcks(InvalidationClient* client,
+                            const vector<string>& acks);
+
   /* The actual listener to which this listener delegates. */
   InvalidationListener* delegate_;
 
@@ -80,7 +191,57 @@ class CheckingInvalidationListener : public InvalidationListener {
   /* The scheduler for scheduling events for the delegate. */
   Scheduler* listener_scheduler_;
 
+  /* Schedulers across which per-object invalidations are sharded. If empty,
+   * they go to listener_scheduler_.
+   */
+  vector<Scheduler*> shard_schedulers_;
+
   Logger* logger_;
+
+  /* Backlog at which invalidations are collapsed into InvalidateAll; at half
+   * this value, known-version invalidations are downgraded to unknown-version.
+   */
+  int backlog_high_watermark_;
+
+  /* Invalidations handed to this listener whose acks have not been seen. */
+  int unacked_invalidations_;
+
+  /* Whether invalidations are being folded into an InvalidateAll that has not
+   * been scheduled yet.
+   */
+  bool collapsing_;
+
+  /* Number of listener and shard threads that have not yet reached the
+   * barrier queued when the current collapse started.
+   */
+  int pending_collapse_barriers_;
+
+  /* Ack handle data of invalidations folded into the next InvalidateAll,
+   * capped at backlog_high_watermark_ entries. Invalidations beyond the cap
+   * are never acked, so the server will resend them later.
+   */
+  vector<string> deferred_acks_;
+
+  /* Protects the fields below, which are shared with the listener thread. */
+  Mutex lock_;
+
+  /* Known-version invalidations that have been scheduled for delivery but not
+   * yet handed to the delegate, keyed by object.
+   */
+  map<ObjectKey, PendingInvalidation> pending_invalidations_;
+
+  /* Number of upcalls scheduled on the listener thread that have not
+   * completed.
+   */
+  int outstanding_upcalls_;
+
+  /* Largest value of outstanding_upcalls_ seen so far. */
+  int max_outstanding_upcalls_;
+
+  /* Whether a PublishGauges call is queued on the internal thread. */
+  bool publish_gauges_scheduled_;
+
+  DISALLOW_COPY_AND_ASSIGN(CheckingInvalidationListener);
 };
 
 }  // namespace invalidation
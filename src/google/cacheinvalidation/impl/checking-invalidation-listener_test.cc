@@ -0,0 +1,409 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the CheckingInvalidationListener.
+
+#include <string>
+#include <vector>
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/scoped_ptr.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/checking-invalidation-listener.h"
+#include "google/cacheinvalidation/impl/statistics.h"
+#include "google/cacheinvalidation/test/deterministic-scheduler.h"
+#include "google/cacheinvalidation/test/test-logger.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::string;
+using INVALIDATION_STL_NAMESPACE::vector;
+
+// A client that records the handles it is asked to acknowledge.
+class RecordingClient : public InvalidationClient {
+ public:
+  virtual void Start() {}
+  virtual void Stop() {}
+  virtual void Register(const ObjectId& object_id) {}
+  virtual void Register(const vector<ObjectId>& object_ids) {}
+  virtual void Unregister(const ObjectId& object_id) {}
+  virtual void Unregister(const vector<ObjectId>& object_ids) {}
+  virtual void Acknowledge(const AckHandle& ack_handle) {
+    acks.push_back(ack_handle.handle_data());
+  }
+
+  vector<string> acks;
+};
+
+// A listener that records the invalidation upcalls it receives.
+class RecordingListener : public InvalidationListener {
+ public:
+  virtual void Ready(InvalidationClient* client) {}
+
+  virtual void Invalidate(InvalidationClient* client,
+                          const Invalidation& invalidation,
+                          const AckHandle& ack_handle) {
+    upcalls.push_back("Invalidate " + invalidation.object_id().name() + " " +
+                      SimpleItoa(invalidation.version()) + " " +
+                      ack_handle.handle_data());
+  }
+
+  virtual void InvalidateUnknownVersion(InvalidationClient* client,
+                                        const ObjectId& object_id,
+                                        const AckHandle& ack_handle) {
+    upcalls.push_back("InvalidateUnknownVersion " + object_id.name() + " " +
+                      ack_handle.handle_data());
+  }
+
+  virtual void InvalidateAll(InvalidationClient* client,
+                             const AckHandle& ack_handle) {
+    upcalls.push_back("InvalidateAll " + ack_handle.handle_data());
+  }
+
+  virtual void InformRegistrationStatus(InvalidationClient* client,
+                                        const ObjectId& object_id,
+                                        RegistrationState reg_state) {}
+
+  virtual void InformRegistrationFailure(InvalidationClient* client,
+                                         const ObjectId& object_id,
+                                         bool is_transient,
+                                         const string& error_message) {}
+
+  virtual void ReissueRegistrations(InvalidationClient* client,
+                                    const string& prefix, int prefix_len) {}
+
+  virtual void InformError(InvalidationClient* client,
+                           const ErrorInfo& error_info) {}
+
+  vector<string> upcalls;
+};
+
+class CheckingInvalidationListenerTest : public testing::Test {
+ public:
+  virtual void SetUp() {
+    internal_scheduler_.reset(new SimpleDeterministicScheduler(&logger_));
+    listener_scheduler_.reset(new SimpleDeterministicScheduler(&logger_));
+    internal_scheduler_->StartScheduler();
+    listener_scheduler_->StartScheduler();
+  }
+
+  virtual void TearDown() {
+    listener_.reset();
+    for (size_t i = 0; i < shard_schedulers_.size(); ++i) {
+      delete shard_schedulers_[i];
+    }
+  }
+
+  // Creates the listener under test with the given backlog high watermark.
+  void CreateListener(int backlog_high_watermark) {
+    listener_.reset(new CheckingInvalidationListener(
+        &delegate_, &statistics_, internal_scheduler_.get(),
+        listener_scheduler_.get(), shard_schedulers_, &logger_,
+        backlog_high_watermark));
+  }
+
+  // Runs the tasks queued on the listener scheduler.
+  void RunListener() {
+    listener_scheduler_->PassTime(TimeDelta::FromMilliseconds(1));
+  }
+
+  // Runs the tasks queued on the internal scheduler.
+  void RunInternal() {
+    internal_scheduler_->PassTime(TimeDelta::FromMilliseconds(1));
+  }
+
+  // Returns the number of InvalidateAll upcalls the application has seen.
+  int CountInvalidateAllUpcalls() {
+    int count = 0;
+    for (size_t i = 0; i < delegate_.upcalls.size(); ++i) {
+      if (delegate_.upcalls[i] == "InvalidateAll ") {
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  // Invalidates object name at version, with ack handle data handle.
+  void Invalidate(const string& name, int64 version, const string& handle) {
+    listener_->Invalidate(&client_, Invalidation(ObjectId(4, name), version),
+                          AckHandle(handle));
+  }
+
+  TestLogger logger_;
+  Statistics statistics_;
+  RecordingClient client_;
+  RecordingListener delegate_;
+  scoped_ptr<DeterministicScheduler> internal_scheduler_;
+  scoped_ptr<DeterministicScheduler> listener_scheduler_;
+  vector<Scheduler*> shard_schedulers_;
+  scoped_ptr<CheckingInvalidationListener> listener_;
+};
+
+// Tests that invalidations for an object that are waiting for the listener
+// thread are delivered once, at the highest version, and that the handles of
+// the superseded ones are acknowledged on the application's behalf.
+TEST_F(CheckingInvalidationListenerTest, CoalescesPerObject) {
+  CreateListener(0);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("a", 3, "a3");
+  Invalidate("a", 2, "a2");
+  ASSERT_EQ(2, client_.acks.size());
+  ASSERT_EQ("a1", client_.acks[0]);
+  ASSERT_EQ("a2", client_.acks[1]);
+  ASSERT_EQ(2, statistics_.GetListenerEventCountForTest(
+      Statistics::ListenerEventType_INVALIDATE_COALESCED));
+
+  RunListener();
+  ASSERT_EQ(2, delegate_.upcalls.size());
+  ASSERT_EQ("Invalidate a 3 a3", delegate_.upcalls[0]);
+  ASSERT_EQ("Invalidate b 1 b1", delegate_.upcalls[1]);
+
+  // Once delivered, a new invalidation for the object is not coalesced.
+  Invalidate("a", 4, "a4");
+  RunListener();
+  ASSERT_EQ(3, delegate_.upcalls.size());
+  ASSERT_EQ("Invalidate a 4 a4", delegate_.upcalls[2]);
+  ASSERT_EQ(2, client_.acks.size());
+}
+
+// Tests that the queue depth gauge follows the upcalls as they run, and that
+// the listener thread leaves it to the internal thread to lower it.
+TEST_F(CheckingInvalidationListenerTest, QueueDepthGauge) {
+  CreateListener(0);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  ASSERT_EQ(2, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_QUEUE_DEPTH));
+  RunListener();
+  ASSERT_EQ(2, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_QUEUE_DEPTH));
+  ASSERT_EQ(0, listener_->GetOutstandingUpcallsForTest());
+  RunInternal();
+  ASSERT_EQ(0, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_QUEUE_DEPTH));
+  ASSERT_EQ(2, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_QUEUE_MAX_DEPTH));
+}
+
+// Tests that once the backlog reaches half the high watermark, known-version
+// invalidations are delivered as unknown-version.
+TEST_F(CheckingInvalidationListenerTest, DowngradesWhenBehind) {
+  CreateListener(4);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  RunListener();
+  ASSERT_EQ(2, delegate_.upcalls.size());
+  ASSERT_EQ("Invalidate a 1 a1", delegate_.upcalls[0]);
+  ASSERT_EQ("InvalidateUnknownVersion b b1", delegate_.upcalls[1]);
+  ASSERT_EQ(1, statistics_.GetListenerEventCountForTest(
+      Statistics::ListenerEventType_INVALIDATE_DOWNGRADED));
+
+  // Acks bring the backlog back down.
+  listener_->HandleAcknowledge(AckHandle("a1"));
+  listener_->HandleAcknowledge(AckHandle("b1"));
+  Invalidate("c", 1, "c1");
+  RunListener();
+  ASSERT_EQ("Invalidate c 1 c1", delegate_.upcalls[2]);
+}
+
+// Tests that at the high watermark, invalidations are collapsed into a single
+// InvalidateAll and that their acks are released only after it has run.
+TEST_F(CheckingInvalidationListenerTest, CollapsesAtHighWatermark) {
+  CreateListener(4);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("c", 1, "c1");
+  Invalidate("d", 1, "d1");
+  Invalidate("e", 1, "e1");
+  ASSERT_EQ(2, statistics_.GetListenerEventCountForTest(
+      Statistics::ListenerEventType_INVALIDATE_COLLAPSED));
+  ASSERT_EQ(2, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_DEFERRED_ACKS));
+
+  // The InvalidateAll is scheduled only once the upcalls queued before the
+  // collapse have run, and nothing is acked before it has been processed.
+  RunInternal();
+  ASSERT_TRUE(client_.acks.empty());
+  RunListener();
+  ASSERT_EQ(3, delegate_.upcalls.size());
+  ASSERT_EQ("Invalidate a 1 a1", delegate_.upcalls[0]);
+  ASSERT_EQ("InvalidateUnknownVersion b b1", delegate_.upcalls[1]);
+  ASSERT_EQ("InvalidateUnknownVersion c c1", delegate_.upcalls[2]);
+  RunInternal();
+  ASSERT_EQ(0, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_DEFERRED_ACKS));
+  RunListener();
+  ASSERT_EQ(4, delegate_.upcalls.size());
+  ASSERT_EQ("InvalidateAll ", delegate_.upcalls[3]);
+  ASSERT_TRUE(client_.acks.empty());
+
+  // The deferred acks are released on the internal thread afterwards.
+  RunInternal();
+  ASSERT_EQ(2, client_.acks.size());
+  ASSERT_EQ("d1", client_.acks[0]);
+  ASSERT_EQ("e1", client_.acks[1]);
+}
+
+// Tests that handles delivered before a collapse still count towards the
+// backlog until the application acks them.
+TEST_F(CheckingInvalidationListenerTest, KeepsHandlesDeliveredBeforeCollapse) {
+  CreateListener(4);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("c", 1, "c1");
+  Invalidate("d", 1, "d1");
+  Invalidate("e", 1, "e1");
+  RunListener();
+  RunInternal();
+  RunListener();
+  RunInternal();
+  ASSERT_EQ(2, client_.acks.size());
+  listener_->HandleAcknowledge(AckHandle("d1"));
+  listener_->HandleAcknowledge(AckHandle("e1"));
+
+  // a1, b1 and c1 are still unacked, so f starts another collapse.
+  Invalidate("f", 1, "f1");
+  ASSERT_EQ(3, statistics_.GetListenerEventCountForTest(
+      Statistics::ListenerEventType_INVALIDATE_COLLAPSED));
+  RunListener();
+  RunInternal();
+  RunListener();
+  RunInternal();
+  ASSERT_EQ(5, delegate_.upcalls.size());
+  ASSERT_EQ("InvalidateAll ", delegate_.upcalls[4]);
+  ASSERT_EQ(3, client_.acks.size());
+  ASSERT_EQ("f1", client_.acks[2]);
+  listener_->HandleAcknowledge(AckHandle("f1"));
+
+  // Once the application acks them, invalidations are delivered again.
+  listener_->HandleAcknowledge(AckHandle("a1"));
+  listener_->HandleAcknowledge(AckHandle("b1"));
+  listener_->HandleAcknowledge(AckHandle("c1"));
+  Invalidate("g", 1, "g1");
+  RunListener();
+  ASSERT_EQ(6, delegate_.upcalls.size());
+  ASSERT_EQ("Invalidate g 1 g1", delegate_.upcalls[5]);
+}
+
+// Tests that at most backlog_high_watermark acks are deferred; invalidations
+// past the cap are left unacked.
+TEST_F(CheckingInvalidationListenerTest, CapsDeferredAcks) {
+  CreateListener(2);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("c", 1, "c1");
+  Invalidate("d", 1, "d1");
+  ASSERT_EQ(2, statistics_.GetGaugeForTest(
+      Statistics::GaugeType_LISTENER_DEFERRED_ACKS));
+  RunListener();
+  RunInternal();
+  RunListener();
+  RunInternal();
+  ASSERT_EQ(2, client_.acks.size());
+  ASSERT_EQ("b1", client_.acks[0]);
+  ASSERT_EQ("c1", client_.acks[1]);
+}
+
+// Tests that an InvalidateAll from the server resets the count of
+// invalidations the application has not acked.
+TEST_F(CheckingInvalidationListenerTest, InvalidateAllResetsUnacked) {
+  CreateListener(6);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("c", 1, "c1");
+  listener_->InvalidateAll(&client_, AckHandle("all"));
+  RunListener();
+  ASSERT_EQ(4, delegate_.upcalls.size());
+  ASSERT_EQ("InvalidateUnknownVersion c c1", delegate_.upcalls[2]);
+  ASSERT_EQ("InvalidateAll all", delegate_.upcalls[3]);
+
+  Invalidate("d", 1, "d1");
+  RunListener();
+  ASSERT_EQ("Invalidate d 1 d1", delegate_.upcalls[4]);
+}
+
+// Tests that with sharded upcalls, the InvalidateAll is delivered only after
+// every shard has drained the upcalls queued before the collapse.
+TEST_F(CheckingInvalidationListenerTest, CollapseWaitsForShards) {
+  for (int i = 0; i < 2; ++i) {
+    DeterministicScheduler* shard = new SimpleDeterministicScheduler(&logger_);
+    shard->StartScheduler();
+    shard_schedulers_.push_back(shard);
+  }
+  CreateListener(2);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("c", 1, "c1");
+
+  RunListener();
+  RunInternal();
+  static_cast<DeterministicScheduler*>(shard_schedulers_[0])->PassTime(
+      TimeDelta::FromMilliseconds(1));
+  RunInternal();
+  RunListener();
+  ASSERT_EQ(0, CountInvalidateAllUpcalls());
+
+  static_cast<DeterministicScheduler*>(shard_schedulers_[1])->PassTime(
+      TimeDelta::FromMilliseconds(1));
+  ASSERT_EQ(1, delegate_.upcalls.size());
+  RunInternal();
+  RunListener();
+  ASSERT_EQ(2, delegate_.upcalls.size());
+  ASSERT_EQ("InvalidateAll ", delegate_.upcalls[1]);
+  ASSERT_TRUE(client_.acks.empty());
+  RunInternal();
+  ASSERT_EQ(2, client_.acks.size());
+  ASSERT_EQ("b1", client_.acks[0]);
+  ASSERT_EQ("c1", client_.acks[1]);
+}
+
+// Tests that an invalidation collapsed while the last shard is still draining
+// is covered by the InvalidateAll, which the application sees after it.
+TEST_F(CheckingInvalidationListenerTest, CoversInvalidationsBeforeLastBarrier) {
+  for (int i = 0; i < 2; ++i) {
+    DeterministicScheduler* shard = new SimpleDeterministicScheduler(&logger_);
+    shard->StartScheduler();
+    shard_schedulers_.push_back(shard);
+  }
+  CreateListener(3);
+  Invalidate("a", 1, "a1");
+  Invalidate("b", 1, "b1");
+  Invalidate("c", 1, "c1");
+  RunListener();
+  RunInternal();
+  static_cast<DeterministicScheduler*>(shard_schedulers_[0])->PassTime(
+      TimeDelta::FromMilliseconds(1));
+  RunInternal();
+
+  // Only the last shard's barrier is outstanding.
+  Invalidate("d", 1, "d1");
+  ASSERT_EQ(2, statistics_.GetListenerEventCountForTest(
+      Statistics::ListenerEventType_INVALIDATE_COLLAPSED));
+  RunListener();
+  ASSERT_EQ(0, CountInvalidateAllUpcalls());
+
+  static_cast<DeterministicScheduler*>(shard_schedulers_[1])->PassTime(
+      TimeDelta::FromMilliseconds(1));
+  RunInternal();
+  RunListener();
+  ASSERT_EQ(1, CountInvalidateAllUpcalls());
+  ASSERT_EQ("InvalidateAll ", delegate_.upcalls.back());
+  RunInternal();
+  ASSERT_EQ(2, client_.acks.size());
+  ASSERT_EQ("c1", client_.acks[0]);
+  ASSERT_EQ("d1", client_.acks[1]);
+}
+
+}  // namespace invalidation
@@ -25,6 +25,7 @@
 namespace invalidation {
 
 // Client
+using ::ipc::invalidation::ObjectVersionP;
 using ::ipc::invalidation::PersistentStateBlob;
 using ::ipc::invalidation::PersistentTiclState;
 
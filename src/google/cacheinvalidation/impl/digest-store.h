@@ -20,6 +20,8 @@
 
 #include <vector>
 
+#include "google/cacheinvalidation/impl/object-id-digest-utils.h"
+
 namespace invalidation {
 
 using INVALIDATION_STL_NAMESPACE::vector;
@@ -35,6 +37,11 @@ class DigestStore {
   /* Returns whether element is in the store. */
   virtual bool Contains(const ElementType& element) = 0;
 
+  /* Returns whether the element whose digest is element_digest is in the
+   * store. Lets callers that already hold the digest avoid recomputing it.
+   */
+  virtual bool ContainsDigest(const ObjectIdDigest& element_digest) = 0;
+
   /* Returns a digest of the desired objects in 'digest'.
    *
    * NOTE: the digest computations MUST NOT depend on the order in which the
@@ -64,11 +71,23 @@ class DigestStore {
   virtual void Add(const vector<ElementType>& elements,
       vector<ElementType>* added_elements) = 0;
 
+  /* Like Add(elements, added_elements), for callers that already hold
+   * element_digests, the digests of elements in the same order.
+   */
+  virtual void Add(const vector<ObjectIdDigest>& element_digests,
+      const vector<ElementType>& elements,
+      vector<ElementType>* added_elements) = 0;
+
   /* Removes element from the store. No-op if element is not present.
    * Returns whether the element was removed.
    */
   virtual bool Remove(const ElementType& element) = 0;
 
+  /* Removes the element whose digest is element_digest from the store. No-op
+   * if it is not present. Returns whether an element was removed.
+   */
+  virtual bool RemoveDigest(const ObjectIdDigest& element_digest) = 0;
+
   /* Remove elements from the store. If any element in element is not present,
    * the removal is a no-op for that element.
    * When the function returns, removed_elements will have been modified to
@@ -77,9 +96,35 @@ class DigestStore {
   virtual void Remove(const vector<ElementType>& elements,
       vector<ElementType>* removed_elements) = 0;
 
-  /* Removes all elements in this and stores them in elements. */
+  /* Like Remove(elements, removed_elements), for callers that already hold
+   * element_digests, the digests of elements in the same order.
+   */
+  virtual void Remove(const vector<ObjectIdDigest>& element_digests,
+      const vector<ElementType>& elements,
+      vector<ElementType>* removed_elements) = 0;
+
+  /* Removes all elements in this and stores them in elements. Pending
+   * operations are discarded.
+   */
   virtual void RemoveAll(vector<ElementType>* elements) = 0;
 
+  /* Records that an operation of type op_type on each of elements, whose
+   * digests are element_digests, awaits a response from the server, replacing
+   * any operation already pending on it. Pending operations are kept whether
+   * or not the element is in the store, and do not affect its contents.
+   */
+  virtual void SetPendingOperations(
+      const vector<ObjectIdDigest>& element_digests,
+      const vector<ElementType>& elements, RegistrationP::OpType op_type) = 0;
+
+  /* Clears the operation pending on the element whose digest is
+   * element_digest, if any.
+   */
+  virtual void ClearPendingOperation(const ObjectIdDigest& element_digest) = 0;
+
+  /* Appends the pending operations to operations and clears them. */
+  virtual void TakePendingOperations(vector<RegistrationP>* operations) = 0;
+
   /* Returns a string representation of this digest store. */
   virtual string ToString() = 0;
 };
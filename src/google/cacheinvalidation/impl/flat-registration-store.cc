@@ -0,0 +1,352 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compact implementation of DigestStore that keeps registrations in a sorted
+// array of fixed-size entries, with all object names packed into one buffer.
+
+#include "google/cacheinvalidation/impl/flat-registration-store.h"
+
+#include <algorithm>
+
+#include "google/cacheinvalidation/impl/proto-helpers.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::inplace_merge;
+using INVALIDATION_STL_NAMESPACE::lower_bound;
+using INVALIDATION_STL_NAMESPACE::stable_sort;
+
+namespace {
+
+/* Orders indices into a vector of digests by the digests they refer to. */
+class DigestIndexLess {
+ public:
+  explicit DigestIndexLess(const vector<ObjectIdDigest>* digests)
+      : digests_(digests) {}
+
+  bool operator()(size_t first, size_t second) const {
+    return (*digests_)[first] < (*digests_)[second];
+  }
+
+ private:
+  const vector<ObjectIdDigest>* digests_;
+};
+
+}  // namespace
+
+bool FlatRegistrationStore::Add(const ObjectIdP& oid) {
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(oid, digest_function_, &digest);
+  vector<Entry>::iterator iter =
+      lower_bound(entries_.begin(), entries_.end(), digest, EntryLess());
+  if ((iter != entries_.end()) && (iter->digest == digest)) {
+    if (iter->is_element) {
+      return false;
+    }
+    iter->is_element = 1;
+  } else {
+    entries_.insert(iter, MakeEntry(oid, digest));
+  }
+  ++num_elements_;
+  RecomputeDigest();
+  return true;
+}
+
+void FlatRegistrationStore::Add(const vector<ObjectIdP>& oids,
+                                vector<ObjectIdP>* oids_to_send) {
+  vector<ObjectIdDigest> digests;
+  ObjectIdDigestUtils::GetDigests(oids, digest_function_, &digests);
+  Add(digests, oids, oids_to_send);
+}
+
+void FlatRegistrationStore::Add(const vector<ObjectIdDigest>& oid_digests,
+                                const vector<ObjectIdP>& oids,
+                                vector<ObjectIdP>* oids_to_send) {
+  // Objects that only have an operation pending already have an entry; find
+  // the objects that have none.
+  vector<bool> added(oids.size(), false);
+  vector<size_t> missing;
+  bool changed = false;
+  for (size_t i = 0; i < oids.size(); ++i) {
+    int index = Find(oid_digests[i]);
+    if (index < 0) {
+      missing.push_back(i);
+    } else if (!entries_[index].is_element) {
+      entries_[index].is_element = 1;
+      ++num_elements_;
+      added[i] = true;
+      changed = true;
+    }
+  }
+  if (!missing.empty()) {
+    InsertEntries(oid_digests, oids, &missing, true, 0, &added);
+    changed = true;
+  }
+  if (!changed) {
+    return;
+  }
+  for (size_t i = 0; i < oids.size(); ++i) {
+    if (added[i]) {
+      oids_to_send->push_back(oids[i]);
+    }
+  }
+  RecomputeDigest();
+}
+
+bool FlatRegistrationStore::Remove(const ObjectIdP& oid) {
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(oid, digest_function_, &digest);
+  return RemoveDigest(digest);
+}
+
+bool FlatRegistrationStore::RemoveDigest(const ObjectIdDigest& oid_digest) {
+  int index = Find(oid_digest);
+  if ((index < 0) || !entries_[index].is_element) {
+    return false;
+  }
+  --num_elements_;
+  if (entries_[index].pending_operation != 0) {
+    entries_[index].is_element = 0;
+  } else {
+    ReleaseName(entries_[index]);
+    entries_.erase(entries_.begin() + index);
+    MaybeCompactNames();
+  }
+  RecomputeDigest();
+  return true;
+}
+
+void FlatRegistrationStore::Remove(const vector<ObjectIdP>& oids,
+                                   vector<ObjectIdP>* oids_to_send) {
+  vector<ObjectIdDigest> digests;
+  ObjectIdDigestUtils::GetDigests(oids, digest_function_, &digests);
+  Remove(digests, oids, oids_to_send);
+}
+
+void FlatRegistrationStore::Remove(const vector<ObjectIdDigest>& oid_digests,
+                                   const vector<ObjectIdP>& oids,
+                                   vector<ObjectIdP>* oids_to_send) {
+  // Unmark the removed elements, then drop unused entries in a single pass.
+  bool changed = false;
+  for (size_t i = 0; i < oids.size(); ++i) {
+    int index = Find(oid_digests[i]);
+    if ((index >= 0) && entries_[index].is_element) {
+      entries_[index].is_element = 0;
+      --num_elements_;
+      changed = true;
+      oids_to_send->push_back(oids[i]);
+    }
+  }
+  if (!changed) {
+    return;
+  }
+  DropUnusedEntries();
+  RecomputeDigest();
+}
+
+void FlatRegistrationStore::RemoveAll(vector<ObjectIdP>* oids) {
+  GetElements("", 0, oids);
+  entries_.clear();
+  num_elements_ = 0;
+  names_.clear();
+  garbage_name_bytes_ = 0;
+  RecomputeDigest();
+}
+
+void FlatRegistrationStore::SetPendingOperations(
+    const vector<ObjectIdDigest>& oid_digests, const vector<ObjectIdP>& oids,
+    RegistrationP::OpType op_type) {
+  vector<size_t> missing;
+  for (size_t i = 0; i < oids.size(); ++i) {
+    int index = Find(oid_digests[i]);
+    if (index < 0) {
+      missing.push_back(i);
+    } else {
+      entries_[index].pending_operation = op_type;
+    }
+  }
+  if (!missing.empty()) {
+    InsertEntries(oid_digests, oids, &missing, false, op_type, NULL);
+  }
+}
+
+void FlatRegistrationStore::ClearPendingOperation(
+    const ObjectIdDigest& oid_digest) {
+  int index = Find(oid_digest);
+  if (index < 0) {
+    return;
+  }
+  if (entries_[index].is_element) {
+    entries_[index].pending_operation = 0;
+  } else {
+    ReleaseName(entries_[index]);
+    entries_.erase(entries_.begin() + index);
+    MaybeCompactNames();
+  }
+}
+
+void FlatRegistrationStore::TakePendingOperations(
+    vector<RegistrationP>* operations) {
+  bool changed = false;
+  ObjectIdP oid;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    Entry* entry = &entries_[i];
+    if (entry->pending_operation == 0) {
+      continue;
+    }
+    GetObjectId(*entry, &oid);
+    operations->push_back(RegistrationP());
+    ProtoHelpers::InitRegistrationP(oid,
+        static_cast<RegistrationP::OpType>(entry->pending_operation),
+        &operations->back());
+    entry->pending_operation = 0;
+    changed = true;
+  }
+  if (changed) {
+    DropUnusedEntries();
+  }
+}
+
+bool FlatRegistrationStore::Contains(const ObjectIdP& oid) {
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(oid, digest_function_, &digest);
+  return ContainsDigest(digest);
+}
+
+bool FlatRegistrationStore::ContainsDigest(const ObjectIdDigest& oid_digest) {
+  int index = Find(oid_digest);
+  return (index >= 0) && entries_[index].is_element;
+}
+
+void FlatRegistrationStore::GetElements(
+    const string& oid_digest_prefix, int prefix_len,
+    vector<ObjectIdP>* result) {
+  // We always return all the registrations and let the Ticl sort it out.
+  size_t next = result->size();
+  result->resize(next + num_elements_);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].is_element) {
+      GetObjectId(entries_[i], &(*result)[next++]);
+    }
+  }
+}
+
+size_t FlatRegistrationStore::GetMemoryUsage() const {
+  return sizeof(*this) + (entries_.capacity() * sizeof(Entry)) +
+      names_.capacity() + digest_.capacity();
+}
+
+int FlatRegistrationStore::Find(const ObjectIdDigest& digest) const {
+  vector<Entry>::const_iterator iter =
+      lower_bound(entries_.begin(), entries_.end(), digest, EntryLess());
+  if ((iter == entries_.end()) || !(iter->digest == digest)) {
+    return -1;
+  }
+  return iter - entries_.begin();
+}
+
+FlatRegistrationStore::Entry FlatRegistrationStore::MakeEntry(
+    const ObjectIdP& oid, const ObjectIdDigest& digest) {
+  Entry entry;
+  entry.digest = digest;
+  entry.source = oid.source();
+  entry.name_offset = names_.size();
+  entry.name_length = oid.name().size();
+  entry.is_element = 1;
+  entry.pending_operation = 0;
+  names_.append(oid.name());
+  return entry;
+}
+
+void FlatRegistrationStore::InsertEntries(
+    const vector<ObjectIdDigest>& oid_digests, const vector<ObjectIdP>& oids,
+    vector<size_t>* missing, bool is_element, uint32 pending_operation,
+    vector<bool>* inserted) {
+  // Sort the objects by digest. The sort is stable so that only the first of
+  // several equal objects gets an entry.
+  stable_sort(missing->begin(), missing->end(), DigestIndexLess(&oid_digests));
+
+  // Append the new entries in digest order, then merge them into place.
+  size_t old_size = entries_.size();
+  for (size_t i = 0; i < missing->size(); ++i) {
+    size_t index = (*missing)[i];
+    if ((i > 0) && (oid_digests[(*missing)[i - 1]] == oid_digests[index])) {
+      continue;
+    }
+    Entry entry = MakeEntry(oids[index], oid_digests[index]);
+    entry.is_element = is_element ? 1 : 0;
+    entry.pending_operation = pending_operation;
+    entries_.push_back(entry);
+    if (is_element) {
+      ++num_elements_;
+    }
+    if (inserted != NULL) {
+      (*inserted)[index] = true;
+    }
+  }
+  inplace_merge(entries_.begin(), entries_.begin() + old_size, entries_.end(),
+                EntryLess());
+}
+
+void FlatRegistrationStore::DropUnusedEntries() {
+  size_t kept = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (!entries_[i].is_element && (entries_[i].pending_operation == 0)) {
+      ReleaseName(entries_[i]);
+    } else {
+      entries_[kept++] = entries_[i];
+    }
+  }
+  entries_.resize(kept);
+  MaybeCompactNames();
+}
+
+void FlatRegistrationStore::GetObjectId(const Entry& entry,
+                                        ObjectIdP* oid) const {
+  oid->set_source(entry.source);
+  oid->set_name(names_.data() + entry.name_offset, entry.name_length);
+}
+
+void FlatRegistrationStore::ReleaseName(const Entry& entry) {
+  garbage_name_bytes_ += entry.name_length;
+}
+
+void FlatRegistrationStore::MaybeCompactNames() {
+  if (garbage_name_bytes_ * 2 <= names_.size()) {
+    return;
+  }
+  string compacted;
+  compacted.reserve(names_.size() - garbage_name_bytes_);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    Entry* entry = &entries_[i];
+    uint32 offset = compacted.size();
+    compacted.append(names_, entry->name_offset, entry->name_length);
+    entry->name_offset = offset;
+  }
+  names_.swap(compacted);
+  garbage_name_bytes_ = 0;
+}
+
+void FlatRegistrationStore::RecomputeDigest() {
+  digest_function_->Reset();
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].is_element) {
+      digest_function_->UpdateBuffer(entries_[i].digest.bytes,
+                                     ObjectIdDigest::kLength);
+    }
+  }
+  digest_ = digest_function_->GetDigest();
+}
+
+}  // namespace invalidation
@@ -0,0 +1,187 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compact implementation of DigestStore that keeps registrations in a sorted
+// array of fixed-size entries, with all object names packed into one buffer.
+
+#ifndef GOOGLE_CACHEINVALIDATION_IMPL_FLAT_REGISTRATION_STORE_H_
+#define GOOGLE_CACHEINVALIDATION_IMPL_FLAT_REGISTRATION_STORE_H_
+
+#include <string>
+#include <vector>
+
+#include "google/cacheinvalidation/deps/digest-function.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
+#include "google/cacheinvalidation/impl/digest-store.h"
+#include "google/cacheinvalidation/impl/object-id-digest-utils.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::string;
+using INVALIDATION_STL_NAMESPACE::vector;
+
+class FlatRegistrationStore : public DigestStore<ObjectIdP> {
+ public:
+  explicit FlatRegistrationStore(DigestFunction* digest_function)
+      : num_elements_(0), garbage_name_bytes_(0),
+        digest_function_(digest_function) {
+    RecomputeDigest();
+  }
+
+  virtual ~FlatRegistrationStore() {}
+
+  virtual bool Add(const ObjectIdP& oid);
+
+  virtual void Add(const vector<ObjectIdP>& oids,
+                   vector<ObjectIdP>* oids_to_send);
+
+  virtual void Add(const vector<ObjectIdDigest>& oid_digests,
+                   const vector<ObjectIdP>& oids,
+                   vector<ObjectIdP>* oids_to_send);
+
+  virtual bool Remove(const ObjectIdP& oid);
+
+  virtual bool RemoveDigest(const ObjectIdDigest& oid_digest);
+
+  virtual void Remove(const vector<ObjectIdP>& oids,
+                      vector<ObjectIdP>* oids_to_send);
+
+  virtual void Remove(const vector<ObjectIdDigest>& oid_digests,
+                      const vector<ObjectIdP>& oids,
+                      vector<ObjectIdP>* oids_to_send);
+
+  virtual void RemoveAll(vector<ObjectIdP>* oids);
+
+  virtual void SetPendingOperations(const vector<ObjectIdDigest>& oid_digests,
+                                    const vector<ObjectIdP>& oids,
+                                    RegistrationP::OpType op_type);
+
+  virtual void ClearPendingOperation(const ObjectIdDigest& oid_digest);
+
+  virtual void TakePendingOperations(vector<RegistrationP>* operations);
+
+  virtual bool Contains(const ObjectIdP& oid);
+
+  virtual bool ContainsDigest(const ObjectIdDigest& oid_digest);
+
+  virtual int size() {
+    return num_elements_;
+  }
+
+  virtual string GetDigest() {
+    return digest_;
+  }
+
+  virtual void GetElements(const string& oid_digest_prefix, int prefix_len,
+                           vector<ObjectIdP>* result);
+
+  /* Returns the number of heap and inline bytes used by the store. */
+  size_t GetMemoryUsage() const;
+
+  virtual string ToString() {
+    return StringPrintf("FlatRegistrationStore: %d registrations",
+                        static_cast<int>(num_elements_));
+  }
+
+ private:
+  /* An object id that is registered, has an operation pending, or both: the
+   * object id digest plus the location of the object name in names_.
+   */
+  struct Entry {
+    ObjectIdDigest digest;
+    int32 source;
+    uint32 name_offset;
+    uint32 name_length : 29;
+
+    /* Whether the object is in the store, i.e., registered. */
+    uint32 is_element : 1;
+
+    /* The RegistrationP::OpType pending on the object, or 0 if none. */
+    uint32 pending_operation : 2;
+  };
+
+  /* Orders entries (and digests) by digest. */
+  struct EntryLess {
+    bool operator()(const Entry& entry, const ObjectIdDigest& digest) const {
+      return entry.digest < digest;
+    }
+    bool operator()(const Entry& first, const Entry& second) const {
+      return first.digest < second.digest;
+    }
+  };
+
+  /* Returns the index of the entry with the given digest, or -1 if there is
+   * none.
+   */
+  int Find(const ObjectIdDigest& digest) const;
+
+  /* Returns an entry for oid with the given digest, copying the name of oid
+   * into names_.
+   */
+  Entry MakeEntry(const ObjectIdP& oid, const ObjectIdDigest& digest);
+
+  /* Inserts an entry for each object in oids whose index is in missing (which
+   * is reordered), skipping repeated digests. The new entries have the given
+   * is_element and pending_operation. If inserted is not NULL, sets
+   * (*inserted)[i] for each object i that got an entry.
+   */
+  void InsertEntries(const vector<ObjectIdDigest>& oid_digests,
+                     const vector<ObjectIdP>& oids, vector<size_t>* missing,
+                     bool is_element, uint32 pending_operation,
+                     vector<bool>* inserted);
+
+  /* Drops the entries that are neither elements nor have an operation
+   * pending.
+   */
+  void DropUnusedEntries();
+
+  /* Stores the object id described by entry in oid. */
+  void GetObjectId(const Entry& entry, ObjectIdP* oid) const;
+
+  /* Records that the name of entry is no longer referenced. */
+  void ReleaseName(const Entry& entry);
+
+  /* Rewrites names_ so that it holds only names referenced by entries_, if
+   * more than half of it is unreferenced.
+   */
+  void MaybeCompactNames();
+
+  /* Recomputes the digests over all objects and sets this.digest. */
+  void RecomputeDigest();
+
+  /* All registrations and pending operations, sorted by digest. */
+  vector<Entry> entries_;
+
+  /* Number of entries in entries_ that are elements. */
+  int num_elements_;
+
+  /* Names of the registered objects, concatenated. */
+  string names_;
+
+  /* Number of bytes in names_ not referenced by any entry. */
+  size_t garbage_name_bytes_;
+
+  /* The function used to compute digests of objects. */
+  DigestFunction* digest_function_;
+
+  /* The memoized digest of all elements in entries_. */
+  string digest_;
+
+  DISALLOW_COPY_AND_ASSIGN(FlatRegistrationStore);
+};
+
+}  // namespace invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_IMPL_FLAT_REGISTRATION_STORE_H_
@@ -0,0 +1,230 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the flat registration store against the map-based one.
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/sha1-digest-function.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/flat-registration-store.h"
+#include "google/cacheinvalidation/impl/simple-registration-store.h"
+
+namespace invalidation {
+
+class FlatRegistrationStoreTest : public testing::Test {
+ public:
+  // Returns an object id whose name is derived from index.
+  static ObjectIdP MakeObjectId(int index) {
+    ObjectIdP object_id;
+    object_id.set_source(1000 + (index % 3));
+    object_id.set_name(StringPrintf("object-%d", index));
+    return object_id;
+  }
+
+  // Returns object ids for indices [start, start + count).
+  static vector<ObjectIdP> MakeObjectIds(int start, int count) {
+    vector<ObjectIdP> object_ids;
+    for (int i = start; i < start + count; ++i) {
+      object_ids.push_back(MakeObjectId(i));
+    }
+    return object_ids;
+  }
+
+  // Checks that flat and simple hold the same registrations.
+  static void CheckSameContents(FlatRegistrationStore* flat,
+                                SimpleRegistrationStore* simple) {
+    ASSERT_EQ(simple->size(), flat->size());
+    EXPECT_EQ(simple->GetDigest(), flat->GetDigest());
+    vector<ObjectIdP> flat_elements;
+    vector<ObjectIdP> simple_elements;
+    flat->GetElements("", 0, &flat_elements);
+    simple->GetElements("", 0, &simple_elements);
+    ASSERT_EQ(simple_elements.size(), flat_elements.size());
+    for (size_t i = 0; i < simple_elements.size(); ++i) {
+      EXPECT_EQ(simple_elements[i].SerializeAsString(),
+                flat_elements[i].SerializeAsString());
+    }
+  }
+
+  Sha1DigestFunction flat_digest_function_;
+  Sha1DigestFunction simple_digest_function_;
+};
+
+// Tests that single and batched operations give the same results as the
+// map-based store.
+TEST_F(FlatRegistrationStoreTest, MatchesSimpleStore) {
+  FlatRegistrationStore flat(&flat_digest_function_);
+  SimpleRegistrationStore simple(&simple_digest_function_);
+  CheckSameContents(&flat, &simple);
+
+  EXPECT_TRUE(flat.Add(MakeObjectId(7)));
+  EXPECT_TRUE(simple.Add(MakeObjectId(7)));
+  EXPECT_FALSE(flat.Add(MakeObjectId(7)));
+  CheckSameContents(&flat, &simple);
+
+  // A batch with a duplicate and an object that is already present.
+  vector<ObjectIdP> batch = MakeObjectIds(0, 20);
+  batch.push_back(MakeObjectId(3));
+  vector<ObjectIdP> flat_added;
+  vector<ObjectIdP> simple_added;
+  flat.Add(batch, &flat_added);
+  simple.Add(batch, &simple_added);
+  ASSERT_EQ(19U, flat_added.size());
+  for (size_t i = 0; i < flat_added.size(); ++i) {
+    EXPECT_EQ(simple_added[i].SerializeAsString(),
+              flat_added[i].SerializeAsString());
+  }
+  CheckSameContents(&flat, &simple);
+  EXPECT_TRUE(flat.Contains(MakeObjectId(19)));
+  EXPECT_FALSE(flat.Contains(MakeObjectId(20)));
+
+  // Lookups and removals by a precomputed digest.
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(MakeObjectId(11), &flat_digest_function_,
+                                 &digest);
+  EXPECT_TRUE(flat.ContainsDigest(digest));
+  EXPECT_TRUE(simple.ContainsDigest(digest));
+  EXPECT_TRUE(flat.RemoveDigest(digest));
+  EXPECT_TRUE(simple.RemoveDigest(digest));
+  EXPECT_FALSE(flat.ContainsDigest(digest));
+  EXPECT_FALSE(flat.RemoveDigest(digest));
+  EXPECT_FALSE(simple.RemoveDigest(digest));
+  CheckSameContents(&flat, &simple);
+  flat.Add(MakeObjectId(11));
+  simple.Add(MakeObjectId(11));
+
+  EXPECT_TRUE(flat.Remove(MakeObjectId(7)));
+  EXPECT_TRUE(simple.Remove(MakeObjectId(7)));
+  EXPECT_FALSE(flat.Remove(MakeObjectId(7)));
+  CheckSameContents(&flat, &simple);
+
+  batch = MakeObjectIds(5, 30);
+  batch.push_back(MakeObjectId(8));
+  vector<ObjectIdP> flat_removed;
+  vector<ObjectIdP> simple_removed;
+  flat.Remove(batch, &flat_removed);
+  simple.Remove(batch, &simple_removed);
+  EXPECT_EQ(14U, flat_removed.size());
+  EXPECT_EQ(simple_removed.size(), flat_removed.size());
+  CheckSameContents(&flat, &simple);
+
+  vector<ObjectIdP> all;
+  flat.RemoveAll(&all);
+  EXPECT_EQ(5U, all.size());
+  simple.RemoveAll(&all);
+  CheckSameContents(&flat, &simple);
+}
+
+// Tests that names survive compaction of the name buffer.
+TEST_F(FlatRegistrationStoreTest, CompactsNames) {
+  FlatRegistrationStore flat(&flat_digest_function_);
+  SimpleRegistrationStore simple(&simple_digest_function_);
+  vector<ObjectIdP> ignored;
+  flat.Add(MakeObjectIds(0, 100), &ignored);
+  simple.Add(MakeObjectIds(0, 100), &ignored);
+  for (int i = 0; i < 90; i += 2) {
+    flat.Remove(MakeObjectId(i));
+    simple.Remove(MakeObjectId(i));
+  }
+  flat.Remove(MakeObjectIds(50, 40), &ignored);
+  simple.Remove(MakeObjectIds(50, 40), &ignored);
+  CheckSameContents(&flat, &simple);
+  EXPECT_TRUE(flat.Contains(MakeObjectId(95)));
+  EXPECT_TRUE(flat.Contains(MakeObjectId(1)));
+}
+
+// Tests that pending operations are kept apart from the registrations and
+// match the map-based store.
+TEST_F(FlatRegistrationStoreTest, KeepsPendingOperations) {
+  FlatRegistrationStore flat(&flat_digest_function_);
+  SimpleRegistrationStore simple(&simple_digest_function_);
+  vector<ObjectIdP> ignored;
+  flat.Add(MakeObjectIds(0, 10), &ignored);
+  simple.Add(MakeObjectIds(0, 10), &ignored);
+
+  // Pending operations on registered and unregistered objects leave the
+  // registrations unchanged.
+  vector<ObjectIdP> registering = MakeObjectIds(5, 10);
+  vector<ObjectIdDigest> registering_digests;
+  ObjectIdDigestUtils::GetDigests(registering, &flat_digest_function_,
+                                  &registering_digests);
+  flat.SetPendingOperations(registering_digests, registering,
+                            RegistrationP_OpType_REGISTER);
+  simple.SetPendingOperations(registering_digests, registering,
+                              RegistrationP_OpType_REGISTER);
+  CheckSameContents(&flat, &simple);
+  EXPECT_FALSE(flat.Contains(MakeObjectId(12)));
+
+  // Registering an object with a pending operation adds it once.
+  vector<ObjectIdP> flat_added;
+  vector<ObjectIdP> simple_added;
+  flat.Add(registering_digests, registering, &flat_added);
+  simple.Add(registering_digests, registering, &simple_added);
+  EXPECT_EQ(5, static_cast<int>(flat_added.size()));
+  EXPECT_EQ(simple_added.size(), flat_added.size());
+  CheckSameContents(&flat, &simple);
+
+  // Unregistering keeps the entry while its operation is pending.
+  vector<ObjectIdP> unregistering = MakeObjectIds(12, 3);
+  vector<ObjectIdDigest> unregistering_digests;
+  ObjectIdDigestUtils::GetDigests(unregistering, &flat_digest_function_,
+                                  &unregistering_digests);
+  flat.SetPendingOperations(unregistering_digests, unregistering,
+                            RegistrationP_OpType_UNREGISTER);
+  simple.SetPendingOperations(unregistering_digests, unregistering,
+                              RegistrationP_OpType_UNREGISTER);
+  vector<ObjectIdP> flat_removed;
+  vector<ObjectIdP> simple_removed;
+  flat.Remove(unregistering_digests, unregistering, &flat_removed);
+  simple.Remove(unregistering_digests, unregistering, &simple_removed);
+  EXPECT_EQ(3, static_cast<int>(flat_removed.size()));
+  CheckSameContents(&flat, &simple);
+
+  // Clear one operation on a registered object and one on an unregistered
+  // object, then take the rest.
+  flat.ClearPendingOperation(registering_digests[0]);
+  simple.ClearPendingOperation(registering_digests[0]);
+  flat.ClearPendingOperation(unregistering_digests[0]);
+  simple.ClearPendingOperation(unregistering_digests[0]);
+  vector<RegistrationP> flat_operations;
+  vector<RegistrationP> simple_operations;
+  flat.TakePendingOperations(&flat_operations);
+  simple.TakePendingOperations(&simple_operations);
+  ASSERT_EQ(8, static_cast<int>(flat_operations.size()));
+  ASSERT_EQ(simple_operations.size(), flat_operations.size());
+  for (size_t i = 0; i < simple_operations.size(); ++i) {
+    EXPECT_EQ(simple_operations[i].SerializeAsString(),
+              flat_operations[i].SerializeAsString());
+  }
+  CheckSameContents(&flat, &simple);
+
+  // No operations are left, and only registered objects keep entries.
+  flat_operations.clear();
+  flat.TakePendingOperations(&flat_operations);
+  EXPECT_TRUE(flat_operations.empty());
+  EXPECT_TRUE(flat.Contains(MakeObjectId(11)));
+  EXPECT_FALSE(flat.Contains(MakeObjectId(13)));
+
+  // RemoveAll discards pending operations.
+  flat.SetPendingOperations(unregistering_digests, unregistering,
+                            RegistrationP_OpType_REGISTER);
+  vector<ObjectIdP> all;
+  flat.RemoveAll(&all);
+  EXPECT_EQ(12, static_cast<int>(all.size()));
+  flat.TakePendingOperations(&flat_operations);
+  EXPECT_TRUE(flat_operations.empty());
+  EXPECT_EQ(0, flat.size());
+}
+
+}  // namespace invalidation
@@ -0,0 +1,56 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Chooses the interval between heartbeats.
+
+#include "google/cacheinvalidation/impl/heartbeat-policy.h"
+
+#include <algorithm>
+
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::max;
+using INVALIDATION_STL_NAMESPACE::min;
+
+HeartbeatPolicy::HeartbeatPolicy(
+    TimeDelta interval, TimeDelta max_idle_interval,
+    TimeDelta out_of_sync_interval)
+    : interval_(interval), max_idle_interval_(max(interval, max_idle_interval)),
+      out_of_sync_interval_(min(interval, out_of_sync_interval)),
+      idle_heartbeats_(0) {
+}
+
+void HeartbeatPolicy::RecordActivity() {
+  idle_heartbeats_ = 0;
+}
+
+void HeartbeatPolicy::RecordHeartbeat() {
+  // Once the interval has reached the maximum, stop counting so that the
+  // shift below cannot overflow.
+  if ((interval_ > TimeDelta()) && (GetInterval(true) < max_idle_interval_)) {
+    ++idle_heartbeats_;
+  }
+}
+
+TimeDelta HeartbeatPolicy::GetInterval(bool is_in_sync) const {
+  if (!is_in_sync) {
+    return out_of_sync_interval_;
+  }
+  int64 interval_ms = interval_.InMilliseconds() << idle_heartbeats_;
+  return min(TimeDelta::FromMilliseconds(interval_ms), max_idle_interval_);
+}
+
+}  // namespace invalidation
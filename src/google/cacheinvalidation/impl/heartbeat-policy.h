@@ -0,0 +1,66 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Chooses the interval between heartbeats. A client that stays idle and in
+// sync with the server backs off, doubling the interval after each heartbeat
+// up to a maximum, since its heartbeats only tell the server that it is still
+// alive. Any activity resets the interval. While the registrations are out of
+// sync, heartbeats carry a request for the server's registration summary, so
+// the interval is tightened to let the client converge quickly.
+
+#ifndef GOOGLE_CACHEINVALIDATION_IMPL_HEARTBEAT_POLICY_H_
+#define GOOGLE_CACHEINVALIDATION_IMPL_HEARTBEAT_POLICY_H_
+
+#include "google/cacheinvalidation/deps/time.h"
+
+namespace invalidation {
+
+class HeartbeatPolicy {
+ public:
+  /* Creates a policy with the given base interval, backing off up to
+   * max_idle_interval and tightening to out_of_sync_interval.
+   */
+  HeartbeatPolicy(TimeDelta interval, TimeDelta max_idle_interval,
+                  TimeDelta out_of_sync_interval);
+
+  /* Records activity other than heartbeats, e.g., (un)registrations or
+   * invalidations, which resets the interval.
+   */
+  void RecordActivity();
+
+  /* Records that a heartbeat was sent while the client was in sync. */
+  void RecordHeartbeat();
+
+  /* Returns the interval until the next heartbeat, given whether the
+   * registrations are in sync with the server.
+   */
+  TimeDelta GetInterval(bool is_in_sync) const;
+
+ private:
+  /* Interval used after activity. */
+  TimeDelta interval_;
+
+  /* Largest interval reached by backing off. */
+  TimeDelta max_idle_interval_;
+
+  /* Interval used while the registrations are out of sync. */
+  TimeDelta out_of_sync_interval_;
+
+  /* Number of heartbeats sent since the last activity. */
+  int idle_heartbeats_;
+};
+
+}  // namespace invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_IMPL_HEARTBEAT_POLICY_H_
@@ -0,0 +1,72 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the heartbeat policy. Its use by the heartbeat task is tested through
+// the client in invalidation-client-impl_test.cc.
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/time.h"
+#include "google/cacheinvalidation/impl/heartbeat-policy.h"
+
+namespace invalidation {
+
+class HeartbeatPolicyTest : public testing::Test {
+ public:
+  HeartbeatPolicyTest()
+      : policy_(Minutes(kIntervalMinutes), Minutes(kMaxIdleIntervalMinutes),
+                Minutes(kOutOfSyncIntervalMinutes)) {}
+
+  static TimeDelta Minutes(int minutes) {
+    return TimeDelta::FromMilliseconds(minutes * 60 * 1000);
+  }
+
+  static int InMinutes(TimeDelta delta) {
+    return static_cast<int>(delta.InMilliseconds() / (60 * 1000));
+  }
+
+  static const int kIntervalMinutes;
+  static const int kMaxIdleIntervalMinutes;
+  static const int kOutOfSyncIntervalMinutes;
+
+  HeartbeatPolicy policy_;
+};
+
+const int HeartbeatPolicyTest::kIntervalMinutes = 20;
+const int HeartbeatPolicyTest::kMaxIdleIntervalMinutes = 120;
+const int HeartbeatPolicyTest::kOutOfSyncIntervalMinutes = 1;
+
+// Tests that the interval of an idle client doubles up to the maximum, and
+// that activity resets it.
+TEST_F(HeartbeatPolicyTest, BacksOffWhenIdle) {
+  ASSERT_EQ(20, InMinutes(policy_.GetInterval(true)));
+  policy_.RecordHeartbeat();
+  ASSERT_EQ(40, InMinutes(policy_.GetInterval(true)));
+  policy_.RecordHeartbeat();
+  ASSERT_EQ(80, InMinutes(policy_.GetInterval(true)));
+  for (int i = 0; i < 100; ++i) {
+    policy_.RecordHeartbeat();
+  }
+  ASSERT_EQ(kMaxIdleIntervalMinutes, InMinutes(policy_.GetInterval(true)));
+  policy_.RecordActivity();
+  ASSERT_EQ(20, InMinutes(policy_.GetInterval(true)));
+}
+
+// Tests that the interval tightens while the registrations are out of sync.
+TEST_F(HeartbeatPolicyTest, TightensWhenOutOfSync) {
+  policy_.RecordHeartbeat();
+  ASSERT_EQ(kOutOfSyncIntervalMinutes, InMinutes(policy_.GetInterval(false)));
+  ASSERT_EQ(40, InMinutes(policy_.GetInterval(true)));
+}
+
+}  // namespace invalidation
@@ -0,0 +1,69 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lock-free queue of client API calls, filled by application threads and
+// drained by the client's internal thread.
+
+#include "google/cacheinvalidation/impl/ingress-queue.h"
+
+namespace invalidation {
+
+IngressQueue::~IngressQueue() {
+  IngressOperation* operation = PopAll();
+  while (operation != NULL) {
+    IngressOperation* next = operation->next;
+    delete operation;
+    operation = next;
+  }
+}
+
+bool IngressQueue::Push(IngressOperation* operation) {
+  AtomicWord new_head = reinterpret_cast<AtomicWord>(operation);
+  AtomicWord old_head = NoBarrier_Load(&head_);
+  while (true) {
+    operation->next = reinterpret_cast<IngressOperation*>(old_head);
+    AtomicWord previous_head =
+        Release_CompareAndSwap(&head_, old_head, new_head);
+    if (previous_head == old_head) {
+      return old_head == 0;
+    }
+    old_head = previous_head;
+  }
+}
+
+IngressOperation* IngressQueue::PopAll() {
+  // Detach the whole list. Producers only ever push, so there is no ABA
+  // problem in swapping the head for NULL.
+  AtomicWord old_head = NoBarrier_Load(&head_);
+  while (old_head != 0) {
+    AtomicWord previous_head = Acquire_CompareAndSwap(&head_, old_head, 0);
+    if (previous_head == old_head) {
+      break;
+    }
+    old_head = previous_head;
+  }
+
+  // The list is newest first; reverse it.
+  IngressOperation* operation = reinterpret_cast<IngressOperation*>(old_head);
+  IngressOperation* oldest = NULL;
+  while (operation != NULL) {
+    IngressOperation* next = operation->next;
+    operation->next = oldest;
+    oldest = operation;
+    operation = next;
+  }
+  return oldest;
+}
+
+}  // namespace invalidation
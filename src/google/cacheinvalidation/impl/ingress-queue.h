@@ -0,0 +1,88 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lock-free queue of client API calls, filled by application threads and
+// drained by the client's internal thread.
+
+#ifndef GOOGLE_CACHEINVALIDATION_IMPL_INGRESS_QUEUE_H_
+#define GOOGLE_CACHEINVALIDATION_IMPL_INGRESS_QUEUE_H_
+
+#include <vector>
+
+#include "google/cacheinvalidation/include/types.h"
+#include "google/cacheinvalidation/deps/atomicops.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::vector;
+
+/* A call made on the client API, waiting to be run on the internal thread. */
+struct IngressOperation {
+  enum Type {
+    START,
+    STOP,
+    REGISTER,
+    UNREGISTER,
+    ACKNOWLEDGE
+  };
+
+  explicit IngressOperation(Type operation_type)
+      : type(operation_type), ack_handle(""), next(NULL) {}
+
+  Type type;
+
+  /* Objects to (un)register, for REGISTER and UNREGISTER. */
+  vector<ObjectId> object_ids;
+
+  /* Handle being acknowledged, for ACKNOWLEDGE. */
+  AckHandle ack_handle;
+
+  /* Next operation in the queue. */
+  IngressOperation* next;
+};
+
+/* A multi-producer, single-consumer queue of operations. Any thread may push
+ * without blocking; a single consumer thread removes everything queued so far
+ * in one step.
+ */
+class IngressQueue {
+ public:
+  IngressQueue() : head_(0) {}
+
+  /* Deletes any operations that were never removed. */
+  ~IngressQueue();
+
+  /* Adds operation (owned by this after the call) to the queue. Returns whether
+   * the queue was empty, in which case the caller must arrange for the
+   * consumer to call PopAll.
+   */
+  bool Push(IngressOperation* operation);
+
+  /* Removes all queued operations and returns them as a list linked through
+   * next, oldest first, or NULL if the queue is empty. Ownership of the
+   * operations passes to the caller. May only be called by the consumer.
+   */
+  IngressOperation* PopAll();
+
+ private:
+  /* Most recently pushed operation, linked to older ones through next. */
+  volatile AtomicWord head_;
+
+  DISALLOW_COPY_AND_ASSIGN(IngressQueue);
+};
+
+}  // namespace invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_IMPL_INGRESS_QUEUE_H_
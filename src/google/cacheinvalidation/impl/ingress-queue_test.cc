@@ -0,0 +1,118 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the ingress queue with concurrent producers.
+
+#include <pthread.h>
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/impl/ingress-queue.h"
+
+namespace invalidation {
+
+class IngressQueueTest : public testing::Test {
+ public:
+  // Arguments of a producer thread.
+  struct Producer {
+    IngressQueue* queue;
+    int source;
+    int count;
+  };
+
+  // Pushes producer->count registrations of objects (source, 0), (source, 1),
+  // ... in order.
+  static void* Produce(void* arg) {
+    Producer* producer = static_cast<Producer*>(arg);
+    for (int i = 0; i < producer->count; ++i) {
+      IngressOperation* operation =
+          new IngressOperation(IngressOperation::REGISTER);
+      operation->object_ids.push_back(ObjectId(producer->source, ""));
+      operation->ack_handle = AckHandle(string(1, static_cast<char>(i % 128)));
+      producer->queue->Push(operation);
+    }
+    return NULL;
+  }
+
+  // Deletes a list of operations linked through next. Returns its length.
+  static int DeleteAll(IngressOperation* operation) {
+    int count = 0;
+    while (operation != NULL) {
+      IngressOperation* next = operation->next;
+      delete operation;
+      operation = next;
+      ++count;
+    }
+    return count;
+  }
+};
+
+// Tests that operations come out oldest first, and that Push reports when the
+// queue was empty.
+TEST_F(IngressQueueTest, PopsInOrder) {
+  IngressQueue queue;
+  EXPECT_TRUE(queue.PopAll() == NULL);
+  EXPECT_TRUE(queue.Push(new IngressOperation(IngressOperation::START)));
+  EXPECT_FALSE(queue.Push(new IngressOperation(IngressOperation::REGISTER)));
+  EXPECT_FALSE(queue.Push(new IngressOperation(IngressOperation::STOP)));
+
+  IngressOperation* operations = queue.PopAll();
+  ASSERT_TRUE(operations != NULL);
+  EXPECT_EQ(IngressOperation::START, operations->type);
+  EXPECT_EQ(IngressOperation::REGISTER, operations->next->type);
+  EXPECT_EQ(IngressOperation::STOP, operations->next->next->type);
+  EXPECT_EQ(3, DeleteAll(operations));
+
+  EXPECT_TRUE(queue.PopAll() == NULL);
+  EXPECT_TRUE(queue.Push(new IngressOperation(IngressOperation::ACKNOWLEDGE)));
+  // The remaining operation is deleted by the queue's destructor.
+}
+
+// Tests that no operation is lost or reordered when several threads push while
+// the consumer drains.
+TEST_F(IngressQueueTest, ConcurrentProducers) {
+  const int kNumThreads = 4;
+  const int kCount = 50000;
+  IngressQueue queue;
+  vector<Producer> producers(kNumThreads);
+  vector<pthread_t> threads(kNumThreads);
+  for (int i = 0; i < kNumThreads; ++i) {
+    Producer producer = { &queue, i, kCount };
+    producers[i] = producer;
+    pthread_create(&threads[i], NULL, &Produce, &producers[i]);
+  }
+
+  // Each producer's operations must arrive in the order they were pushed.
+  vector<int> received(kNumThreads, 0);
+  int total = 0;
+  while (total < kNumThreads * kCount) {
+    IngressOperation* operation = queue.PopAll();
+    while (operation != NULL) {
+      int source = operation->object_ids[0].source();
+      EXPECT_EQ(static_cast<char>(received[source] % 128),
+                operation->ack_handle.handle_data()[0]);
+      ++received[source];
+      ++total;
+      IngressOperation* next = operation->next;
+      delete operation;
+      operation = next;
+    }
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ(kCount, received[i]);
+  }
+  EXPECT_TRUE(queue.PopAll() == NULL);
+}
+
+}  // namespace invalidation
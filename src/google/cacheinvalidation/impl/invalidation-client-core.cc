@@ -16,12 +16,14 @@
 
 #include "google/cacheinvalidation/impl/invalidation-client-core.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "google/cacheinvalidation/client_test_internal.pb.h"
 #include "google/cacheinvalidation/deps/callback.h"
 #include "google/cacheinvalidation/deps/random.h"
 #include "google/cacheinvalidation/deps/sha1-digest-function.h"
+#include "google/cacheinvalidation/deps/stl-namespace.h"
 #include "google/cacheinvalidation/deps/string_util.h"
 #include "google/cacheinvalidation/impl/exponential-backoff-delay-generator.h"
 #include "google/cacheinvalidation/impl/invalidation-client-util.h"
@@ -35,6 +37,9 @@
 namespace invalidation {
 
 using ::ipc::invalidation::RegistrationManagerStateP;
+using INVALIDATION_STL_NAMESPACE::max;
+using INVALIDATION_STL_NAMESPACE::min;
+using INVALIDATION_STL_NAMESPACE::sort;
 
 const char* InvalidationClientCore::kClientTokenKey = "ClientToken";
 
@@ -50,7 +55,8 @@ AcquireTokenTask::AcquireTokenTask(InvalidationClientCore* client)
             client->config_.network_timeout_delay_ms())),
         Scheduler::NoDelay(),
         TimeDelta::FromMilliseconds(
-            client->config_.network_timeout_delay_ms())),
+            client->config_.network_timeout_delay_ms()),
+        Scheduler::NORMAL_PRIORITY),
       client_(client) {
   }
 
@@ -86,7 +92,8 @@ RegSyncHeartbeatTask::RegSyncHeartbeatTask(InvalidationClientCore* client)
         TimeDelta::FromMilliseconds(
             client->config_.network_timeout_delay_ms()),
         TimeDelta::FromMilliseconds(
-            client->config_.network_timeout_delay_ms())),
+            client->config_.network_timeout_delay_ms()),
+        Scheduler::LOW_PRIORITY),
       client_(client) {
 }
 
@@ -115,13 +122,19 @@ PersistentWriteTask::PersistentWriteTask(InvalidationClientCore* client)
             client->config_.write_retry_delay_ms())),
         Scheduler::NoDelay(),
         TimeDelta::FromMilliseconds(
-            client->config_.write_retry_delay_ms())),
-      client_(client) {
+            client->config_.write_retry_delay_ms()),
+        Scheduler::LOW_PRIORITY),
+      client_(client),
+      last_written_cache_generation_(0) {
 }
 
 bool PersistentWriteTask::RunTask() {
+  bool persist_cache = client_->config_.persist_object_version_cache();
+  int64 cache_generation = client_->object_version_cache_.generation();
   if (client_->client_token_.empty() ||
-      (client_->client_token_ == last_written_token_)) {
+      ((client_->client_token_ == last_written_token_) &&
+       (!persist_cache ||
+        (cache_generation == last_written_cache_generation_)))) {
     // No work to be done
     return false;  // Do not reschedule
   }
@@ -129,23 +142,29 @@ bool PersistentWriteTask::RunTask() {
   // Persistent write needs to happen.
   PersistentTiclState state;
   state.set_client_token(client_->client_token_);
+  if (persist_cache) {
+    client_->object_version_cache_.GetEntries(state.mutable_object_version());
+  }
   string serialized_state;
   PersistenceUtils::SerializeState(state, client_->digest_fn_.get(),
       &serialized_state);
   client_->storage_->WriteKey(InvalidationClientCore::kClientTokenKey,
       serialized_state,
       NewPermanentCallback(this, &PersistentWriteTask::WriteCallback,
-          client_->client_token_));
+          client_->client_token_, cache_generation));
   return true;  // Reschedule after timeout to make sure that write does happen.
 }
 
-void PersistentWriteTask::WriteCallback(const string& token, Status status) {
+void PersistentWriteTask::WriteCallback(const string& token,
+                                        int64 cache_generation,
+                                        Status status) {
   TLOG(client_->logger_, INFO, "Write state completed: %d, %s",
        status.IsSuccess(), status.message().c_str());
   if (status.IsSuccess()) {
     // Set lastWrittenToken to be the token that was written (NOT client_token_:
     // which could have changed while the write was happening).
     last_written_token_ = token;
+    last_written_cache_generation_ = cache_generation;
   } else {
     client_->statistics_->RecordError(
         Statistics::ClientErrorType_PERSISTENT_WRITE_FAILURE);
@@ -163,8 +182,10 @@ HeartbeatTask::HeartbeatTask(InvalidationClientCore* client)
         NULL,
         TimeDelta::FromMilliseconds(
             client->config_.heartbeat_interval_ms()),
-        Scheduler::NoDelay()),
-      client_(client) {
+        Scheduler::NoDelay(),
+        Scheduler::LOW_PRIORITY),
+      client_(client),
+      is_suspended_(false) {
   next_performance_send_time_ = client_->internal_scheduler_->GetCurrentTime() +
       smearer()->GetSmearedDelay(TimeDelta::FromMilliseconds(
           client_->config_.perf_counter_delay_ms()));
@@ -173,36 +194,152 @@ HeartbeatTask::HeartbeatTask(InvalidationClientCore* client)
 bool HeartbeatTask::RunTask() {
   // Send info message. If needed, send performance counters and reset the next
   // performance counter send time.
-  TLOG(client_->logger_, INFO, "Sending heartbeat to server: %s",
-       client_->ToString().c_str());
   Scheduler *scheduler = client_->internal_scheduler_;
-  bool must_send_perf_counters =
-      next_performance_send_time_ > scheduler->GetCurrentTime();
+  Time now = scheduler->GetCurrentTime();
+  bool adaptive = client_->config_.adaptive_heartbeats();
+  if (adaptive && !client_->is_online_) {
+    // A heartbeat cannot reach the server; resume when the network is back.
+    TLOG(client_->logger_, FINE, "Suspending heartbeats while offline");
+    is_suspended_ = true;
+    return false;  // Don't reschedule.
+  }
+  TimeDelta base_interval = TimeDelta::FromMilliseconds(
+      client_->config_.heartbeat_interval_ms());
+  bool must_send_perf_counters = next_performance_send_time_ <= now;
+  bool must_request_server_summary =
+      !client_->registration_manager_.IsStateInSyncWithServer();
+  TimeDelta heartbeat_interval = adaptive ?
+      client_->heartbeat_policy_.GetInterval(!must_request_server_summary) :
+      base_interval;
+
+  // A heartbeat that has nothing else to say than that the client is alive is
+  // deferred while it is not due. Every message to the server carries the
+  // header and registration summary, so with traffic-aware heartbeats, it is
+  // not due until one interval after the last message sent. With adaptive
+  // heartbeats, it is not due until one (backed-off) interval after the last
+  // heartbeat.
+  Time next_heartbeat_time = now;
+  if (!must_send_perf_counters && !must_request_server_summary) {
+    if (client_->config_.traffic_aware_heartbeats()) {
+      next_heartbeat_time = max(next_heartbeat_time,
+          client_->last_message_send_time_ + heartbeat_interval);
+    }
+    if (adaptive) {
+      next_heartbeat_time = max(next_heartbeat_time,
+          last_heartbeat_time_ + heartbeat_interval);
+    }
+  }
+
+  // Check again at least once per base interval, so that activity or a loss
+  // of sync is noticed even when the interval has backed off.
+  if (next_heartbeat_time > now) {
+    TLOG(client_->logger_, FINE,
+         "Deferring heartbeat; previous send was %s ms ago",
+         SimpleItoa((now - client_->last_message_send_time_)
+                    .InMilliseconds()).c_str());
+    set_initial_delay(min(next_heartbeat_time - now, base_interval));
+    return true;  // Reschedule.
+  }
+
   if (must_send_perf_counters) {
-    next_performance_send_time_ = scheduler->GetCurrentTime() +
+    next_performance_send_time_ = now +
         client_->smearer_.GetSmearedDelay(TimeDelta::FromMilliseconds(
             client_->config_.perf_counter_delay_ms()));
   }
 
+  // If a batch is pending, the info message is added to it and so goes out
+  // with that batch rather than in a message of its own.
   TLOG(client_->logger_, INFO, "Sending heartbeat to server: %s",
        client_->ToString().c_str());
   client_->SendInfoMessageToServer(must_send_perf_counters,
-      !client_->registration_manager_.IsStateInSyncWithServer());
+      must_request_server_summary);
+  last_heartbeat_time_ = now;
+  if (adaptive) {
+    if (!must_request_server_summary) {
+      client_->heartbeat_policy_.RecordHeartbeat();
+    }
+    heartbeat_interval =
+        client_->heartbeat_policy_.GetInterval(!must_request_server_summary);
+  }
+  set_initial_delay(min(heartbeat_interval, base_interval));
   return true;  // Reschedule.
 }
 
+void HeartbeatTask::ResumeIfSuspended() {
+  if (is_suspended_) {
+    is_suspended_ = false;
+    EnsureScheduled("Heartbeat-after-reconnection");
+  }
+}
+
+// RegistrationDebounceTask
+
+RegistrationDebounceTask::RegistrationDebounceTask(
+    InvalidationClientCore* client)
+    : RecurringTask(
+        "RegistrationDebounce",
+        client->internal_scheduler_,
+        client->logger_,
+        &client->smearer_,
+        NULL,
+        TimeDelta::FromMilliseconds(
+            client->config_.registration_debounce_delay_ms()),
+        Scheduler::NoDelay(),
+        Scheduler::NORMAL_PRIORITY),
+      client_(client) {
+}
+
+bool RegistrationDebounceTask::RunTask() {
+  client_->FlushDebouncedRegistrations();
+  return false;  // Don't reschedule.
+}
+
 BatchingTask::BatchingTask(
     ProtocolHandler *handler, Smearer* smearer, TimeDelta batching_delay)
     : RecurringTask(
         "Batching", handler->internal_scheduler_, handler->logger_, smearer,
-        NULL,  batching_delay, Scheduler::NoDelay()),
-        protocol_handler_(handler) {
+        NULL,  batching_delay, Scheduler::NoDelay(),
+        Scheduler::HIGH_PRIORITY),
+        protocol_handler_(handler),
+        batching_delay_(batching_delay) {
+}
+
+BatchingTask::BatchingTask(const string& name,
+    ProtocolHandler *handler, Smearer* smearer, TimeDelta batching_delay)
+    : RecurringTask(
+        name, handler->internal_scheduler_, handler->logger_, smearer,
+        NULL,  batching_delay, Scheduler::NoDelay(),
+        Scheduler::HIGH_PRIORITY),
+        protocol_handler_(handler),
+        batching_delay_(batching_delay) {
 }
 
 bool BatchingTask::RunTask() {
   // Send message to server - the batching information is picked up in
   // SendMessageToServer.
   protocol_handler_->SendMessageToServer();
+
+  // Registrations held back by the pacer go out with a later batch.
+  if (protocol_handler_->HasPacedRegistrations()) {
+    TimeDelta delay = max(protocol_handler_->GetPacedRegistrationDelay(),
+                          batching_delay_);
+    set_initial_delay(max(delay, TimeDelta::FromMilliseconds(1)));
+    return true;  // Reschedule.
+  }
+  set_initial_delay(batching_delay_);
+  return false;  // Don't reschedule.
+}
+
+// AckBatchingTask
+
+AckBatchingTask::AckBatchingTask(
+    ProtocolHandler *handler, Smearer* smearer, TimeDelta ack_batching_delay)
+    : BatchingTask("AckBatching", handler, smearer, ack_batching_delay) {
+}
+
+bool AckBatchingTask::RunTask() {
+  // Send the acks (and whatever else is batched), within the rate limits.
+  protocol_handler_->SendPendingAcks();
   return false;  // Don't reschedule.
 }
 
@@ -213,17 +350,27 @@ InvalidationClientCore::InvalidationClientCore(
     : resources_(resources),
       internal_scheduler_(resources->internal_scheduler()),
       logger_(resources->logger()),
-      storage_(new SafeStorage(resources->storage())),
+      storage_(new SafeStorage(resources->storage(),
+                               Scheduler::LOW_PRIORITY)),
       statistics_(new Statistics()),
       config_(config),
       digest_fn_(new Sha1DigestFunction()),
       registration_manager_(logger_, statistics_.get(), digest_fn_.get()),
+      object_version_cache_(config.object_version_cache_size()),
       msg_validator_(new TiclMessageValidator(logger_)),
       smearer_(random, config.smear_percent()),
       protocol_handler_(config.protocol_handler_config(), resources, &smearer_,
           statistics_.get(), client_type, application_name, this,
           msg_validator_.get()),
       is_online_(true),
+      heartbeat_policy_(
+          TimeDelta::FromMilliseconds(config.heartbeat_interval_ms()),
+          TimeDelta::FromMilliseconds(
+              config.max_idle_heartbeat_interval_ms()),
+          TimeDelta::FromMilliseconds(
+              config.out_of_sync_heartbeat_interval_ms())),
+      reg_sync_next_index_(0),
+      reg_sync_confirmed_index_(0),
       random_(random) {
   storage_.get()->SetSystemResources(resources_);
   application_client_id_.set_client_name(client_name);
@@ -252,6 +399,11 @@ void InvalidationClientCore::CreateSchedulingTasks() {
       &smearer_,
       TimeDelta::FromMilliseconds(
           config_.protocol_handler_config().batching_delay_ms())));
+  ack_batching_task_.reset(new AckBatchingTask(&protocol_handler_,
+      &smearer_,
+      TimeDelta::FromMilliseconds(
+          config_.protocol_handler_config().ack_batching_delay_ms())));
+  registration_debounce_task_.reset(new RegistrationDebounceTask(this));
 }
 
 void InvalidationClientCore::InitConfig(ClientConfigP* config) {
@@ -326,6 +478,9 @@ void InvalidationClientCore::StartInternal(const string& serialized_state) {
     set_nonce("");
     set_client_token(persistent_state.client_token());
     should_send_registrations_ = false;
+    if (config_.persist_object_version_cache()) {
+      object_version_cache_.MergeEntries(persistent_state.object_version());
+    }
 
     // Schedule an info message for the near future. We delay a little bit to
     // allow the application to reissue its registrations locally and avoid
@@ -378,14 +533,25 @@ void InvalidationClientCore::Unregister(const ObjectId& object_id) {
 
 void InvalidationClientCore::PerformRegisterOperations(
     const vector<ObjectId>& object_ids, RegistrationP::OpType reg_op_type) {
+  vector<const vector<ObjectId>*> object_id_lists(1, &object_ids);
+  PerformBulkRegisterOperations(object_id_lists, reg_op_type);
+}
+
+void InvalidationClientCore::PerformBulkRegisterOperations(
+    const vector<const vector<ObjectId>*>& object_id_lists,
+    RegistrationP::OpType reg_op_type) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
-  CHECK(!object_ids.empty()) << "Must specify some object id";
+  size_t num_objects = 0;
+  for (size_t i = 0; i < object_id_lists.size(); ++i) {
+    num_objects += object_id_lists[i]->size();
+  }
+  CHECK(num_objects > 0) << "Must specify some object id";
 
   if (ticl_state_.IsStopped()) {
     // The Ticl has been stopped. This might be some old registration op
     // coming in. Just ignore instead of crashing.
     TLOG(logger_, SEVERE, "Ticl stopped: register (%d) of %d objects ignored.",
-         reg_op_type, object_ids.size());
+         reg_op_type, num_objects);
     return;
   }
   if (!ticl_state_.IsStarted()) {
@@ -395,30 +561,73 @@ void InvalidationClientCore::PerformRegisterOperations(
     TLOG(logger_, SEVERE,
         "Ticl is not yet started; failing registration call; client = %s, "
          "num-objects = %d, op = %d",
-        this->ToString().c_str(), object_ids.size(), reg_op_type);
-    for (size_t i = 0; i < object_ids.size(); ++i) {
-      const ObjectId& object_id = object_ids[i];
-      GetListener()->InformRegistrationFailure(this, object_id, true,
-                                               "Client not yet ready");
+        this->ToString().c_str(), num_objects, reg_op_type);
+    for (size_t i = 0; i < object_id_lists.size(); ++i) {
+      const vector<ObjectId>& object_ids = *object_id_lists[i];
+      for (size_t j = 0; j < object_ids.size(); ++j) {
+        GetListener()->InformRegistrationFailure(this, object_ids[j], true,
+                                                 "Client not yet ready");
+      }
     }
     return;
   }
+  heartbeat_policy_.RecordActivity();
 
   vector<ObjectIdP> object_id_protos;
-  for (size_t i = 0; i < object_ids.size(); ++i) {
-    const ObjectId& object_id = object_ids[i];
-    ObjectIdP object_id_proto;
-    ProtoConverter::ConvertToObjectIdProto(object_id, &object_id_proto);
-    Statistics::IncomingOperationType op_type =
-        (reg_op_type == RegistrationP_OpType_REGISTER) ?
-        Statistics::IncomingOperationType_REGISTRATION :
-        Statistics::IncomingOperationType_UNREGISTRATION;
+  object_id_protos.reserve(num_objects);
+  for (size_t i = 0; i < object_id_lists.size(); ++i) {
+    ProtoConverter::ConvertToObjectIdProtos(*object_id_lists[i],
+                                            &object_id_protos);
+  }
+
+  // Reject object ids that could never be sent to the server here, so that
+  // outbound registration messages are valid by construction.
+  size_t num_valid = 0;
+  ObjectId invalid_object_id;
+  for (size_t i = 0; i < object_id_protos.size(); ++i) {
+    if (!msg_validator_->IsValid(object_id_protos[i])) {
+      ProtoConverter::ConvertFromObjectIdProto(object_id_protos[i],
+                                               &invalid_object_id);
+      GetListener()->InformRegistrationFailure(this, invalid_object_id, false,
+                                               "Invalid object id");
+      continue;
+    }
+    if (num_valid != i) {
+      object_id_protos[num_valid].Swap(&object_id_protos[i]);
+    }
+    ++num_valid;
+  }
+  object_id_protos.resize(num_valid);
+  if (object_id_protos.empty()) {
+    return;
+  }
+
+  Statistics::IncomingOperationType op_type =
+      (reg_op_type == RegistrationP_OpType_REGISTER) ?
+      Statistics::IncomingOperationType_REGISTRATION :
+      Statistics::IncomingOperationType_UNREGISTRATION;
+  for (size_t i = 0; i < object_id_protos.size(); ++i) {
     statistics_->RecordIncomingOperation(op_type);
     TLOG(logger_, INFO, "Register %s, %d",
-         ProtoHelpers::ToString(object_id_proto).c_str(), reg_op_type);
-    object_id_protos.push_back(object_id_proto);
+         ProtoHelpers::ToString(object_id_protos[i]).c_str(), reg_op_type);
+  }
+
+  if (config_.registration_debounce_delay_ms() > 0) {
+    // Only remember the latest operation per object; it is applied when the
+    // debounce task runs.
+    for (size_t i = 0; i < object_id_protos.size(); ++i) {
+      debounced_operations_[object_id_protos[i]] = reg_op_type;
+    }
+    registration_debounce_task_.get()->EnsureScheduled("PerformRegister");
+    return;
   }
+  PerformRegisterOperationsInternal(object_id_protos, reg_op_type);
+}
 
+void InvalidationClientCore::PerformRegisterOperationsInternal(
+    const vector<ObjectIdP>& object_id_protos,
+    RegistrationP::OpType reg_op_type) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
 
   // Update the registration manager state, then have the protocol client send a
   // message.
@@ -435,6 +644,48 @@ void InvalidationClientCore::PerformRegisterOperations(
   reg_sync_heartbeat_task_.get()->EnsureScheduled("PerformRegister");
 }
 
+void InvalidationClientCore::FlushDebouncedRegistrations() {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  if (ticl_state_.IsStopped()) {
+    TLOG(logger_, SEVERE, "Ticl stopped: dropping %d debounced operations",
+         debounced_operations_.size());
+    debounced_operations_.clear();
+    return;
+  }
+  vector<ObjectIdP> registrations;
+  vector<ObjectIdP> unregistrations;
+  int num_unchanged = 0;
+  map<ObjectIdP, RegistrationP::OpType, ProtoCompareLess>::iterator iter;
+  for (iter = debounced_operations_.begin();
+       iter != debounced_operations_.end(); ++iter) {
+    bool is_register = (iter->second == RegistrationP_OpType_REGISTER);
+    if (registration_manager_.IsRegistrationDesired(iter->first) ==
+        is_register) {
+      // The burst left the object where it started (e.g., register then
+      // unregister of an object that was never registered). As when such an
+      // operation is not debounced, nothing is sent and the listener hears
+      // about the object only from the server's registration status.
+      ++num_unchanged;
+    } else if (is_register) {
+      registrations.push_back(iter->first);
+    } else {
+      unregistrations.push_back(iter->first);
+    }
+  }
+  debounced_operations_.clear();
+  TLOG(logger_, FINE,
+       "Applying debounced operations: %d reg, %d unreg, %d unchanged",
+       registrations.size(), unregistrations.size(), num_unchanged);
+  if (!registrations.empty()) {
+    PerformRegisterOperationsInternal(
+        registrations, RegistrationP_OpType_REGISTER);
+  }
+  if (!unregistrations.empty()) {
+    PerformRegisterOperationsInternal(
+        unregistrations, RegistrationP_OpType_UNREGISTER);
+  }
+}
+
 void InvalidationClientCore::Acknowledge(const AckHandle& acknowledge_handle) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   if (acknowledge_handle.IsNoOp()) {
@@ -470,7 +721,16 @@ void InvalidationClientCore::Acknowledge(const AckHandle& acknowledge_handle) {
   invalidation->clear_payload();  // Don't send the payload back.
   statistics_->RecordIncomingOperation(
       Statistics::IncomingOperationType_ACKNOWLEDGE);
-  protocol_handler_.SendInvalidationAck(*invalidation, batching_task_.get());
+  protocol_handler_.SendInvalidationAck(*invalidation,
+                                        ack_batching_task_.get());
+
+  // Remember the acknowledged version so that redeliveries can be suppressed.
+  if (invalidation->is_known_version() &&
+      object_version_cache_.Record(invalidation->object_id(),
+                                   invalidation->version()) &&
+      config_.persist_object_version_cache()) {
+    persistent_write_task_.get()->EnsureScheduled("Write-after-ack");
+  }
 }
 
 string InvalidationClientCore::ToString() {
@@ -530,7 +790,8 @@ void InvalidationClientCore::HandleIncomingMessage(const string& message) {
   if (parsed_message.invalidation_message != NULL) {
     statistics_->RecordReceivedMessage(
         Statistics::ReceivedMessageType_INVALIDATION);
-    HandleInvalidations(parsed_message.invalidation_message->invalidation());
+    HandleInvalidations(
+        parsed_message.invalidation_message->mutable_invalidation());
   }
   if (parsed_message.registration_status_message != NULL) {
     statistics_->RecordReceivedMessage(
@@ -606,14 +867,37 @@ void InvalidationClientCore::ScheduleAcquireToken(const string& debug_string) {
 }
 
 void InvalidationClientCore::HandleInvalidations(
-    const RepeatedPtrField<InvalidationP>& invalidations) {
+    RepeatedPtrField<InvalidationP>* invalidations) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
-
-  for (int i = 0; i < invalidations.size(); ++i) {
-    const InvalidationP& invalidation = invalidations.Get(i);
-    AckHandleP ack_handle_proto;
+  heartbeat_policy_.RecordActivity();
+
+  // Reused across invalidations, so that their storage is allocated once per
+  // message rather than once per invalidation.
+  AckHandleP ack_handle_proto;
+  string serialized;
+  Invalidation inv;
+  for (int i = 0; i < invalidations->size(); ++i) {
+    InvalidationP* invalidation_proto = invalidations->Mutable(i);
+    const InvalidationP& invalidation = *invalidation_proto;
+    if (invalidation.is_known_version() &&
+        object_version_cache_.IsStale(invalidation.object_id(),
+                                      invalidation.version())) {
+      // The application has already acknowledged this version (or a later
+      // one); ack on its behalf instead of making it refetch the object.
+      TLOG(logger_, FINE, "Suppressing already-acked invalidation: %s",
+           ProtoHelpers::ToString(invalidation).c_str());
+      statistics_->RecordListenerEvent(
+          Statistics::ListenerEventType_INVALIDATE_SUPPRESSED);
+      invalidation_proto->clear_payload();
+      protocol_handler_.SendInvalidationAck(invalidation,
+                                            ack_batching_task_.get());
+      continue;
+    }
+    // Move the payload into the invalidation given to the listener, which
+    // shares it with all its copies. The ack handle does not need it: the
+    // payload is never sent back to the server.
+    ProtoConverter::ConvertFromInvalidationProto(invalidation_proto, &inv);
     ack_handle_proto.mutable_invalidation()->CopyFrom(invalidation);
-    string serialized;
     ack_handle_proto.SerializeToString(&serialized);
     AckHandle ack_handle(serialized);
     if (ProtoConverter::IsAllObjectIdP(invalidation.object_id())) {
@@ -621,8 +905,6 @@ void InvalidationClientCore::HandleInvalidations(
       GetListener()->InvalidateAll(this, ack_handle);
     } else {
       // Regular object. Could be unknown version or not.
-      Invalidation inv;
-      ProtoConverter::ConvertFromInvalidationProto(invalidation, &inv);
       bool isSuppressed = invalidation.is_trickle_restart();
       TLOG(logger_, INFO, "Issuing invalidate: %s",
            ProtoHelpers::ToString(invalidation).c_str());
@@ -653,14 +935,15 @@ void InvalidationClientCore::HandleRegistrationStatus(
       "Not all registration statuses were processed";
 
   // Inform app about the success or failure of each registration based
-  // on what the registration manager has indicated.
+  // on what the registration manager has indicated. The object id is reused
+  // across statuses so that its name buffer is only grown, not reallocated.
+  ObjectId object_id;
   for (int i = 0; i < reg_status_list.size(); ++i) {
     const RegistrationStatus& reg_status = reg_status_list.Get(i);
     bool was_success = local_processing_statuses[i];
     TLOG(logger_, FINE, "Process reg status: %s",
          ProtoHelpers::ToString(reg_status).c_str());
 
-    ObjectId object_id;
     ProtoConverter::ConvertFromObjectIdProto(
         reg_status.registration().object_id(), &object_id);
     if (was_success) {
@@ -687,11 +970,116 @@ void InvalidationClientCore::HandleRegistrationStatus(
 
 void InvalidationClientCore::HandleRegistrationSyncRequest() {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
-  // Send all the registrations in the reg sync message.
-  // Generate a single subtree for all the registrations.
-  RegistrationSubtree subtree;
-  registration_manager_.GetRegistrations("", 0, &subtree);
-  protocol_handler_.SendRegistrationSyncSubtree(subtree, batching_task_.get());
+  if (protocol_handler_.HasPacedRegistrations()) {
+    // The summary the server saw covers registrations or sync subtrees that
+    // the pacer has not released yet, so the server is bound to be missing
+    // them. They are on their way; if the server still disagrees once they
+    // have been sent, it will ask again.
+    TLOG(logger_, INFO,
+         "Ignoring registration sync request while registrations are paced");
+    return;
+  }
+  if (config_.max_registration_sync_chunk_size() <= 0) {
+    // Send all the registrations in the reg sync message.
+    // Generate a single subtree for all the registrations.
+    RegistrationSubtree subtree;
+    registration_manager_.GetRegistrations("", 0, &subtree);
+    protocol_handler_.SendRegistrationSyncSubtree(subtree,
+                                                  batching_task_.get());
+    return;
+  }
+  RegistrationSummary client_summary;
+  registration_manager_.GetClientSummary(&client_summary);
+  if ((reg_sync_snapshot_.registered_object_size() > 0) &&
+      (client_summary.registration_digest() == reg_sync_snapshot_digest_)) {
+    // A repeated request means that the server is still missing part of the
+    // snapshot: a chunk may have been lost. Resend from the first chunk it is
+    // not known to hold rather than restarting the whole sync. The
+    // confirmation is used once: unless a later summary confirms more, the
+    // next request starts over, in case the server no longer holds the
+    // confirmed chunks.
+    TLOG(logger_, INFO, "Resuming registration sync at %d of %d",
+         reg_sync_confirmed_index_,
+         reg_sync_snapshot_.registered_object_size());
+    reg_sync_next_index_ = reg_sync_confirmed_index_;
+    reg_sync_confirmed_index_ = 0;
+    SendNextRegistrationSyncChunk();
+    return;
+  }
+  reg_sync_snapshot_.Clear();
+  registration_manager_.GetRegistrations("", 0, &reg_sync_snapshot_);
+  reg_sync_snapshot_digest_ = client_summary.registration_digest();
+  reg_sync_next_index_ = 0;
+  reg_sync_confirmed_index_ = 0;
+  if (reg_sync_snapshot_.registered_object_size() == 0) {
+    // Nothing to stream, but the server still expects a subtree.
+    protocol_handler_.SendRegistrationSyncSubtree(reg_sync_snapshot_,
+                                                  batching_task_.get());
+    return;
+  }
+  SendNextRegistrationSyncChunk();
+}
+
+void InvalidationClientCore::SendNextRegistrationSyncChunk() {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  int num_objects = reg_sync_snapshot_.registered_object_size();
+  if (reg_sync_next_index_ >= num_objects) {
+    return;
+  }
+  int end = reg_sync_next_index_ + config_.max_registration_sync_chunk_size();
+  if (end > num_objects) {
+    end = num_objects;
+  }
+  RegistrationSubtree chunk;
+  for (int i = reg_sync_next_index_; i < end; ++i) {
+    chunk.add_registered_object()->CopyFrom(
+        reg_sync_snapshot_.registered_object(i));
+  }
+  reg_sync_next_index_ = end;
+  protocol_handler_.SendRegistrationSyncSubtree(chunk, batching_task_.get());
+}
+
+void InvalidationClientCore::UpdateRegistrationSyncProgress(
+    const RegistrationSummary& summary) {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  int num_objects = reg_sync_snapshot_.registered_object_size();
+  if (num_objects == 0) {
+    return;
+  }
+  RegistrationSummary client_summary;
+  registration_manager_.GetClientSummary(&client_summary);
+  if (registration_manager_.IsStateInSyncWithServer() ||
+      (client_summary.registration_digest() != reg_sync_snapshot_digest_)) {
+    // Either the sync is done, or the registrations have changed and the next
+    // sync request will take a new snapshot.
+    reg_sync_snapshot_.Clear();
+    reg_sync_next_index_ = 0;
+    reg_sync_confirmed_index_ = 0;
+    return;
+  }
+
+  // The server holds the chunks before a boundary if its summary is exactly
+  // that of the snapshot objects before the boundary. Later summaries may
+  // also count chunks received after a lost one; they keep the confirmed
+  // prefix unless they hold too few objects to contain it.
+  int num_held = summary.num_registrations();
+  if (num_held < reg_sync_confirmed_index_) {
+    reg_sync_confirmed_index_ = 0;
+  }
+  if ((num_held <= reg_sync_confirmed_index_) || (num_held > num_objects) ||
+      ((num_held % config_.max_registration_sync_chunk_size()) != 0)) {
+    return;
+  }
+  vector<ObjectIdDigest> digests(num_held);
+  for (int i = 0; i < num_held; ++i) {
+    ObjectIdDigestUtils::GetDigest(reg_sync_snapshot_.registered_object(i),
+                                   digest_fn_.get(), &digests[i]);
+  }
+  sort(digests.begin(), digests.end());
+  if (ObjectIdDigestUtils::GetDigest(digests, digest_fn_.get()) ==
+      summary.registration_digest()) {
+    reg_sync_confirmed_index_ = num_held;
+  }
 }
 
 void InvalidationClientCore::HandleInfoMessage(
@@ -749,8 +1137,8 @@ void InvalidationClientCore::HandleErrorMessage(
   registration_manager_.RemoveRegisteredObjects(&desired_registrations);
   TLOG(logger_, WARNING, "Issuing failure for %d objects",
        desired_registrations.size());
+  ObjectId object_id;
   for (size_t i = 0; i < desired_registrations.size(); ++i) {
-    ObjectId object_id;
     ProtoConverter::ConvertFromObjectIdProto(
         desired_registrations[i], &object_id);
     GetListener()->InformRegistrationFailure(
@@ -761,6 +1149,12 @@ void InvalidationClientCore::HandleErrorMessage(
 void InvalidationClientCore::HandleMessageSent() {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   last_message_send_time_ = internal_scheduler_->GetCurrentTime();
+
+  // Once a sent message has carried the pending chunk of a registration sync
+  // in progress, i.e., the pacer no longer holds it back, queue the next one.
+  if (!protocol_handler_.HasPacedRegistrations()) {
+    SendNextRegistrationSyncChunk();
+  }
 }
 
 void InvalidationClientCore::HandleNetworkStatusChange(bool is_online) {
@@ -769,6 +1163,14 @@ void InvalidationClientCore::HandleNetworkStatusChange(bool is_online) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   bool was_online = is_online_;
   is_online_ = is_online;
+  if (is_online && !was_online && config_.adaptive_heartbeats()) {
+    heartbeat_task_.get()->ResumeIfSuspended();
+    if (config_.channel_supports_offline_delivery()) {
+      // Anything the server sent while we were offline will be delivered and
+      // answered, so there is no need to announce that we are back.
+      return;
+    }
+  }
   if (is_online && !was_online &&
       (internal_scheduler_->GetCurrentTime() >
        last_message_send_time_ + TimeDelta::FromMilliseconds(
@@ -833,15 +1235,16 @@ void InvalidationClientCore::HandleIncomingHeader(
          ProtoHelpers::ToString(*header.registration_summary()).c_str(),
          upcalls.size());
     vector<RegistrationP>::iterator iter;
+    ObjectId object_id;
     for (iter = upcalls.begin(); iter != upcalls.end(); iter++) {
       const RegistrationP& registration = *iter;
-      ObjectId object_id;
       ProtoConverter::ConvertFromObjectIdProto(registration.object_id(),
                                                &object_id);
       InvalidationListener::RegistrationState reg_state =
           ConvertOpTypeToRegState(registration.op_type());
       GetListener()->InformRegistrationStatus(this, object_id, reg_state);
     }
+    UpdateRegistrationSyncProgress(*header.registration_summary());
   }
 }
 
@@ -983,9 +1386,9 @@ InvalidationClientCore::ConvertOpTypeToRegState(RegistrationP::OpType
 }
 
 void InvalidationClientCore::MessageReceiver(string message) {
-  internal_scheduler_->Schedule(Scheduler::NoDelay(), NewPermanentCallback(
-      this,
-      &InvalidationClientCore::HandleIncomingMessage, message));
+  internal_scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), Scheduler::HIGH_PRIORITY, NewPermanentCallback(
+          this, &InvalidationClientCore::HandleIncomingMessage, message));
 }
 
 void InvalidationClientCore::NetworkStatusReceiver(bool status) {
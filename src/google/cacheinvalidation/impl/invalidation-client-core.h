@@ -17,6 +17,7 @@
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_INVALIDATION_CLIENT_CORE_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_INVALIDATION_CLIENT_CORE_H_
 
+#include <map>
 #include <string>
 #include <utility>
 
@@ -26,6 +27,8 @@
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 #include "google/cacheinvalidation/impl/digest-store.h"
 #include "google/cacheinvalidation/impl/exponential-backoff-delay-generator.h"
+#include "google/cacheinvalidation/impl/heartbeat-policy.h"
+#include "google/cacheinvalidation/impl/object-version-cache.h"
 #include "google/cacheinvalidation/impl/protocol-handler.h"
 #include "google/cacheinvalidation/impl/registration-manager.h"
 #include "google/cacheinvalidation/impl/run-state.h"
@@ -77,9 +80,10 @@ class PersistentWriteTask : public RecurringTask {
 
  private:
   /* Handles the result of a request to write to persistent storage.
-   * |state| is the serialized state that was written.
+   * |token| and |cache_generation| describe the state that was written.
    */
-  void WriteCallback(const string& state, Status status);
+  void WriteCallback(const string& token, int64 cache_generation,
+                     Status status);
 
   InvalidationClientCore* client_;
 
@@ -87,6 +91,9 @@ class PersistentWriteTask : public RecurringTask {
    * successfully.
    */
   string last_written_token_;
+
+  /* Generation of the object version cache in the last successful write. */
+  int64 last_written_cache_generation_;
 };
 
 /* A task for sending heartbeats to the server. */
@@ -97,12 +104,38 @@ class HeartbeatTask : public RecurringTask {
 
   // The actual implementation as required by the RecurringTask.
   virtual bool RunTask();
+
+  /* Schedules the task again if it was suspended while offline. */
+  void ResumeIfSuspended();
+
  private:
   /* The client that owns this task. */
   InvalidationClientCore* client_;
 
   /* Next time that the performance counters are sent to the server. */
   Time next_performance_send_time_;
+
+  /* Last time a heartbeat was sent to the server. */
+  Time last_heartbeat_time_;
+
+  /* Whether the task stopped rescheduling itself because the client was
+   * offline.
+   */
+  bool is_suspended_;
+};
+
+/* A task that applies the net effect of debounced (un)registrations. */
+class RegistrationDebounceTask : public RecurringTask {
+ public:
+  explicit RegistrationDebounceTask(InvalidationClientCore* client);
+  virtual ~RegistrationDebounceTask() {}
+
+  // The actual implementation as required by the RecurringTask.
+  virtual bool RunTask();
+
+ private:
+  /* The client that owns this task. */
+  InvalidationClientCore* client_;
 };
 
 /* The task that is scheduled to send batched messages to the server (when
@@ -118,8 +151,29 @@ class BatchingTask : public RecurringTask {
   // The actual implementation as required by the RecurringTask.
   virtual bool RunTask();
 
- private:
+ protected:
+  BatchingTask(const string& name, ProtocolHandler *handler, Smearer* smearer,
+      TimeDelta batching_delay);
+
   ProtocolHandler* protocol_handler_;
+
+ private:
+  /* Delay after which batched data is sent, unless chosen adaptively. */
+  TimeDelta batching_delay_;
+};
+
+/* The task that is scheduled to send pending invalidation acks to the server,
+ * after a shorter delay than other batched messages.
+ */
+class AckBatchingTask : public BatchingTask {
+ public:
+  AckBatchingTask(ProtocolHandler *handler, Smearer* smearer,
+      TimeDelta ack_batching_delay);
+
+  virtual ~AckBatchingTask() {}
+
+  // The actual implementation as required by the RecurringTask.
+  virtual bool RunTask();
 };
 
 class InvalidationClientCore : public InvalidationClient,
@@ -223,8 +277,21 @@ class InvalidationClientCore : public InvalidationClient,
   virtual void PerformRegisterOperations(
       const vector<ObjectId>& object_ids, RegistrationP::OpType reg_op_type);
 
+  /* Like PerformRegisterOperations, on the concatenation of the vectors in
+   * object_id_lists, which are not copied.
+   */
+  void PerformBulkRegisterOperations(
+      const vector<const vector<ObjectId>*>& object_id_lists,
+      RegistrationP::OpType reg_op_type);
+
+  /* Applies (un)registration of object_ids to the registration manager and
+   * sends the resulting changes to the server.
+   */
   void PerformRegisterOperationsInternal(
-      const vector<ObjectId>& object_ids, RegistrationP::OpType reg_op_type);
+      const vector<ObjectIdP>& object_ids, RegistrationP::OpType reg_op_type);
+
+  /* Applies the net operation of every debounced (un)registration. */
+  void FlushDebouncedRegistrations();
 
   virtual void Acknowledge(const AckHandle& acknowledge_handle);
 
@@ -289,6 +356,7 @@ class InvalidationClientCore : public InvalidationClient,
   friend class InvalidationClientFactoryTest;
   friend class PersistentWriteTask;
   friend class RegSyncHeartbeatTask;
+  friend class RegistrationDebounceTask;
 
   //
   // Private methods.
@@ -371,9 +439,10 @@ class InvalidationClientCore : public InvalidationClient,
   /* Processes a server message |header|. */
   void HandleIncomingHeader(const ServerMessageHeader& header);
 
-  /* Handles |invalidations| from the server. */
-  void HandleInvalidations(
-       const RepeatedPtrField<InvalidationP>& invalidations);
+  /* Handles |invalidations| from the server. Their payloads are moved to the
+   * listener, leaving them without payloads.
+   */
+  void HandleInvalidations(RepeatedPtrField<InvalidationP>* invalidations);
 
   /* Handles registration statusES from the server. */
   void HandleRegistrationStatus(
@@ -382,6 +451,15 @@ class InvalidationClientCore : public InvalidationClient,
   /* Handles A registration sync request from the server. */
   void HandleRegistrationSyncRequest();
 
+  /* Sends the next chunk of the registration sync in progress, if any. */
+  void SendNextRegistrationSyncChunk();
+
+  /* Records how much of the registration sync in progress the server holds,
+   * given its latest registration summary, and ends the sync once the server
+   * is in sync or the snapshot is stale.
+   */
+  void UpdateRegistrationSyncProgress(const RegistrationSummary& summary);
+
   /* Handles an info message request from the server. */
   void HandleInfoMessage(
        const RepeatedField<InfoRequestMessage_InfoType>& info_types);
@@ -430,6 +508,9 @@ class InvalidationClientCore : public InvalidationClient,
   /* Object maintaining the registration state for this client. */
   RegistrationManager registration_manager_;
 
+  /* Highest acknowledged versions of recently invalidated objects. */
+  ObjectVersionCache object_version_cache_;
+
   /* Used to validate messages */
   scoped_ptr<TiclMessageValidator> msg_validator_;
 
@@ -462,6 +543,9 @@ class InvalidationClientCore : public InvalidationClient,
   /* Last time a message was sent to the server. */
   Time last_message_send_time_;
 
+  /* Interval between heartbeats, if they are adaptive. */
+  HeartbeatPolicy heartbeat_policy_;
+
   /* A task for acquiring the token (if the client has no token). */
   scoped_ptr<AcquireTokenTask> acquire_token_task_;
 
@@ -479,6 +563,39 @@ class InvalidationClientCore : public InvalidationClient,
   /* Task to send all batched messages to the server. */
   scoped_ptr<BatchingTask> batching_task_;
 
+  /* Task to flush pending invalidation acks on the shorter
+   * ack_batching_delay_ms lane, ahead of the regular batching delay.
+   */
+  scoped_ptr<AckBatchingTask> ack_batching_task_;
+
+  /* Latest requested operation for each object whose (un)registration is
+   * being debounced.
+   */
+  map<ObjectIdP, RegistrationP::OpType, ProtoCompareLess> debounced_operations_;
+
+  /* Task to apply debounced_operations_ once the debounce delay has passed. */
+  scoped_ptr<RegistrationDebounceTask> registration_debounce_task_;
+
+  /* Snapshot of the registrations being streamed to the server by a chunked
+   * registration sync. The sync is in progress while it is not empty; it is
+   * kept until the server is in sync, so that lost chunks can be resent.
+   */
+  RegistrationSubtree reg_sync_snapshot_;
+
+  /* Index in reg_sync_snapshot_ of the first object not yet queued for
+   * sending.
+   */
+  int reg_sync_next_index_;
+
+  /* Number of leading objects of reg_sync_snapshot_ (a chunk boundary) that
+   * a server summary has shown the server to hold. A repeated sync request
+   * resends from here.
+   */
+  int reg_sync_confirmed_index_;
+
+  /* Digest of the registrations when reg_sync_snapshot_ was taken. */
+  string reg_sync_snapshot_digest_;
+
   /* Random number generator for smearing, exp backoff, etc. */
   scoped_ptr<Random> random_;
 
@@ -16,6 +16,8 @@
 
 #include "google/cacheinvalidation/impl/invalidation-client-impl.h"
 
+#include "google/cacheinvalidation/deps/callback.h"
+
 namespace invalidation {
 
 InvalidationClientImpl::InvalidationClientImpl(
@@ -23,57 +25,122 @@ InvalidationClientImpl::InvalidationClientImpl(
     const string& client_name, const ClientConfigP& config,
     const string& application_name, InvalidationListener* listener)
     : InvalidationClientCore(resources, random, client_type, client_name,
-        config, application_name),
-      listener_(new CheckingInvalidationListener(
-            listener, GetStatistics(), resources->internal_scheduler(),
-            resources->listener_scheduler(), resources->logger())) {
+        config, application_name) {
+  vector<Scheduler*> shard_schedulers;
+  for (int i = 0; i < resources->listener_shard_count(); ++i) {
+    shard_schedulers.push_back(resources->listener_shard_scheduler(i));
+  }
+  listener_.reset(new CheckingInvalidationListener(
+      listener, GetStatistics(), resources->internal_scheduler(),
+      resources->listener_scheduler(), shard_schedulers, resources->logger(),
+      config.listener_backlog_high_watermark()));
 }
 
 void InvalidationClientImpl::Start() {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoStart));
+    EnqueueOperation(new IngressOperation(IngressOperation::START));
 }
 
 void InvalidationClientImpl::Stop() {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoStop));
+    EnqueueOperation(new IngressOperation(IngressOperation::STOP));
 }
 
 void InvalidationClientImpl::Register(const ObjectId& object_id) {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoRegister,
-                             object_id));
+    IngressOperation* operation =
+        new IngressOperation(IngressOperation::REGISTER);
+    operation->object_ids.push_back(object_id);
+    EnqueueOperation(operation);
 }
 
 void InvalidationClientImpl::Register(const vector<ObjectId>& object_ids) {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoBulkRegister,
-                             object_ids));
+    vector<ObjectId> copied_object_ids(object_ids);
+    EnqueueRegistrations(IngressOperation::REGISTER, &copied_object_ids);
 }
 
 void InvalidationClientImpl::Unregister(const ObjectId& object_id) {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoUnregister,
-                             object_id));
+    IngressOperation* operation =
+        new IngressOperation(IngressOperation::UNREGISTER);
+    operation->object_ids.push_back(object_id);
+    EnqueueOperation(operation);
 }
 
 void InvalidationClientImpl::Unregister(const vector<ObjectId>& object_ids) {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoBulkUnregister,
-                             object_ids));
+    vector<ObjectId> copied_object_ids(object_ids);
+    EnqueueRegistrations(IngressOperation::UNREGISTER, &copied_object_ids);
+}
+
+void InvalidationClientImpl::SwapAndRegister(vector<ObjectId>* object_ids) {
+    EnqueueRegistrations(IngressOperation::REGISTER, object_ids);
+}
+
+void InvalidationClientImpl::SwapAndUnregister(vector<ObjectId>* object_ids) {
+    EnqueueRegistrations(IngressOperation::UNREGISTER, object_ids);
 }
 
 void InvalidationClientImpl::Acknowledge(const AckHandle& acknowledge_handle) {
-    GetInternalScheduler()->Schedule(
-        Scheduler::NoDelay(),
-        NewPermanentCallback(this, &InvalidationClientImpl::DoAcknowledge,
-                             acknowledge_handle));
+    IngressOperation* operation =
+        new IngressOperation(IngressOperation::ACKNOWLEDGE);
+    operation->ack_handle = acknowledge_handle;
+    EnqueueOperation(operation);
+}
+
+void InvalidationClientImpl::EnqueueOperation(IngressOperation* operation) {
+  if (ingress_queue_.Push(operation)) {
+    GetInternalScheduler()->ScheduleWithPriority(
+        Scheduler::NoDelay(), Scheduler::HIGH_PRIORITY,
+        NewPooledCallback(this, &InvalidationClientImpl::DrainIngressQueue));
+  }
+}
+
+void InvalidationClientImpl::EnqueueRegistrations(
+    IngressOperation::Type type, vector<ObjectId>* object_ids) {
+  IngressOperation* operation = new IngressOperation(type);
+  operation->object_ids.swap(*object_ids);
+  object_ids->clear();
+  EnqueueOperation(operation);
+}
+
+void InvalidationClientImpl::DrainIngressQueue() {
+  IngressOperation* operation = ingress_queue_.PopAll();
+  while (operation != NULL) {
+    IngressOperation* next = operation->next;
+    switch (operation->type) {
+      case IngressOperation::START:
+        DoStart();
+        break;
+      case IngressOperation::STOP:
+        DoStop();
+        break;
+      case IngressOperation::REGISTER:
+      case IngressOperation::UNREGISTER: {
+        // Apply the following operations of the same type together with this
+        // one, without copying their object ids.
+        vector<const vector<ObjectId>*> object_id_lists;
+        object_id_lists.push_back(&operation->object_ids);
+        IngressOperation* last = operation;
+        while ((next != NULL) && (next->type == operation->type)) {
+          object_id_lists.push_back(&next->object_ids);
+          last = next;
+          next = next->next;
+        }
+        if (operation->type == IngressOperation::REGISTER) {
+          DoBulkRegister(object_id_lists);
+        } else {
+          DoBulkUnregister(object_id_lists);
+        }
+        while (operation != last) {
+          IngressOperation* applied = operation;
+          operation = operation->next;
+          delete applied;
+        }
+        break;
+      }
+      case IngressOperation::ACKNOWLEDGE:
+        DoAcknowledge(operation->ack_handle);
+        break;
+    }
+    delete operation;
+    operation = next;
+  }
 }
 
 }  // namespace invalidation
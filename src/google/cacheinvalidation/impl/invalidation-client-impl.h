@@ -23,6 +23,7 @@
 #include "google/cacheinvalidation/include/invalidation-client.h"
 #include "google/cacheinvalidation/include/invalidation-listener.h"
 #include "google/cacheinvalidation/impl/checking-invalidation-listener.h"
+#include "google/cacheinvalidation/impl/ingress-queue.h"
 #include "google/cacheinvalidation/impl/invalidation-client-core.h"
 #include "google/cacheinvalidation/impl/protocol-handler.h"
 
@@ -46,9 +47,9 @@ class InvalidationClientImpl : public InvalidationClientCore {
       const string& application_name, InvalidationListener* listener);
 
   // These methods override those in InvalidationClientCore. Their
-  // implementations all enqueue an event onto the work queue and
-  // then delegate to the InvalidationClientCore method through one
-  // of the private DoYYY functions (below).
+  // implementations all push an operation onto the ingress queue, which the
+  // internal thread drains and delegates to the InvalidationClientCore
+  // methods through the private DoYYY functions (below).
 
   virtual void Start();
 
@@ -62,6 +63,10 @@ class InvalidationClientImpl : public InvalidationClientCore {
 
   virtual void Unregister(const vector<ObjectId>& object_ids);
 
+  virtual void SwapAndRegister(vector<ObjectId>* object_ids);
+
+  virtual void SwapAndUnregister(vector<ObjectId>* object_ids);
+
   virtual void Acknowledge(const AckHandle& acknowledge_handle);
 
   /* Returns the listener that was registered by the caller. */
@@ -75,10 +80,25 @@ class InvalidationClientImpl : public InvalidationClientCore {
   }
 
  private:
+  /* Pushes operation (owned by the queue after the call) onto the ingress
+   * queue, scheduling a drain on the internal thread if the queue was empty.
+   */
+  void EnqueueOperation(IngressOperation* operation);
+
+  /* Pushes a (un)registration of object_ids, whose contents are swapped out,
+   * onto the ingress queue.
+   */
+  void EnqueueRegistrations(IngressOperation::Type type,
+                            vector<ObjectId>* object_ids);
+
+  /* Runs all operations queued so far, in order. Consecutive registrations
+   * (or unregistrations) are merged into a single bulk operation.
+   */
+  void DrainIngressQueue();
+
   /*
    * All of these methods simply delegate to the superclass implementation. They
-   * exist so that NewPermanentCallback objects created in
-   * invalidation-client-impl.cc can call superclass methods.
+   * are called on the internal thread by DrainIngressQueue.
    */
   void DoStart() {
     this->InvalidationClientCore::Start();
@@ -88,23 +108,19 @@ class InvalidationClientImpl : public InvalidationClientCore {
     this->InvalidationClientCore::Stop();
   }
 
-  void DoRegister(const ObjectId& object_id) {
-    this->InvalidationClientCore::Register(object_id);
-  }
-
-  void DoUnregister(const ObjectId& object_id) {
-    this->InvalidationClientCore::Unregister(object_id);
+  void DoBulkRegister(const vector<const vector<ObjectId>*>& object_id_lists) {
+    PerformBulkRegisterOperations(object_id_lists,
+                                  RegistrationP_OpType_REGISTER);
   }
 
-  void DoBulkRegister(const vector<ObjectId>& object_ids) {
-    this->InvalidationClientCore::Register(object_ids);
-  }
-
-  void DoBulkUnregister(const vector<ObjectId>& object_ids) {
-    this->InvalidationClientCore::Unregister(object_ids);
+  void DoBulkUnregister(
+      const vector<const vector<ObjectId>*>& object_id_lists) {
+    PerformBulkRegisterOperations(object_id_lists,
+                                  RegistrationP_OpType_UNREGISTER);
   }
 
   void DoAcknowledge(const AckHandle& acknowledge_handle) {
+    listener_.get()->HandleAcknowledge(acknowledge_handle);
     this->InvalidationClientCore::Acknowledge(acknowledge_handle);
   }
 
@@ -114,6 +130,9 @@ class InvalidationClientImpl : public InvalidationClientCore {
    */
   scoped_ptr<CheckingInvalidationListener> listener_;
 
+  /* API calls made by application threads, not yet run. */
+  IngressQueue ingress_queue_;
+
   DISALLOW_COPY_AND_ASSIGN(InvalidationClientImpl);
 };
 
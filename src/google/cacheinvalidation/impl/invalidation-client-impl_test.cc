@@ -14,6 +14,7 @@
 
 // Unit tests for the InvalidationClientImpl class.
 
+#include <set>
 #include <vector>
 
 #include "google/cacheinvalidation/client_test_internal.pb.h"
@@ -23,10 +24,12 @@
 #include "google/cacheinvalidation/deps/gmock.h"
 #include "google/cacheinvalidation/deps/googletest.h"
 #include "google/cacheinvalidation/deps/random.h"
+#include "google/cacheinvalidation/deps/sha1-digest-function.h"
 #include "google/cacheinvalidation/deps/string_util.h"
 #include "google/cacheinvalidation/impl/basic-system-resources.h"
 #include "google/cacheinvalidation/impl/constants.h"
 #include "google/cacheinvalidation/impl/invalidation-client-impl.h"
+#include "google/cacheinvalidation/impl/simple-registration-store.h"
 #include "google/cacheinvalidation/impl/statistics.h"
 #include "google/cacheinvalidation/impl/throttle.h"
 #include "google/cacheinvalidation/impl/ticl-message-validator.h"
@@ -92,11 +95,7 @@ class InvalidationClientImplTest : public UnitTestBase {
     UnitTestBase::SetUp();
     InitCommonExpectations();  // Set up expectations for common mock operations
 
-
-    // Clear throttle limits so that it does not interfere with any test.
-    InvalidationClientImpl::InitConfig(&config);
-    config.set_smear_percent(kDefaultSmearPercent);
-    config.mutable_protocol_handler_config()->clear_rate_limit();
+    InitClientConfig();
 
     // Set up the listener scheduler to run any runnable that it receives.
     EXPECT_CALL(*listener_scheduler, Schedule(_, _))
@@ -110,6 +109,14 @@ class InvalidationClientImplTest : public UnitTestBase {
         "InvClientTest", &listener));
   }
 
+  // Initializes the configuration with which the client is created.
+  virtual void InitClientConfig() {
+    // Clear throttle limits so that it does not interfere with any test.
+    InvalidationClientImpl::InitConfig(&config);
+    config.set_smear_percent(kDefaultSmearPercent);
+    config.mutable_protocol_handler_config()->clear_rate_limit();
+  }
+
   // Starts the Ticl and ensures that the initialize message is sent. In
   // response, gives a tokencontrol message to the protocol handler and makes
   // sure that ready is called. client_messages is the list of messages expected
@@ -260,6 +267,30 @@ TEST_F(InvalidationClientImplTest, Register) {
   ASSERT_TRUE(CompareMessages(expected_msg, actual_msg));
 }
 
+// Tests that registrations queued by separate calls before the internal thread
+// runs are applied together and sent in one message.
+TEST_F(InvalidationClientImplTest, RegisterQueuedCalls) {
+  SetExpectationsForTiclStart(2);
+  StartClient();
+
+  vector<ObjectIdP> oid_protos;
+  vector<ObjectId> oids;
+  InitTestObjectIds(3, &oid_protos);
+  ConvertFromObjectIdProtos(oid_protos, &oids);
+  client.get()->Register(oids[0]);
+  vector<ObjectId> rest(oids.begin() + 1, oids.end());
+  client.get()->SwapAndRegister(&rest);
+  ASSERT_TRUE(rest.empty());
+  internal_scheduler->PassTime(
+      GetMaxBatchingDelay(config.protocol_handler_config()));
+
+  ClientToServerMessage client_msg;
+  client_msg.ParseFromString(outgoing_messages[1]);
+  RegistrationMessage expected_msg;
+  InitRegistrationMessage(oid_protos, true, &expected_msg);
+  ASSERT_TRUE(CompareMessages(expected_msg, client_msg.registration_message()));
+}
+
 // Tests that given invalidations from the server, the right listener methods
 // are invoked. Ack the invalidations and make sure that the ack message is sent
 // out. Include a payload in one invalidation and make sure the client does not
@@ -501,4 +532,515 @@ TEST_F(InvalidationClientImplTest, Heartbeats) {
   internal_scheduler->PassTime(EndOfTestWaitTime());
 }
 
+// Tests the invalidation client with registration pacing.
+class InvalidationClientImplPacingTest : public InvalidationClientImplTest {
+ public:
+  virtual void InitClientConfig() {
+    InvalidationClientImplTest::InitClientConfig();
+    ProtocolHandlerConfigP* protocol_handler_config =
+        config.mutable_protocol_handler_config();
+    protocol_handler_config->set_registration_objects_per_second(500);
+    protocol_handler_config->set_max_registrations_per_message(1000);
+  }
+};
+
+// Tests that a bulk registration is paced, and that registration sync requests
+// the server sends meanwhile are ignored rather than answered with the objects
+// the pacer still holds.
+TEST_F(InvalidationClientImplPacingTest, IgnoresSyncRequestsWhilePacing) {
+  const int kNumObjects = 2500;
+  const int kMaxObjectsPerMessage =
+      config.protocol_handler_config().max_registrations_per_message();
+  ASSERT_LT(0, kMaxObjectsPerMessage);
+  ASSERT_LT(kMaxObjectsPerMessage, kNumObjects);
+  SetExpectationsForTiclStart(1);
+  StartClient();
+  EXPECT_CALL(*network, SendMessage(_))
+      .WillRepeatedly(SaveArgToVector<0>(&outgoing_messages));
+
+  vector<ObjectIdP> oid_protos;
+  vector<ObjectId> oids;
+  InitTestObjectIds(kNumObjects, &oid_protos);
+  ConvertFromObjectIdProtos(oid_protos, &oids);
+  client.get()->Register(oids);
+  internal_scheduler->PassTime(
+      GetMaxBatchingDelay(config.protocol_handler_config()));
+  ASSERT_EQ(2, outgoing_messages.size());
+
+  // The server, which does not hold the advertised registrations yet, keeps
+  // asking for a registration sync.
+  ServerToClientMessage message;
+  InitServerHeader(client.get()->GetClientToken(), message.mutable_header());
+  message.mutable_registration_sync_request_message();
+  for (int i = 0; i < 3; ++i) {
+    ProcessIncomingMessage(message, TimeDelta::FromMilliseconds(500));
+  }
+  internal_scheduler->PassTime(TimeDelta::FromSeconds(30));
+
+  int num_registrations = 0;
+  int num_synced_objects = 0;
+  for (size_t i = 1; i < outgoing_messages.size(); ++i) {
+    ClientToServerMessage client_msg;
+    client_msg.ParseFromString(outgoing_messages[i]);
+    int num_objects = client_msg.registration_message().registration_size();
+    num_registrations += num_objects;
+    const RegistrationSyncMessage& sync =
+        client_msg.registration_sync_message();
+    for (int j = 0; j < sync.subtree_size(); ++j) {
+      num_objects += sync.subtree(j).registered_object_size();
+      num_synced_objects += sync.subtree(j).registered_object_size();
+    }
+    ASSERT_GE(kMaxObjectsPerMessage, num_objects);
+  }
+  ASSERT_EQ(kNumObjects, num_registrations);
+  ASSERT_EQ(0, num_synced_objects);
+
+  // Once the registrations have gone out, a sync request is answered, and the
+  // sync is paced like the registrations.
+  size_t num_messages = outgoing_messages.size();
+  ProcessIncomingMessage(message, TimeDelta::FromSeconds(30));
+  for (size_t i = num_messages; i < outgoing_messages.size(); ++i) {
+    ClientToServerMessage client_msg;
+    client_msg.ParseFromString(outgoing_messages[i]);
+    const RegistrationSyncMessage& sync =
+        client_msg.registration_sync_message();
+    int num_objects = 0;
+    for (int j = 0; j < sync.subtree_size(); ++j) {
+      num_objects += sync.subtree(j).registered_object_size();
+    }
+    num_synced_objects += num_objects;
+    ASSERT_GE(kMaxObjectsPerMessage, num_objects);
+  }
+  ASSERT_EQ(kNumObjects, num_synced_objects);
+}
+
+// Tests the heartbeats of the invalidation client when they are traffic-aware
+// and adaptive.
+class InvalidationClientImplHeartbeatTest : public InvalidationClientImplTest {
+ public:
+  virtual void InitClientConfig() {
+    InvalidationClientImplTest::InitClientConfig();
+    config.set_traffic_aware_heartbeats(true);
+    config.set_adaptive_heartbeats(true);
+    config.set_heartbeat_interval_ms(10 * 1000);
+    config.set_max_idle_heartbeat_interval_ms(40 * 1000);
+    config.set_out_of_sync_heartbeat_interval_ms(1000);
+
+    // Send each heartbeat almost as soon as it is due.
+    config.mutable_protocol_handler_config()->set_batching_delay_ms(50);
+  }
+
+  // Starts the client and saves every message it sends in outgoing_messages.
+  // The first heartbeat is due one interval after the client got its token,
+  // i.e., just under one interval after this returns.
+  void StartClientAndSaveMessages() {
+    SetExpectationsForTiclStart(1);
+    StartClient();
+    EXPECT_CALL(*network, SendMessage(_))
+        .WillRepeatedly(SaveArgToVector<0>(&outgoing_messages));
+  }
+
+  // Lets seconds pass on the internal scheduler.
+  void PassSeconds(int seconds) {
+    internal_scheduler->PassTime(TimeDelta::FromSeconds(seconds));
+  }
+};
+
+// Tests that a heartbeat is deferred until one interval after the last message
+// sent to the server.
+TEST_F(InvalidationClientImplHeartbeatTest, DefersHeartbeatAfterTraffic) {
+  vector<ObjectIdP> oid_protos;
+  InitTestObjectIds(1, &oid_protos);
+  vector<InvalidationP> invalidations;
+  MakeInvalidationsFromObjectIds(oid_protos, &invalidations);
+  vector<AckHandle> ack_handles;
+  EXPECT_CALL(listener, Invalidate(Eq(client.get()), _, _))
+      .WillOnce(SaveArgToVector<2>(&ack_handles));
+  StartClientAndSaveMessages();
+
+  // Halfway through the interval, the client acks an invalidation.
+  PassSeconds(5);
+  ServerToClientMessage message;
+  InitServerHeader(client.get()->GetClientToken(), message.mutable_header());
+  InitInvalidationMessage(invalidations,
+      message.mutable_invalidation_message());
+  ProcessIncomingMessage(message, MessageHandlingDelay());
+  client.get()->Acknowledge(ack_handles[0]);
+  PassSeconds(1);
+  ASSERT_EQ(2, outgoing_messages.size());
+
+  // The heartbeat is not sent when the interval has passed since the token
+  // was received, but one interval after the ack.
+  PassSeconds(8);
+  ASSERT_EQ(2, outgoing_messages.size());
+  PassSeconds(2);
+  ASSERT_EQ(3, outgoing_messages.size());
+  ClientToServerMessage client_msg;
+  client_msg.ParseFromString(outgoing_messages[2]);
+  ASSERT_TRUE(client_msg.has_info_message());
+}
+
+// Tests that the heartbeats of an idle client back off up to the maximum idle
+// interval.
+TEST_F(InvalidationClientImplHeartbeatTest, BacksOffWhenIdle) {
+  StartClientAndSaveMessages();
+
+  // Heartbeats go out 10, 20 and then 40 seconds apart.
+  PassSeconds(11);
+  ASSERT_EQ(2, outgoing_messages.size());
+  PassSeconds(18);
+  ASSERT_EQ(2, outgoing_messages.size());
+  PassSeconds(2);
+  ASSERT_EQ(3, outgoing_messages.size());
+  PassSeconds(38);
+  ASSERT_EQ(3, outgoing_messages.size());
+  PassSeconds(2);
+  ASSERT_EQ(4, outgoing_messages.size());
+  PassSeconds(38);
+  ASSERT_EQ(4, outgoing_messages.size());
+  PassSeconds(2);
+  ASSERT_EQ(5, outgoing_messages.size());
+  for (size_t i = 1; i < outgoing_messages.size(); ++i) {
+    ClientToServerMessage client_msg;
+    client_msg.ParseFromString(outgoing_messages[i]);
+    ASSERT_TRUE(client_msg.has_info_message());
+    ASSERT_FALSE(
+        client_msg.info_message().server_registration_summary_requested());
+  }
+}
+
+// Tests that once the interval has backed off, the heartbeat task still wakes
+// up every base interval, so that a loss of sync is reported without waiting
+// for the backed-off interval.
+TEST_F(InvalidationClientImplHeartbeatTest, WakesUpEveryBaseInterval) {
+  vector<ObjectIdP> oid_protos;
+  vector<ObjectId> oids;
+  InitTestObjectIds(1, &oid_protos);
+  ConvertFromObjectIdProtos(oid_protos, &oids);
+  StartClientAndSaveMessages();
+
+  // After two heartbeats, the next one is not due for 40 seconds.
+  PassSeconds(31);
+  ASSERT_EQ(3, outgoing_messages.size());
+
+  // Registering leaves the registrations out of sync, which the next wakeup,
+  // within 10 seconds of the last heartbeat, reports to the server.
+  PassSeconds(4);
+  client.get()->Register(oids[0]);
+  PassSeconds(1);
+  ASSERT_EQ(4, outgoing_messages.size());
+  PassSeconds(5);
+  ASSERT_EQ(5, outgoing_messages.size());
+  ClientToServerMessage client_msg;
+  client_msg.ParseFromString(outgoing_messages[4]);
+  ASSERT_TRUE(client_msg.has_info_message());
+  ASSERT_TRUE(
+      client_msg.info_message().server_registration_summary_requested());
+}
+
+// Tests that heartbeats are suspended while the client is offline, and that
+// reconnecting sends a heartbeat right away and resumes them.
+TEST_F(InvalidationClientImplHeartbeatTest, SuspendsWhileOffline) {
+  StartClientAndSaveMessages();
+  ChangeNetworkStatus(false, TimeDelta::FromSeconds(1));
+  PassSeconds(100);
+  ASSERT_EQ(1, outgoing_messages.size());
+
+  // Nothing was sent for longer than the offline heartbeat threshold.
+  ChangeNetworkStatus(true, TimeDelta::FromSeconds(1));
+  ASSERT_EQ(2, outgoing_messages.size());
+  ClientToServerMessage client_msg;
+  client_msg.ParseFromString(outgoing_messages[1]);
+  ASSERT_TRUE(client_msg.has_info_message());
+
+  // The resumed heartbeat task sends the next heartbeat one interval later.
+  PassSeconds(8);
+  ASSERT_EQ(2, outgoing_messages.size());
+  PassSeconds(2);
+  ASSERT_EQ(3, outgoing_messages.size());
+}
+
+// Tests the heartbeats of a client whose channel delivers messages sent while
+// it is offline.
+class InvalidationClientImplOfflineDeliveryTest
+    : public InvalidationClientImplHeartbeatTest {
+ public:
+  virtual void InitClientConfig() {
+    InvalidationClientImplHeartbeatTest::InitClientConfig();
+    config.set_channel_supports_offline_delivery(true);
+  }
+};
+
+// Tests that reconnecting resumes the heartbeats without announcing the client
+// right away, since the channel delivers what the server sent meanwhile.
+TEST_F(InvalidationClientImplOfflineDeliveryTest, SkipsReconnectionHeartbeat) {
+  StartClientAndSaveMessages();
+  ChangeNetworkStatus(false, TimeDelta::FromSeconds(1));
+  PassSeconds(100);
+  ChangeNetworkStatus(true, TimeDelta::FromSeconds(1));
+  ASSERT_EQ(1, outgoing_messages.size());
+  PassSeconds(10);
+  ASSERT_EQ(2, outgoing_messages.size());
+}
+
+// Tests the invalidation client with registration debouncing turned on.
+class InvalidationClientImplDebounceTest : public InvalidationClientImplTest {
+ public:
+  virtual void InitClientConfig() {
+    InvalidationClientImplTest::InitClientConfig();
+    config.set_registration_debounce_delay_ms(100);
+  }
+};
+
+// Tests that with debouncing, registering and then unregistering an object that
+// was never registered sends nothing and makes no upcall, since the server has
+// not reported any status for the object.
+TEST_F(InvalidationClientImplDebounceTest, FlapSendsNothing) {
+  SetExpectationsForTiclStart(1);
+
+  vector<ObjectIdP> oid_protos;
+  vector<ObjectId> oids;
+  InitTestObjectIds(1, &oid_protos);
+  ConvertFromObjectIdProtos(oid_protos, &oids);
+  StartClient();
+
+  client.get()->Register(oids[0]);
+  client.get()->Unregister(oids[0]);
+  internal_scheduler->PassTime(
+      TimeDelta::FromMilliseconds(config.registration_debounce_delay_ms()) +
+      GetMaxBatchingDelay(config.protocol_handler_config()));
+  ASSERT_EQ(1, outgoing_messages.size());
+}
+
+// Tests that with debouncing, a register/unregister/register burst results in
+// a single registration being sent.
+TEST_F(InvalidationClientImplDebounceTest, BurstSendsNetOperation) {
+  SetExpectationsForTiclStart(2);
+
+  vector<ObjectIdP> oid_protos;
+  vector<ObjectId> oids;
+  InitTestObjectIds(1, &oid_protos);
+  ConvertFromObjectIdProtos(oid_protos, &oids);
+  StartClient();
+
+  client.get()->Register(oids[0]);
+  client.get()->Unregister(oids[0]);
+  client.get()->Register(oids[0]);
+  internal_scheduler->PassTime(
+      TimeDelta::FromMilliseconds(config.registration_debounce_delay_ms()) +
+      GetMaxBatchingDelay(config.protocol_handler_config()));
+
+  ClientToServerMessage client_msg;
+  client_msg.ParseFromString(outgoing_messages[1]);
+  RegistrationMessage expected_msg;
+  InitRegistrationMessage(oid_protos, true, &expected_msg);
+  ASSERT_TRUE(CompareMessages(expected_msg, client_msg.registration_message()));
+
+  // Unregistering and re-registering the object sends nothing more. The
+  // registration is still pending at the server, so the listener is not told
+  // that the object is registered.
+  client.get()->Unregister(oids[0]);
+  client.get()->Register(oids[0]);
+  internal_scheduler->PassTime(
+      TimeDelta::FromMilliseconds(config.registration_debounce_delay_ms()) +
+      GetMaxBatchingDelay(config.protocol_handler_config()));
+  ASSERT_EQ(2, outgoing_messages.size());
+}
+
+// Tests the invalidation client with registration syncs streamed in chunks.
+class InvalidationClientImplRegSyncTest : public InvalidationClientImplTest {
+ public:
+  virtual void InitClientConfig() {
+    InvalidationClientImplTest::InitClientConfig();
+    config.set_max_registration_sync_chunk_size(2);
+  }
+
+  // Starts the client, registers for count objects (whose ids are stored in
+  // oid_protos) and lets the registration message go out. Every message sent
+  // by the client is saved in outgoing_messages.
+  void StartAndRegister(int count, vector<ObjectIdP>* oid_protos) {
+    SetExpectationsForTiclStart(1);
+    StartClient();
+    EXPECT_CALL(*network, SendMessage(_))
+        .WillRepeatedly(SaveArgToVector<0>(&outgoing_messages));
+    vector<ObjectId> oids;
+    InitTestObjectIds(count, oid_protos);
+    ConvertFromObjectIdProtos(*oid_protos, &oids);
+    client.get()->Register(oids);
+    internal_scheduler->PassTime(
+        GetMaxBatchingDelay(config.protocol_handler_config()));
+  }
+
+  // Gives the client a registration sync request and waits for delay.
+  void RequestRegistrationSync(TimeDelta delay) {
+    ServerToClientMessage message;
+    InitServerHeader(client.get()->GetClientToken(), message.mutable_header());
+    message.mutable_registration_sync_request_message();
+    ProcessIncomingMessage(message, delay);
+  }
+
+  // Makes the server headers carry the summary of a server that holds exactly
+  // the objects of subtrees.
+  void SetServerHeldSubtrees(const vector<RegistrationSubtree>& subtrees) {
+    Sha1DigestFunction digest_fn;
+    SimpleRegistrationStore store(&digest_fn);
+    for (size_t i = 0; i < subtrees.size(); ++i) {
+      for (int j = 0; j < subtrees[i].registered_object_size(); ++j) {
+        store.Add(subtrees[i].registered_object(j));
+      }
+    }
+    reg_summary.reset(new RegistrationSummary());
+    reg_summary.get()->set_num_registrations(store.size());
+    reg_summary.get()->set_registration_digest(store.GetDigest());
+  }
+
+  // Gives the client a message with only a server header and waits for delay.
+  void SendServerHeader(TimeDelta delay) {
+    ServerToClientMessage message;
+    InitServerHeader(client.get()->GetClientToken(), message.mutable_header());
+    ProcessIncomingMessage(message, delay);
+  }
+
+  // Stores in subtrees the registration sync subtrees of the messages sent
+  // from index start on, one entry per subtree, in the order they were sent.
+  void GetSentSubtrees(size_t start, vector<RegistrationSubtree>* subtrees) {
+    for (size_t i = start; i < outgoing_messages.size(); ++i) {
+      ClientToServerMessage client_msg;
+      client_msg.ParseFromString(outgoing_messages[i]);
+      const RegistrationSyncMessage& sync =
+          client_msg.registration_sync_message();
+      for (int j = 0; j < sync.subtree_size(); ++j) {
+        subtrees->push_back(sync.subtree(j));
+      }
+    }
+  }
+};
+
+// Tests that a sync is sent one chunk per message, each further chunk being
+// queued once the previous message has gone out.
+TEST_F(InvalidationClientImplRegSyncTest, ContinuesAfterEachMessage) {
+  vector<ObjectIdP> oid_protos;
+  StartAndRegister(3, &oid_protos);
+  size_t num_sent = outgoing_messages.size();
+
+  RequestRegistrationSync(EndOfTestWaitTime());
+  ASSERT_EQ(num_sent + 2, outgoing_messages.size());
+  vector<RegistrationSubtree> subtrees;
+  GetSentSubtrees(num_sent, &subtrees);
+  ASSERT_EQ(2, subtrees.size());
+  ASSERT_EQ(2, subtrees[0].registered_object_size());
+  ASSERT_EQ(1, subtrees[1].registered_object_size());
+  set<string> names;
+  for (size_t i = 0; i < subtrees.size(); ++i) {
+    for (int j = 0; j < subtrees[i].registered_object_size(); ++j) {
+      names.insert(subtrees[i].registered_object(j).name());
+    }
+  }
+  ASSERT_EQ(3, names.size());
+}
+
+// Tests that sync requests arriving while a sync is queued are ignored rather
+// than queueing its chunks a second time.
+TEST_F(InvalidationClientImplRegSyncTest, IgnoresRequestsWhileQueued) {
+  vector<ObjectIdP> oid_protos;
+  StartAndRegister(6, &oid_protos);
+  size_t num_sent = outgoing_messages.size();
+
+  // Let the first chunk go out, so that the second is queued when the server
+  // asks again.
+  RequestRegistrationSync(
+      GetMaxBatchingDelay(config.protocol_handler_config()));
+  vector<RegistrationSubtree> subtrees;
+  GetSentSubtrees(num_sent, &subtrees);
+  ASSERT_EQ(1, subtrees.size());
+  RequestRegistrationSync(MessageHandlingDelay());
+  RequestRegistrationSync(EndOfTestWaitTime());
+  subtrees.clear();
+  GetSentSubtrees(num_sent, &subtrees);
+  ASSERT_EQ(3, subtrees.size());
+  set<string> names;
+  for (size_t i = 0; i < subtrees.size(); ++i) {
+    for (int j = 0; j < subtrees[i].registered_object_size(); ++j) {
+      names.insert(subtrees[i].registered_object(j).name());
+    }
+  }
+  ASSERT_EQ(6, names.size());
+}
+
+// Tests that a sync request restarts the sync if the registrations have
+// changed since the last one started.
+TEST_F(InvalidationClientImplRegSyncTest, RestartsWhenRegistrationsChange) {
+  vector<ObjectIdP> oid_protos;
+  StartAndRegister(6, &oid_protos);
+
+  // Start a sync, then register for one more object while it is queued. The
+  // server's next request starts over with the new object included.
+  RequestRegistrationSync(MessageHandlingDelay());
+  vector<ObjectIdP> new_oid_protos;
+  vector<ObjectId> new_oids;
+  InitTestObjectIds(7, &new_oid_protos);
+  ConvertFromObjectIdProtos(new_oid_protos, &new_oids);
+  client.get()->Register(new_oids[6]);
+  internal_scheduler->PassTime(EndOfTestWaitTime());
+  size_t num_sent = outgoing_messages.size();
+  RequestRegistrationSync(EndOfTestWaitTime());
+
+  vector<RegistrationSubtree> subtrees;
+  GetSentSubtrees(num_sent, &subtrees);
+  bool found = false;
+  for (size_t i = 0; i < subtrees.size(); ++i) {
+    for (int j = 0; j < subtrees[i].registered_object_size(); ++j) {
+      found |= (subtrees[i].registered_object(j).name() ==
+                new_oid_protos[6].name());
+    }
+  }
+  ASSERT_TRUE(found);
+}
+
+// Tests that when a chunk is lost, a repeated sync request resends from the
+// first chunk that the server summaries have not shown it to hold.
+TEST_F(InvalidationClientImplRegSyncTest, ResendsFromLostChunk) {
+  vector<ObjectIdP> oid_protos;
+  StartAndRegister(6, &oid_protos);
+  size_t num_sent = outgoing_messages.size();
+  RequestRegistrationSync(EndOfTestWaitTime());
+  vector<RegistrationSubtree> subtrees;
+  GetSentSubtrees(num_sent, &subtrees);
+  ASSERT_EQ(3, subtrees.size());
+
+  // The server reports holding the first chunk, then the first and third: the
+  // second was lost.
+  vector<RegistrationSubtree> held;
+  held.push_back(subtrees[0]);
+  SetServerHeldSubtrees(held);
+  SendServerHeader(MessageHandlingDelay());
+  held.push_back(subtrees[2]);
+  SetServerHeldSubtrees(held);
+  num_sent = outgoing_messages.size();
+  RequestRegistrationSync(EndOfTestWaitTime());
+
+  // Only the second and third chunks are sent again.
+  vector<RegistrationSubtree> resent;
+  GetSentSubtrees(num_sent, &resent);
+  ASSERT_EQ(2, resent.size());
+  EXPECT_EQ(subtrees[1].SerializeAsString(), resent[0].SerializeAsString());
+  EXPECT_EQ(subtrees[2].SerializeAsString(), resent[1].SerializeAsString());
+
+  // Once the server is in sync, the registrations are confirmed and a new
+  // request starts a new sync.
+  EXPECT_CALL(listener,
+              InformRegistrationStatus(Eq(client.get()), _,
+                                       InvalidationListener::REGISTERED))
+      .Times(6);
+  held.push_back(subtrees[1]);
+  SetServerHeldSubtrees(held);
+  SendServerHeader(MessageHandlingDelay());
+  num_sent = outgoing_messages.size();
+  RequestRegistrationSync(EndOfTestWaitTime());
+  vector<RegistrationSubtree> restarted;
+  GetSentSubtrees(num_sent, &restarted);
+  ASSERT_EQ(3, restarted.size());
+  EXPECT_EQ(subtrees[0].SerializeAsString(), restarted[0].SerializeAsString());
+}
+
 }  // namespace invalidation
@@ -18,21 +18,79 @@
 
 namespace invalidation {
 
-string ObjectIdDigestUtils::GetDigest(
-    const ObjectIdP& object_id, DigestFunction* digest_fn) {
-  digest_fn->Reset();
-  int source = object_id.source();
-  string buffer(4, 0);
+namespace {
 
-  // Little endian number for type followed by bytes.
+// Writes source as the little-endian number that precedes the name bytes in
+// the digested form of an object id.
+void EncodeSource(int source, uint8 buffer[4]) {
   buffer[0] = source & 0xff;
   buffer[1] = (source >> 8) & 0xff;
   buffer[2] = (source >> 16) & 0xff;
   buffer[3] = (source >> 24) & 0xff;
+}
+
+}  // namespace
 
-  digest_fn->Update(buffer);
-  digest_fn->Update(object_id.name());
+string ObjectIdDigestUtils::GetDigest(
+    const vector<ObjectIdDigest>& sorted_digests, DigestFunction* digest_fn) {
+  digest_fn->Reset();
+  for (size_t i = 0; i < sorted_digests.size(); ++i) {
+    digest_fn->UpdateBuffer(sorted_digests[i].bytes, ObjectIdDigest::kLength);
+  }
   return digest_fn->GetDigest();
 }
 
+string ObjectIdDigestUtils::GetDigest(
+    const ObjectIdP& object_id, DigestFunction* digest_fn) {
+  ObjectIdDigest digest;
+  GetDigest(object_id, digest_fn, &digest);
+  return digest.ToString();
+}
+
+void ObjectIdDigestUtils::GetDigest(
+    const ObjectIdP& object_id, DigestFunction* digest_fn,
+    ObjectIdDigest* digest) {
+  digest_fn->Reset();
+  uint8 buffer[4];
+  EncodeSource(object_id.source(), buffer);
+  digest_fn->UpdateBuffer(buffer, sizeof(buffer));
+  const string& name = object_id.name();
+  digest_fn->UpdateBuffer(name.data(), name.size());
+  digest_fn->GetDigestToBuffer(digest->bytes, ObjectIdDigest::kLength);
+}
+
+void ObjectIdDigestUtils::GetDigests(
+    const vector<ObjectIdP>& object_ids, DigestFunction* digest_fn,
+    vector<ObjectIdDigest>* digests) {
+  if (object_ids.empty()) {
+    return;
+  }
+
+  // Encode the object ids back to back and hash them in a single call.
+  size_t total_length = 0;
+  for (size_t i = 0; i < object_ids.size(); ++i) {
+    total_length += 4 + object_ids[i].name().size();
+  }
+  vector<uint8> encoded(total_length);
+  vector<size_t> lengths(object_ids.size());
+  uint8* next = &encoded[0];
+  for (size_t i = 0; i < object_ids.size(); ++i) {
+    const string& name = object_ids[i].name();
+    EncodeSource(object_ids[i].source(), next);
+    memcpy(next + 4, name.data(), name.size());
+    lengths[i] = 4 + name.size();
+    next += lengths[i];
+  }
+  vector<uint8> digest_bytes(object_ids.size() * ObjectIdDigest::kLength);
+  digest_fn->GetDigestsToBuffer(&encoded[0], &lengths[0], object_ids.size(),
+                                &digest_bytes[0], ObjectIdDigest::kLength);
+
+  size_t start = digests->size();
+  digests->resize(start + object_ids.size());
+  for (size_t i = 0; i < object_ids.size(); ++i) {
+    memcpy((*digests)[start + i].bytes,
+           &digest_bytes[i * ObjectIdDigest::kLength], ObjectIdDigest::kLength);
+  }
+}
+
 }  // namespace invalidation
@@ -17,7 +17,10 @@
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_OBJECT_ID_DIGEST_UTILS_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_OBJECT_ID_DIGEST_UTILS_H_
 
+#include <string.h>
+
 #include <map>
+#include <vector>
 
 #include "google/cacheinvalidation/deps/digest-function.h"
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
@@ -25,24 +28,68 @@
 namespace invalidation {
 
 using INVALIDATION_STL_NAMESPACE::map;
+using INVALIDATION_STL_NAMESPACE::vector;
+
+/* Fixed-size digest of a single object id. Ordered bytewise, which matches
+ * the ordering of the same digest held in a string.
+ */
+struct ObjectIdDigest {
+  /* Length of an object id digest (a SHA-1 digest) in bytes. */
+  static const int kLength = 20;
+
+  bool operator<(const ObjectIdDigest& other) const {
+    return memcmp(bytes, other.bytes, kLength) < 0;
+  }
+
+  bool operator==(const ObjectIdDigest& other) const {
+    return memcmp(bytes, other.bytes, kLength) == 0;
+  }
+
+  /* Returns the digest as a string of kLength bytes. */
+  string ToString() const {
+    return string(reinterpret_cast<const char*>(bytes), kLength);
+  }
+
+  uint8 bytes[kLength];
+};
 
 class ObjectIdDigestUtils {
  public:
   /* Returns the digest of the set of keys in the given map. */
   template<typename T>
   static string GetDigest(
-      map<string, T> registrations, DigestFunction* digest_fn) {
+      const map<ObjectIdDigest, T>& registrations, DigestFunction* digest_fn) {
     digest_fn->Reset();
-    for (map<string, ObjectIdP>::iterator iter = registrations.begin();
+    for (typename map<ObjectIdDigest, T>::const_iterator iter =
+             registrations.begin();
          iter != registrations.end(); ++iter) {
-      digest_fn->Update(iter->first);
+      digest_fn->UpdateBuffer(iter->first.bytes, ObjectIdDigest::kLength);
     }
     return digest_fn->GetDigest();
   }
 
+  /* Returns the digest of the set of objects whose digests are
+   * sorted_digests, which must be in increasing order. This is the digest of a
+   * store holding exactly those objects.
+   */
+  static string GetDigest(const vector<ObjectIdDigest>& sorted_digests,
+                          DigestFunction* digest_fn);
+
   /* Returns the digest of object_id using digest_fn. */
   static string GetDigest(
       const ObjectIdP& object_id, DigestFunction* digest_fn);
+
+  /* Stores the digest of object_id in digest without allocating. */
+  static void GetDigest(const ObjectIdP& object_id, DigestFunction* digest_fn,
+                        ObjectIdDigest* digest);
+
+  /* Appends the digest of each of object_ids, in order, to digests. The
+   * object ids are hashed with a single DigestFunction::GetDigestsToBuffer
+   * call.
+   */
+  static void GetDigests(const vector<ObjectIdP>& object_ids,
+                         DigestFunction* digest_fn,
+                         vector<ObjectIdDigest>* digests);
 };
 }  // namespace invalidation
 
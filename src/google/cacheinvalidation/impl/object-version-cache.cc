@@ -0,0 +1,73 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A bounded cache of the highest acknowledged version of each object, used to
+// suppress invalidations that the application has already processed.
+
+#include "google/cacheinvalidation/impl/object-version-cache.h"
+
+namespace invalidation {
+
+bool ObjectVersionCache::IsStale(const ObjectIdP& object_id,
+                                 int64 version) const {
+  map<ObjectIdP, Entry, ProtoCompareLess>::const_iterator iter =
+      versions_.find(object_id);
+  return (iter != versions_.end()) && (version <= iter->second.version);
+}
+
+bool ObjectVersionCache::Record(const ObjectIdP& object_id, int64 version) {
+  if (max_size_ <= 0) {
+    return false;
+  }
+  map<ObjectIdP, Entry, ProtoCompareLess>::iterator iter =
+      versions_.find(object_id);
+  if (iter != versions_.end()) {
+    if (version <= iter->second.version) {
+      return false;
+    }
+    // Move the object to the most recently updated end.
+    iter->second.version = version;
+    recency_.splice(recency_.end(), recency_, iter->second.position);
+  } else {
+    if (static_cast<int>(versions_.size()) >= max_size_) {
+      versions_.erase(recency_.front());
+      recency_.pop_front();
+    }
+    Entry entry;
+    entry.version = version;
+    entry.position = recency_.insert(recency_.end(), object_id);
+    versions_.insert(make_pair(object_id, entry));
+  }
+  ++generation_;
+  return true;
+}
+
+void ObjectVersionCache::GetEntries(
+    RepeatedPtrField<ObjectVersionP>* entries) const {
+  for (RecencyList::const_iterator iter = recency_.begin();
+       iter != recency_.end(); ++iter) {
+    ObjectVersionP* entry = entries->Add();
+    entry->mutable_object_id()->CopyFrom(*iter);
+    entry->set_version(versions_.find(*iter)->second.version);
+  }
+}
+
+void ObjectVersionCache::MergeEntries(
+    const RepeatedPtrField<ObjectVersionP>& entries) {
+  for (int i = 0; i < entries.size(); ++i) {
+    Record(entries.Get(i).object_id(), entries.Get(i).version());
+  }
+}
+
+}  // namespace invalidation
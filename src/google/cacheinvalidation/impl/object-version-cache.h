@@ -0,0 +1,103 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A bounded cache of the highest acknowledged version of each object, used to
+// suppress invalidations that the application has already processed.
+
+#ifndef GOOGLE_CACHEINVALIDATION_IMPL_OBJECT_VERSION_CACHE_H_
+#define GOOGLE_CACHEINVALIDATION_IMPL_OBJECT_VERSION_CACHE_H_
+
+#include <list>
+#include <map>
+
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
+#include "google/cacheinvalidation/impl/proto-helpers.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::list;
+using INVALIDATION_STL_NAMESPACE::make_pair;
+using INVALIDATION_STL_NAMESPACE::map;
+
+class ObjectVersionCache {
+ public:
+  /* Creates a cache holding at most max_size objects. If max_size <= 0, the
+   * cache is disabled: it records nothing and considers nothing stale.
+   */
+  explicit ObjectVersionCache(int max_size)
+      : max_size_(max_size), generation_(0) {}
+
+  /* Returns whether version is at or below the highest version recorded for
+   * object_id.
+   */
+  bool IsStale(const ObjectIdP& object_id, int64 version) const;
+
+  /* Records that the application has acknowledged version of object_id,
+   * evicting the least recently updated object if the cache is full. Returns
+   * whether the cache changed.
+   */
+  bool Record(const ObjectIdP& object_id, int64 version);
+
+  /* Appends all entries to entries, least recently updated first. */
+  void GetEntries(RepeatedPtrField<ObjectVersionP>* entries) const;
+
+  /* Records every entry in entries, in order. */
+  void MergeEntries(const RepeatedPtrField<ObjectVersionP>& entries);
+
+  /* Returns a counter that is incremented every time the cache changes. */
+  int64 generation() const {
+    return generation_;
+  }
+
+  int size() const {
+    return versions_.size();
+  }
+
+  string ToString() const {
+    return StringPrintf("ObjectVersionCache: %d of %d objects", size(),
+                        max_size_);
+  }
+
+ private:
+  /* Objects ordered from least to most recently updated. */
+  typedef list<ObjectIdP> RecencyList;
+
+  struct Entry {
+    /* Highest acknowledged version of the object. */
+    int64 version;
+
+    /* Position of the object in recency_. */
+    RecencyList::iterator position;
+  };
+
+  /* Maximum number of objects in the cache. */
+  int max_size_;
+
+  /* Number of changes made to the cache so far. */
+  int64 generation_;
+
+  /* Highest acknowledged version for each cached object. */
+  map<ObjectIdP, Entry, ProtoCompareLess> versions_;
+
+  /* Cached objects, least recently updated first. */
+  RecencyList recency_;
+
+  DISALLOW_COPY_AND_ASSIGN(ObjectVersionCache);
+};
+
+}  // namespace invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_IMPL_OBJECT_VERSION_CACHE_H_
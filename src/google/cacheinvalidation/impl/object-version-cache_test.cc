@@ -0,0 +1,91 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the object version cache.
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/impl/object-version-cache.h"
+
+namespace invalidation {
+
+class ObjectVersionCacheTest : public testing::Test {
+ public:
+  // Returns an object id with the given name.
+  static ObjectIdP MakeObjectId(const string& name) {
+    ObjectIdP object_id;
+    object_id.set_source(4);
+    object_id.set_name(name);
+    return object_id;
+  }
+};
+
+// Tests that versions at or below the recorded one are stale.
+TEST_F(ObjectVersionCacheTest, SuppressesOldVersions) {
+  ObjectVersionCache cache(10);
+  ObjectIdP oid = MakeObjectId("oid");
+  EXPECT_FALSE(cache.IsStale(oid, 5));
+  EXPECT_TRUE(cache.Record(oid, 5));
+  EXPECT_TRUE(cache.IsStale(oid, 4));
+  EXPECT_TRUE(cache.IsStale(oid, 5));
+  EXPECT_FALSE(cache.IsStale(oid, 6));
+
+  // Recording an older version does not change the cache.
+  int64 generation = cache.generation();
+  EXPECT_FALSE(cache.Record(oid, 3));
+  EXPECT_EQ(generation, cache.generation());
+  EXPECT_TRUE(cache.IsStale(oid, 5));
+}
+
+// Tests that the least recently updated object is evicted when full.
+TEST_F(ObjectVersionCacheTest, EvictsLeastRecentlyUpdated) {
+  ObjectVersionCache cache(2);
+  ObjectIdP oid1 = MakeObjectId("oid1");
+  ObjectIdP oid2 = MakeObjectId("oid2");
+  ObjectIdP oid3 = MakeObjectId("oid3");
+  cache.Record(oid1, 1);
+  cache.Record(oid2, 1);
+  cache.Record(oid1, 2);  // oid2 is now the least recently updated.
+  cache.Record(oid3, 1);
+  EXPECT_EQ(2, cache.size());
+  EXPECT_TRUE(cache.IsStale(oid1, 2));
+  EXPECT_FALSE(cache.IsStale(oid2, 1));
+  EXPECT_TRUE(cache.IsStale(oid3, 1));
+}
+
+// Tests that a disabled cache never suppresses anything.
+TEST_F(ObjectVersionCacheTest, Disabled) {
+  ObjectVersionCache cache(0);
+  ObjectIdP oid = MakeObjectId("oid");
+  EXPECT_FALSE(cache.Record(oid, 5));
+  EXPECT_FALSE(cache.IsStale(oid, 1));
+}
+
+// Tests that entries survive a round trip through their proto form.
+TEST_F(ObjectVersionCacheTest, GetAndMergeEntries) {
+  ObjectVersionCache cache(2);
+  cache.Record(MakeObjectId("oid1"), 7);
+  cache.Record(MakeObjectId("oid2"), 8);
+  RepeatedPtrField<ObjectVersionP> entries;
+  cache.GetEntries(&entries);
+  ASSERT_EQ(2, entries.size());
+  EXPECT_EQ("oid1", entries.Get(0).object_id().name());
+
+  ObjectVersionCache restored(2);
+  restored.MergeEntries(entries);
+  EXPECT_TRUE(restored.IsStale(MakeObjectId("oid1"), 7));
+  EXPECT_TRUE(restored.IsStale(MakeObjectId("oid2"), 8));
+  EXPECT_FALSE(restored.IsStale(MakeObjectId("oid2"), 9));
+}
+
+}  // namespace invalidation
@@ -33,6 +33,15 @@ void ProtoConverter::ConvertToObjectIdProto(
   object_id_proto->set_name(object_id.name());
 }
 
+void ProtoConverter::ConvertToObjectIdProtos(
+    const vector<ObjectId>& object_ids, vector<ObjectIdP>* object_id_protos) {
+  size_t start = object_id_protos->size();
+  object_id_protos->resize(start + object_ids.size());
+  for (size_t i = 0; i < object_ids.size(); ++i) {
+    ConvertToObjectIdProto(object_ids[i], &(*object_id_protos)[start + i]);
+  }
+}
+
 void ProtoConverter::ConvertFromInvalidationProto(
     const InvalidationP& invalidation_proto, Invalidation* invalidation) {
   ObjectId object_id;
@@ -47,6 +56,22 @@ void ProtoConverter::ConvertFromInvalidationProto(
   }
 }
 
+void ProtoConverter::ConvertFromInvalidationProto(
+    InvalidationP* invalidation_proto, Invalidation* invalidation) {
+  ObjectId object_id;
+  ConvertFromObjectIdProto(invalidation_proto->object_id(), &object_id);
+  bool is_trickle_restart = invalidation_proto->is_trickle_restart();
+  if (invalidation_proto->has_payload()) {
+    invalidation->Init(object_id, invalidation_proto->version(),
+                       invalidation_proto->mutable_payload(),
+                       is_trickle_restart);
+    invalidation_proto->clear_payload();
+  } else {
+    invalidation->Init(object_id, invalidation_proto->version(),
+                       is_trickle_restart);
+  }
+}
+
 void ProtoConverter::ConvertToInvalidationProto(
     const Invalidation& invalidation, InvalidationP* invalidation_proto) {
   ConvertToObjectIdProto(
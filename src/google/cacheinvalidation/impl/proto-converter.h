@@ -18,11 +18,15 @@
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_PROTO_CONVERTER_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_PROTO_CONVERTER_H_
 
+#include <vector>
+
 #include "google/cacheinvalidation/include/types.h"
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 
 namespace invalidation {
 
+using INVALIDATION_STL_NAMESPACE::vector;
+
 class ProtoConverter {
  public:
   /* Converts an object id protocol buffer 'object_id_proto' to the
@@ -37,12 +41,25 @@ class ProtoConverter {
   static void ConvertToObjectIdProto(
       const ObjectId& object_id, ObjectIdP* object_id_proto);
 
+  /* Appends the protocol buffer for each of 'object_ids', in order, to
+   * 'object_id_protos'. Each name is copied once, directly into its final
+   * location.
+   */
+  static void ConvertToObjectIdProtos(
+      const vector<ObjectId>& object_ids, vector<ObjectIdP>* object_id_protos);
+
   /* Converts an invalidation protocol buffer 'invalidation_proto' to the
    * corresponding external object 'invalidation'.
    */
   static void ConvertFromInvalidationProto(
       const InvalidationP& invalidation_proto, Invalidation* invalidation);
 
+  /* Like the above, but moves the payload of 'invalidation_proto' into
+   * 'invalidation' instead of copying it, clearing it from the proto.
+   */
+  static void ConvertFromInvalidationProto(
+      InvalidationP* invalidation_proto, Invalidation* invalidation);
+
   /* Converts an invalidation to the corresponding protocol
    * buffer and returns it.
    */
@@ -283,6 +283,14 @@ DEFINE_TO_STRING(ProtocolHandlerConfigP) {
   BEGIN();
   OPTIONAL(batching_delay_ms);
   REPEATED(rate_limit);
+  OPTIONAL(validate_outbound_messages);
+  OPTIONAL(ack_batching_delay_ms);
+  OPTIONAL(ack_flush_threshold);
+  OPTIONAL(adaptive_batching);
+  OPTIONAL(min_batching_delay_ms);
+  OPTIONAL(max_batching_delay_ms);
+  OPTIONAL(registration_objects_per_second);
+  OPTIONAL(max_registrations_per_message);
   END();
 }
 
@@ -43,8 +43,8 @@ string ServerMessageHeader::ToString() const {
       ProtoHelpers::ToString(*registration_summary_).c_str());
 }
 
-void ParsedMessage::InitFrom(const ServerToClientMessage& raw_message) {
-  base_message = raw_message;  // Does a deep copy.
+void ParsedMessage::InitFrom(ServerToClientMessage* raw_message) {
+  base_message.Swap(raw_message);
 
   // For each field, assign it to the corresponding protobuf field if
   // present, else NULL.
@@ -56,7 +56,7 @@ void ParsedMessage::InitFrom(const ServerToClientMessage& raw_message) {
       &base_message.token_control_message() : NULL;
 
   invalidation_message = base_message.has_invalidation_message() ?
-      &base_message.invalidation_message() : NULL;
+      base_message.mutable_invalidation_message() : NULL;
 
   registration_status_message =
       base_message.has_registration_status_message() ?
@@ -85,9 +85,19 @@ ProtocolHandler::ProtocolHandler(
       internal_scheduler_(resources->internal_scheduler()),
       network_(resources->network()),
       throttle_(config.rate_limit(), internal_scheduler_,
-          NewPermanentCallback(this, &ProtocolHandler::SendMessageToServer)),
+          NewPermanentCallback(
+              this, &ProtocolHandler::SendMessageWithPendingAcks)),
       listener_(listener),
       msg_validator_(msg_validator),
+      validate_outbound_messages_(config.validate_outbound_messages()),
+      ack_flush_threshold_(config.ack_flush_threshold()),
+      adaptive_batching_(config.adaptive_batching()),
+      batching_delay_controller_(
+          TimeDelta::FromMilliseconds(config.min_batching_delay_ms()),
+          TimeDelta::FromMilliseconds(config.max_batching_delay_ms()),
+          TimeDelta::FromMilliseconds(config.batching_delay_ms())),
+      registration_pacer_(config.registration_objects_per_second(),
+                          config.max_registrations_per_message()),
       message_id_(1),
       last_known_server_time_ms_(0),
       next_message_send_time_ms_(0),
@@ -97,6 +107,11 @@ ProtocolHandler::ProtocolHandler(
   // Initialize client version.
   ProtoHelpers::InitClientVersion(resources->platform(), application_name,
       &client_version_);
+
+  // Initialize the constant part of the client header.
+  ProtoHelpers::InitProtocolVersion(
+      header_template_.mutable_protocol_version());
+  header_template_.set_client_type(client_type_);
 }
 
 void ProtocolHandler::InitConfig(ProtocolHandlerConfigP* config) {
@@ -119,6 +134,9 @@ void ProtocolHandler::InitConfigForTest(ProtocolHandlerConfigP* config) {
   ProtoHelpers::InitRateLimitP(1000, 1, config->add_rate_limit());
   // At most six messages per minute.
   ProtoHelpers::InitRateLimitP(60 * 1000, 6, config->add_rate_limit());
+
+  // Check every outbound message.
+  config->set_validate_outbound_messages(true);
 }
 
 bool ProtocolHandler::HandleIncomingMessage(const string& incoming_message,
@@ -174,7 +192,7 @@ bool ProtocolHandler::HandleIncomingMessage(const string& incoming_message,
   if (message_header.server_time_ms() > last_known_server_time_ms_) {
     last_known_server_time_ms_ = message_header.server_time_ms();
   }
-  parsed_message->InitFrom(message);
+  parsed_message->InitFrom(&message);
   return true;
 }
 
@@ -223,11 +241,15 @@ void ProtocolHandler::SendInitializeMessage(
   // when the batching task runs.
   InitializeMessage* message = new InitializeMessage();
   ProtoHelpers::InitInitializeMessage(application_client_id, nonce, message);
+  if (!IsValidOutgoingPart(*message)) {
+    delete message;
+    return;
+  }
   TLOG(logger_, INFO, "Batching initialize message for client: %s, %s",
        debug_string.c_str(),
        ProtoHelpers::ToString(*message).c_str());
   batcher_.SetInitializeMessage(message);
-  batching_task->EnsureScheduled(debug_string);
+  ScheduleBatchingTask(batching_task, debug_string);
 }
 
 void ProtocolHandler::SendInfoMessage(
@@ -258,10 +280,14 @@ void ProtocolHandler::SendInfoMessage(
   message->set_server_registration_summary_requested(
       request_server_registration_summary);
 
+  if (!IsValidOutgoingPart(*message)) {
+    delete message;
+    return;
+  }
   TLOG(logger_, INFO, "Batching info message for client: %s",
        ProtoHelpers::ToString(*message).c_str());
   batcher_.SetInfoMessage(message);
-  batching_task->EnsureScheduled("Send-info");
+  ScheduleBatchingTask(batching_task, "Send-info");
 }
 
 void ProtocolHandler::SendRegistrations(
@@ -270,9 +296,11 @@ void ProtocolHandler::SendRegistrations(
     BatchingTask* batching_task) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   for (size_t i = 0; i < object_ids.size(); ++i) {
-    batcher_.AddRegistration(object_ids[i], reg_op_type);
+    registration_pacer_.Add(object_ids[i], reg_op_type);
   }
-  batching_task->EnsureScheduled("Send-registrations");
+  statistics_->SetGauge(Statistics::GaugeType_REGISTRATION_PACER_QUEUE_DEPTH,
+                        registration_pacer_.GetQueueDepth());
+  ScheduleBatchingTask(batching_task, "Send-registrations");
 }
 
 void ProtocolHandler::SendInvalidationAck(const InvalidationP& invalidation,
@@ -281,7 +309,48 @@ void ProtocolHandler::SendInvalidationAck(const InvalidationP& invalidation,
   // We could summarize acks if there are suppressing invalidations - we don't
   // since it is unlikely to be too beneficial here.
   batcher_.AddAck(invalidation);
-  batching_task->EnsureScheduled("Send-ack");
+  batching_delay_controller_.RecordEnqueue(
+      internal_scheduler_->GetCurrentTime());
+  if (batcher_.GetPendingAckCount() >= ack_flush_threshold_) {
+    SendPendingAcks();
+  }
+  if (batcher_.GetPendingAckCount() > 0) {
+    // Not sent yet (e.g., because of the rate limits or a quiet period).
+    batching_task->EnsureScheduled("Send-ack");
+  }
+}
+
+void ProtocolHandler::ScheduleBatchingTask(BatchingTask* batching_task,
+    const string& debug_string) {
+  batching_delay_controller_.RecordEnqueue(
+      internal_scheduler_->GetCurrentTime());
+  if (adaptive_batching_ && !batching_task->is_scheduled()) {
+    double headroom = throttle_.GetHeadroom();
+    TimeDelta delay = batching_delay_controller_.GetDelay(headroom);
+    batching_task->set_initial_delay(delay);
+    statistics_->SetGauge(Statistics::GaugeType_BATCHING_DELAY_MS,
+                          static_cast<int>(delay.InMilliseconds()));
+    statistics_->SetGauge(Statistics::GaugeType_BATCHING_ENQUEUE_RATE,
+                          batching_delay_controller_.GetEnqueueRatePerMinute());
+    statistics_->SetGauge(Statistics::GaugeType_BATCHING_THROTTLE_HEADROOM,
+                          static_cast<int>(headroom * 100));
+  }
+  batching_task->EnsureScheduled(debug_string);
+}
+
+void ProtocolHandler::SendPendingAcks() {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  if (batcher_.GetPendingAckCount() > 0) {
+    throttle_.Fire();
+  }
+}
+
+void ProtocolHandler::SendMessageWithPendingAcks() {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  if (batcher_.GetPendingAckCount() > 0) {
+    // The throttle records this call itself.
+    SendMessage();
+  }
 }
 
 void ProtocolHandler::SendRegistrationSyncSubtree(
@@ -290,38 +359,76 @@ void ProtocolHandler::SendRegistrationSyncSubtree(
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
   TLOG(logger_, INFO, "Adding subtree: %s",
        ProtoHelpers::ToString(reg_subtree).c_str());
-  batcher_.AddRegSubtree(reg_subtree);
-  batching_task->EnsureScheduled("Send-reg-sync");
+  registration_pacer_.AddSubtree(reg_subtree);
+  statistics_->SetGauge(Statistics::GaugeType_REGISTRATION_PACER_QUEUE_DEPTH,
+                        registration_pacer_.GetQueueDepth());
+  ScheduleBatchingTask(batching_task, "Send-reg-sync");
 }
 
 void ProtocolHandler::SendMessageToServer() {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  if (SendMessage()) {
+    // Count the message against the rate limits, so that the ack lane and the
+    // adaptive batching delay see the real send rate.
+    throttle_.RecordEvent();
+  }
+}
 
+bool ProtocolHandler::SendMessage() {
   if (next_message_send_time_ms_ > GetCurrentTimeMs()) {
     TLOG(logger_, WARNING, "In quiet period: not sending message to server: "
          "%s > %s",
          SimpleItoa(next_message_send_time_ms_).c_str(),
          SimpleItoa(GetCurrentTimeMs()).c_str());
-    return;
+    return false;
+  }
+
+  // Add the registrations and registration sync subtrees that the pacer
+  // releases now.
+  if (!registration_pacer_.IsEmpty()) {
+    vector<RegistrationP> registrations;
+    vector<RegistrationSubtree> subtrees;
+    registration_pacer_.TakeRegistrations(
+        internal_scheduler_->GetCurrentTime(), &registrations, &subtrees);
+    for (size_t i = 0; i < registrations.size(); ++i) {
+      batcher_.AddRegistration(registrations[i].object_id(),
+                               registrations[i].op_type());
+    }
+    for (size_t i = 0; i < subtrees.size(); ++i) {
+      batcher_.AddRegSubtree(subtrees[i]);
+    }
+    statistics_->SetGauge(
+        Statistics::GaugeType_REGISTRATION_PACER_QUEUE_DEPTH,
+        registration_pacer_.GetQueueDepth());
+  }
+
+  if (batcher_.IsEmpty()) {
+    // The other batching task already sent the pending data.
+    return false;
   }
 
   const bool has_client_token(!listener_->GetClientToken().empty());
   ClientToServerMessage builder;
   if (!batcher_.ToBuilder(&builder, has_client_token)) {
     TLOG(logger_, WARNING, "Unable to build message");
-    return;
+    return false;
   }
   ClientHeader* outgoing_header = builder.mutable_header();
   InitClientHeader(outgoing_header);
 
-  // Validate the message and send it.
+  // The batched parts are valid by construction, and so is the header, but a
+  // message must carry exactly one of an initialize message and a token.
+  // Validate the whole message only if asked to.
   ++message_id_;
-  if (!msg_validator_->IsValid(builder)) {
+  bool is_valid = validate_outbound_messages_ ?
+      msg_validator_->IsValid(builder) :
+      (builder.has_initialize_message() ^ outgoing_header->has_client_token());
+  if (!is_valid) {
     TLOG(logger_, SEVERE, "Tried to send invalid message: %s",
          ProtoHelpers::ToString(builder).c_str());
     statistics_->RecordError(
         Statistics::ClientErrorType_OUTGOING_MESSAGE_FAILURE);
-    return;
+    return false;
   }
 
   TLOG(logger_, FINE, "Sending message to server: %s",
@@ -334,15 +441,26 @@ void ProtocolHandler::SendMessageToServer() {
   // Record that the message was sent. We do this inline to match what the
   // Java Ticl, which is constrained by Android requirements, does.
   listener_->HandleMessageSent();
+  return true;
+}
+
+TimeDelta ProtocolHandler::GetPacedRegistrationDelay() {
+  CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
+  TimeDelta delay = registration_pacer_.GetDelayUntilReady(
+      internal_scheduler_->GetCurrentTime());
+  int64 quiet_period_ms = next_message_send_time_ms_ - GetCurrentTimeMs();
+  if (quiet_period_ms > delay.InMilliseconds()) {
+    delay = TimeDelta::FromMilliseconds(quiet_period_ms);
+  }
+  return delay;
 }
 
 void ProtocolHandler::InitClientHeader(ClientHeader* builder) {
   CHECK(internal_scheduler_->IsRunningOnThread()) << "Not on internal thread";
-  ProtoHelpers::InitProtocolVersion(builder->mutable_protocol_version());
+  builder->CopyFrom(header_template_);
   builder->set_client_time_ms(GetCurrentTimeMs());
   builder->set_message_id(StringPrintf("%d", message_id_));
   builder->set_max_known_server_time_ms(last_known_server_time_ms_);
-  builder->set_client_type(client_type_);
   listener_->GetRegistrationSummary(builder->mutable_registration_summary());
   const string& client_token = listener_->GetClientToken();
   if (!client_token.empty()) {
@@ -352,6 +470,47 @@ void ProtocolHandler::InitClientHeader(ClientHeader* builder) {
   }
 }
 
+template<typename T>
+bool ProtocolHandler::IsValidOutgoingPart(const T& message) {
+  if (msg_validator_->IsValid(message)) {
+    return true;
+  }
+  TLOG(logger_, SEVERE, "Not sending invalid message part: %s",
+       ProtoHelpers::ToString(message).c_str());
+  statistics_->RecordError(
+      Statistics::ClientErrorType_OUTGOING_MESSAGE_FAILURE);
+  return false;
+}
+
+Batcher::~Batcher() {
+  set<InvalidationP*, InvalidationPtrLess>::iterator iter;
+  for (iter = pending_acked_invalidations_.begin();
+       iter != pending_acked_invalidations_.end(); ++iter) {
+    delete *iter;
+  }
+}
+
+void Batcher::AddAck(const InvalidationP& invalidation) {
+  InvalidationP* ack = new InvalidationP();
+  ack->CopyFrom(invalidation);
+  if (!pending_acked_invalidations_.insert(ack).second) {
+    delete ack;  // Already pending.
+  }
+}
+
+void Batcher::AddRegSubtree(const RegistrationSubtree& reg_subtree) {
+  // Only the handful of subtrees queued since the last message are compared,
+  // and each comparison stops at the first difference.
+  ProtoCompareLess compare_less_than;
+  for (size_t i = 0; i < pending_reg_subtrees_.size(); ++i) {
+    if (!compare_less_than(pending_reg_subtrees_[i], reg_subtree) &&
+        !compare_less_than(reg_subtree, pending_reg_subtrees_[i])) {
+      return;  // Already pending.
+    }
+  }
+  pending_reg_subtrees_.push_back(reg_subtree);
+}
+
 bool Batcher::ToBuilder(ClientToServerMessage* builder, bool has_client_token) {
   // Check if an initialize message needs to be sent.
   if (pending_initialize_message_.get() != NULL) {
@@ -394,10 +553,8 @@ bool Batcher::ToBuilder(ClientToServerMessage* builder, bool has_client_token) {
   if (!pending_reg_subtrees_.empty()) {
     RegistrationSyncMessage* sync_message =
         builder->mutable_registration_sync_message();
-    set<RegistrationSubtree, ProtoCompareLess>::const_iterator iter;
-    for (iter = pending_reg_subtrees_.begin();
-         iter != pending_reg_subtrees_.end(); ++iter) {
-      sync_message->add_subtree()->CopyFrom(*iter);
+    for (size_t i = 0; i < pending_reg_subtrees_.size(); ++i) {
+      sync_message->add_subtree()->Swap(&pending_reg_subtrees_[i]);
     }
     pending_reg_subtrees_.clear();
     statistics_->RecordSentMessage(
@@ -430,11 +587,14 @@ void Batcher::InitRegistrationMessage(
 void Batcher::InitAckMessage(InvalidationMessage* ack_message) {
   CHECK(!pending_acked_invalidations_.empty());
 
-  // Run through pending_acked_invalidations_ set.
-  set<InvalidationP, ProtoCompareLess>::iterator iter;
+  // Run through pending_acked_invalidations_ set, handing each ack over to the
+  // message.
+  RepeatedPtrField<InvalidationP>* invalidations =
+      ack_message->mutable_invalidation();
+  set<InvalidationP*, InvalidationPtrLess>::iterator iter;
   for (iter = pending_acked_invalidations_.begin();
        iter != pending_acked_invalidations_.end(); iter++) {
-    ack_message->add_invalidation()->CopyFrom(*iter);
+    invalidations->AddAllocated(*iter);
   }
   pending_acked_invalidations_.clear();
 }
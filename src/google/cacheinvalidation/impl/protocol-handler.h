@@ -26,10 +26,12 @@
 
 #include "google/cacheinvalidation/include/system-resources.h"
 #include "google/cacheinvalidation/deps/scoped_ptr.h"
+#include "google/cacheinvalidation/impl/batching-delay-controller.h"
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 #include "google/cacheinvalidation/impl/invalidation-client-util.h"
 #include "google/cacheinvalidation/impl/proto-helpers.h"
 #include "google/cacheinvalidation/impl/recurring-task.h"
+#include "google/cacheinvalidation/impl/registration-pacer.h"
 #include "google/cacheinvalidation/impl/statistics.h"
 #include "google/cacheinvalidation/impl/smearer.h"
 #include "google/cacheinvalidation/impl/throttle.h"
@@ -109,7 +111,8 @@ struct ParsedMessage {
    * method in the protobuf would return true.
    */
   const TokenControlMessage* token_control_message;
-  const InvalidationMessage* invalidation_message;
+  /* Not const, so that invalidation payloads can be moved out of it. */
+  InvalidationMessage* invalidation_message;
   const RegistrationStatusMessage* registration_status_message;
   const RegistrationSyncRequestMessage* registration_sync_request_message;
   const ConfigChangeMessage* config_change_message;
@@ -117,10 +120,10 @@ struct ParsedMessage {
   const ErrorMessage* error_message;
 
   /*
-   * Initializes an instance from a |raw_message|. This function makes a copy of
-   * the message internally.
+   * Initializes an instance from a |raw_message|, whose contents are moved
+   * into this instance (leaving |raw_message| empty).
    */
-  void InitFrom(const ServerToClientMessage& raw_message);
+  void InitFrom(ServerToClientMessage* raw_message);
 
  private:
   ServerToClientMessage base_message;
@@ -129,12 +132,20 @@ struct ParsedMessage {
 
 /*
  * Class that batches messages to be sent to the data center.
+ *
+ * Everything added to the batcher is valid by construction: acks have been
+ * validated when acknowledged, registrations when requested by the
+ * application, and initialize and info messages when built by the protocol
+ * handler; registration subtrees hold only such registrations. The messages it
+ * builds therefore need not be validated again before sending.
  */
 class Batcher {
  public:
   Batcher(Logger* logger, Statistics* statistics)
       : logger_(logger), statistics_(statistics) {}
 
+  ~Batcher();
+
   /* Sets the initialize |message| to be sent to the server. */
   void SetInitializeMessage(const InitializeMessage* message) {
     pending_initialize_message_.reset(message);
@@ -152,15 +163,18 @@ class Batcher {
   }
 
   /* Adds an acknowledgment of |invalidation| to be sent to the server. */
-  void AddAck(const InvalidationP& invalidation) {
-    pending_acked_invalidations_.insert(invalidation);
-  }
+  void AddAck(const InvalidationP& invalidation);
 
-  /* Adds a registration subtree |reg_subtree| to be sent to the server. */
-  void AddRegSubtree(const RegistrationSubtree& reg_subtree) {
-    pending_reg_subtrees_.insert(reg_subtree);
+  /* Returns the number of pending invalidation acks. */
+  size_t GetPendingAckCount() const {
+    return pending_acked_invalidations_.size();
   }
 
+  /* Adds a registration subtree |reg_subtree| to be sent to the server, unless
+   * an identical one is already pending.
+   */
+  void AddRegSubtree(const RegistrationSubtree& reg_subtree);
+
   /*
    * Builds a message from the batcher state and resets the batcher. Returns
    * whether the message could be built.
@@ -170,6 +184,14 @@ class Batcher {
   bool ToBuilder(ClientToServerMessage* builder,
       bool has_client_token);
 
+  /* Returns whether there is nothing to send to the server. */
+  bool IsEmpty() const {
+    return (pending_initialize_message_.get() == NULL) &&
+        (pending_info_message_.get() == NULL) &&
+        pending_registrations_.empty() &&
+        pending_acked_invalidations_.empty() && pending_reg_subtrees_.empty();
+  }
+
   /*
    * Initializes a registration message based on registrations from
    * |pending_registrations|.
@@ -179,13 +201,21 @@ class Batcher {
   void InitRegistrationMessage(RegistrationMessage* reg_message);
 
   /* Initializes an invalidation ack message based on acks from
-   * |pending_acked_invalidations|.
+   * |pending_acked_invalidations|, which are moved into it.
    * <p>
    * REQUIRES: pending_acked_invalidations.size() > 0
    */
   void InitAckMessage(InvalidationMessage* ack_message);
 
  private:
+  /* Orders pointers to invalidations by the invalidations they point to. */
+  struct InvalidationPtrLess {
+    bool operator()(const InvalidationP* invalidation1,
+                    const InvalidationP* invalidation2) const {
+      return ProtoCompareLess()(*invalidation1, *invalidation2);
+    }
+  };
+
   Logger* const logger_;
 
   Statistics* const statistics_;
@@ -196,11 +226,15 @@ class Batcher {
   map<ObjectIdP, RegistrationP::OpType, ProtoCompareLess>
       pending_registrations_;
 
-  /* Set of pending invalidation acks. */
-  set<InvalidationP, ProtoCompareLess> pending_acked_invalidations_;
+  /* Set of pending invalidation acks (owned), kept on the heap so that they
+   * can be handed to the outgoing message without being copied.
+   */
+  set<InvalidationP*, InvalidationPtrLess> pending_acked_invalidations_;
 
-  /* Set of pending registration sub trees for registration sync. */
-  set<RegistrationSubtree, ProtoCompareLess> pending_reg_subtrees_;
+  /* Pending registration sub trees for registration sync, in the order they
+   * were added, without duplicates.
+   */
+  vector<RegistrationSubtree> pending_reg_subtrees_;
 
   /* Pending initialization message to send to the server, if any. */
   scoped_ptr<const InitializeMessage> pending_initialize_message_;
@@ -310,7 +344,8 @@ class ProtocolHandler {
                        bool request_server_registration_summary,
                        BatchingTask* batching_task);
 
-  /* Sends a registration request to the server.
+  /* Sends a registration request to the server. The registrations are
+   * released into outgoing messages by the registration pacer.
    *
    * Arguments:
    * object_ids - object ids on which to (un)register
@@ -321,11 +356,27 @@ class ProtocolHandler {
                          RegistrationP::OpType reg_op_type,
                          BatchingTask* batching_task);
 
-  /* Sends an acknowledgement for invalidation to the server. */
+  /* Sends an acknowledgement for invalidation to the server.
+   *
+   * Arguments:
+   * invalidation - the acknowledged invalidation
+   * batching_task - recurring task to trigger batching, normally an
+   *     AckBatchingTask. No ownership taken.
+   *
+   * If the number of pending acks reaches the ack flush threshold, they are
+   * sent right away instead, subject to the rate limits.
+   */
   void SendInvalidationAck(const InvalidationP& invalidation,
                            BatchingTask* batching_task);
 
-  /* Sends a single registration subtree to the server.
+  /* Sends the pending acks, along with any other pending data, to the server,
+   * subject to the rate limits. Does nothing if no acks are pending.
+   */
+  void SendPendingAcks();
+
+  /* Sends a single registration subtree to the server. The subtree is
+   * released into outgoing messages by the registration pacer, along with the
+   * registrations.
    *
    * Arguments:
    * reg_subtree - subtree to send
@@ -341,6 +392,18 @@ class ProtocolHandler {
    */
   void SendMessageToServer();
 
+  /* Returns whether the registration pacer holds registrations or
+   * registration sync subtrees back.
+   */
+  bool HasPacedRegistrations() const {
+    return !registration_pacer_.IsEmpty();
+  }
+
+  /* Returns the delay until the registrations held back by the pacer may be
+   * sent, taking any quiet period requested by the server into account.
+   */
+  TimeDelta GetPacedRegistrationDelay();
+
   /*
    * Handles a message from the server. If the message can be processed (i.e.,
    * is valid, is of the right version, and is not a silence message), returns
@@ -362,6 +425,30 @@ class ProtocolHandler {
   /* Stores the header to include on a message to the server. */
   void InitClientHeader(ClientHeader* header);
 
+  /* Records that data was batched and ensures that |batching_task| is
+   * scheduled to send it. With adaptive batching, the task's delay is chosen
+   * by the batching delay controller whenever the task is not yet scheduled.
+   */
+  void ScheduleBatchingTask(BatchingTask* batching_task,
+                            const string& debug_string);
+
+  /* Sends a message to the server if acks are still pending: a batched
+   * message may have carried them since they were throttled.
+   */
+  void SendMessageWithPendingAcks();
+
+  /* Sends pending data to the server, as SendMessageToServer does, but
+   * without recording the send against the rate limits. Returns whether a
+   * message was sent.
+   */
+  bool SendMessage();
+
+  /* Returns whether |message|, built for the batcher, is valid. If not, logs
+   * and records an outgoing message failure.
+   */
+  template<typename T>
+  bool IsValidOutgoingPart(const T& message);
+
   // Returns the current time in milliseconds.
   int64 GetCurrentTimeMs() {
     return InvalidationClientUtil::GetCurrentTimeMs(internal_scheduler_);
@@ -373,6 +460,9 @@ class ProtocolHandler {
 
   ClientVersion client_version_;
 
+  // The fields of the client header that are the same on every message.
+  ClientHeader header_template_;
+
   // A logger.
   Logger* logger_;
 
@@ -393,6 +483,23 @@ class ProtocolHandler {
   // constraints.
   TiclMessageValidator* msg_validator_;
 
+  // Whether to validate each complete outbound message, rather than relying on
+  // the batcher to produce valid ones.
+  const bool validate_outbound_messages_;
+
+  // Number of pending acks at which they are sent without waiting for the ack
+  // batching task.
+  const size_t ack_flush_threshold_;
+
+  // Whether the batching delay adapts to the traffic.
+  const bool adaptive_batching_;
+
+  // Chooses the batching delay when adaptive batching is enabled.
+  BatchingDelayController batching_delay_controller_;
+
+  // Releases registrations into outgoing messages at a bounded rate.
+  RegistrationPacer registration_pacer_;
+
   /* A debug message id that is added to every message to the server. */
   int message_id_;
 
@@ -636,10 +636,19 @@ TEST_F(ProtocolHandlerTest, TokenMissing) {
       Statistics::ClientErrorType_TOKEN_MISSING_FAILURE));
 }
 
-// Tests that the protocol handler won't send out a message that fails
-// validation (in this case, an invalidation ack with a missing version).
+// Tests that, when asked to validate outbound messages, the protocol handler
+// won't send out a message that fails validation (in this case, an
+// invalidation ack with a missing version).
 TEST_F(ProtocolHandlerTest, InvalidOutboundMessage) {
   token = "test token";
+  config.set_validate_outbound_messages(true);
+  protocol_handler.reset(
+      new ProtocolHandler(
+          config, resources.get(), smearer.get(), statistics.get(),
+          ClientType_Type_TEST, "unit-test", &listener, validator.get()));
+  batching_task.reset(
+      new BatchingTask(protocol_handler.get(), smearer.get(),
+          TimeDelta::FromMilliseconds(config.batching_delay_ms())));
 
   vector<ObjectIdP> object_ids;
   InitTestObjectIds(1, &object_ids);
@@ -661,6 +670,95 @@ TEST_F(ProtocolHandlerTest, InvalidOutboundMessage) {
       Statistics::ClientErrorType_OUTGOING_MESSAGE_FAILURE));
 }
 
+// Tests that once the ack flush threshold is reached, the pending acks are sent
+// right away rather than after the batching delay.
+TEST_F(ProtocolHandlerTest, AckFlushThreshold) {
+  token = "test token";
+  config.set_ack_flush_threshold(2);
+  protocol_handler.reset(
+      new ProtocolHandler(
+          config, resources.get(), smearer.get(), statistics.get(),
+          ClientType_Type_TEST, "unit-test", &listener, validator.get()));
+  batching_task.reset(
+      new BatchingTask(protocol_handler.get(), smearer.get(),
+          TimeDelta::FromMilliseconds(config.batching_delay_ms())));
+
+  vector<ObjectIdP> object_ids;
+  InitTestObjectIds(2, &object_ids);
+  vector<InvalidationP> invalidations;
+  MakeInvalidationsFromObjectIds(object_ids, &invalidations);
+  for (size_t i = 0; i < invalidations.size(); ++i) {
+    internal_scheduler->Schedule(
+        Scheduler::NoDelay(),
+        NewPermanentCallback(
+            protocol_handler.get(), &ProtocolHandler::SendInvalidationAck,
+            invalidations[i], batching_task.get()));
+  }
+
+  InvalidationMessage expected_acks;
+  InitInvalidationMessage(invalidations, &expected_acks);
+  AddExpectationForHandleMessageSent();
+  EXPECT_CALL(
+      *network,
+      SendMessage(WhenDeserializedAs<ClientToServerMessage>(
+          Property(&ClientToServerMessage::invalidation_ack_message,
+                   EqualsProto(expected_acks)))));
+
+  // No time passes, so the batching task cannot have run.
+  internal_scheduler->PassTime(TimeDelta());
+
+  // Nothing is left for the batching task to send.
+  internal_scheduler->PassTime(GetMaxBatchingDelay(config));
+}
+
+// Tests that messages sent on the regular batching lane use up the rate limits
+// seen by the adaptive batching delay, so that the next batch waits longer.
+TEST_F(ProtocolHandlerTest, AdaptiveBatchingCountsRegularSends) {
+  token = "test token";
+  config.set_adaptive_batching(true);
+  ProtoHelpers::InitRateLimitP(5 * 1000, 3, config.add_rate_limit());
+  protocol_handler.reset(
+      new ProtocolHandler(
+          config, resources.get(), smearer.get(), statistics.get(),
+          ClientType_Type_TEST, "unit-test", &listener, validator.get()));
+  batching_task.reset(
+      new BatchingTask(protocol_handler.get(), smearer.get(),
+          TimeDelta::FromMilliseconds(config.batching_delay_ms())));
+  vector<pair<string, int> > empty_vector;
+  EXPECT_CALL(listener, HandleMessageSent()).Times(2);
+  EXPECT_CALL(*network, SendMessage(_)).Times(2);
+
+  // With no recent sends, the first batch waits the minimum delay.
+  internal_scheduler->Schedule(
+      Scheduler::NoDelay(),
+      NewPermanentCallback(
+          protocol_handler.get(), &ProtocolHandler::SendInfoMessage,
+          empty_vector, NULL, false, batching_task.get()));
+  internal_scheduler->PassTime(TimeDelta());
+  ASSERT_EQ(100, statistics->GetGaugeForTest(
+      Statistics::GaugeType_BATCHING_THROTTLE_HEADROOM));
+  ASSERT_EQ(config.min_batching_delay_ms(), statistics->GetGaugeForTest(
+      Statistics::GaugeType_BATCHING_DELAY_MS));
+
+  // The batching task sends the first message. The next batch, still within
+  // the rate limit window and at a low enqueue rate, waits well beyond the
+  // target latency because a third of the limit is used up.
+  internal_scheduler->PassTime(TimeDelta::FromSeconds(4));
+  internal_scheduler->Schedule(
+      Scheduler::NoDelay(),
+      NewPermanentCallback(
+          protocol_handler.get(), &ProtocolHandler::SendInfoMessage,
+          empty_vector, NULL, false, batching_task.get()));
+  internal_scheduler->PassTime(TimeDelta());
+  ASSERT_EQ(66, statistics->GetGaugeForTest(
+      Statistics::GaugeType_BATCHING_THROTTLE_HEADROOM));
+  ASSERT_GT(statistics->GetGaugeForTest(
+      Statistics::GaugeType_BATCHING_DELAY_MS), config.batching_delay_ms());
+
+  internal_scheduler->PassTime(
+      GetMaxDelay(config.max_batching_delay_ms()));
+}
+
 // Tests that the protocol handler drops an unparseable message.
 TEST_F(ProtocolHandlerTest, UnparseableInboundMessage) {
   // Make an unparseable message.
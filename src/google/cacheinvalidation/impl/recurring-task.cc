@@ -16,16 +16,18 @@
 //
 
 #include "google/cacheinvalidation/impl/recurring-task.h"
+#include "google/cacheinvalidation/deps/callback.h"
 #include "google/cacheinvalidation/impl/log-macro.h"
 
 namespace invalidation {
 
 RecurringTask::RecurringTask(string name, Scheduler* scheduler, Logger* logger,
     Smearer* smearer, ExponentialBackoffDelayGenerator* delay_generator,
-    TimeDelta initial_delay, TimeDelta timeout_delay) : name_(name),
+    TimeDelta initial_delay, TimeDelta timeout_delay,
+    Scheduler::Priority priority) : name_(name),
     scheduler_(scheduler), logger_(logger), smearer_(smearer),
     delay_generator_(delay_generator), initial_delay_(initial_delay),
-    timeout_delay_(timeout_delay), is_scheduled_(false) {
+    timeout_delay_(timeout_delay), priority_(priority), is_scheduled_(false) {
 }
 
 void RecurringTask::EnsureScheduled(string debug_reason) {
@@ -53,7 +55,7 @@ void RecurringTask::EnsureScheduled(bool is_retry, string debug_reason) {
   TLOG(logger_, FINE, "[%s] Scheduling %d with a delay %d, Now = %d",
        debug_reason.c_str(), name_.c_str(), delay.ToInternalValue(),
        scheduler_->GetCurrentTime().ToInternalValue());
-  scheduler_->Schedule(delay, NewPermanentCallback(this,
+  scheduler_->ScheduleWithPriority(delay, priority_, NewPooledCallback(this,
        &RecurringTask::RunTaskAndRescheduleIfNeeded));
   is_scheduled_ = true;
 }
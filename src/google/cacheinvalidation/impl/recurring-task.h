@@ -45,14 +45,16 @@ class RecurringTask {
    * |initial_delay|. If the |this->run()| returns true on its execution, the
    * task is rescheduled after a |timeout_delay| + smeared delay of
    * |initial_delay| or |timeout_delay| + |delay_generator->GetNextDelay()|
-   * depending on whether the |delay_generator| is null or not.
+   * depending on whether the |delay_generator| is null or not. The task is
+   * scheduled in the |priority| class of the scheduler.
    *
    * Space for |scheduler|, |logger|, |smearer| is owned by the caller.
    * Space for |delay_generator| is owned by the callee.
    */
   RecurringTask(string name, Scheduler* scheduler, Logger* logger,
       Smearer* smearer, ExponentialBackoffDelayGenerator* delay_generator,
-      TimeDelta initial_delay, TimeDelta timeout_delay);
+      TimeDelta initial_delay, TimeDelta timeout_delay,
+      Scheduler::Priority priority);
 
   virtual ~RecurringTask() {}
 
@@ -75,6 +77,18 @@ class RecurringTask {
     return smearer_;
   }
 
+  /* Returns whether the task is currently scheduled. */
+  bool is_scheduled() const {
+    return is_scheduled_;
+  }
+
+  /* Sets the delay (before smearing) after which the task is scheduled from
+   * now on.
+   */
+  void set_initial_delay(TimeDelta initial_delay) {
+    initial_delay_ = initial_delay;
+  }
+
  private:
   /* Run the task and check if it needs to be rescheduled. If so, reschedule it
    * after the appropriate delay.
@@ -117,6 +131,9 @@ class RecurringTask {
   /* For a task that is retried, add this time to the delay. */
   TimeDelta timeout_delay_;
 
+  /* Priority class in which the task is scheduled. */
+  Scheduler::Priority priority_;
+
   /* If the task has been currently scheduled. */
   bool is_scheduled_;
 
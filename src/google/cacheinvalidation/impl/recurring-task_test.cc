@@ -48,15 +48,18 @@ class TestTask : public RecurringTask {
    *   any).
    * |test_name| The name of the current test.
    * |max_runs| Maximum number of runs that are allowed.
+   * |priority| The priority class in which the task is scheduled.
    *
    * Space for all the objects with pointers is owned by the caller.
    */
   TestTask(Scheduler* scheduler, Logger* logger, Smearer* smearer,
            ExponentialBackoffDelayGenerator* delay_generator,
-           const string& test_name, int max_runs)
+           const string& test_name, int max_runs,
+           Scheduler::Priority priority)
       : RecurringTask(test_name, scheduler, logger, smearer, delay_generator,
-                      initial_delay, timeout_delay),
+                      initial_delay, timeout_delay, priority),
         current_runs(0),
+        last_run_order(0),
         max_runs_(max_runs),
         scheduler_(scheduler),
         logger_(logger) {
@@ -67,6 +70,7 @@ class TestTask : public RecurringTask {
   // The actual implementation as required by the RecurringTask.
   virtual bool RunTask() {
     current_runs++;
+    last_run_order = ++total_runs;
     TLOG(logger_, INFO, "(%d) Task running: %d",
          scheduler_->GetCurrentTime().ToInternalValue(), current_runs);
     return current_runs < max_runs_;
@@ -75,6 +79,12 @@ class TestTask : public RecurringTask {
   /* The number of times that the task has been run. */
   int current_runs;
 
+  /* The value of total_runs after the last run of this task. */
+  int last_run_order;
+
+  /* The number of runs of all tasks. */
+  static int total_runs;
+
  private:
   /* Maximum number of runs that are allowed. */
   int max_runs_;
@@ -98,6 +108,7 @@ class RecurringTaskTest : public testing::Test {
     TestTask::initial_delay = TimeDelta::FromMilliseconds(10);
     TestTask::timeout_delay = TimeDelta::FromMilliseconds(50);
     end_of_test_delay = 1000 * TestTask::timeout_delay;
+    TestTask::total_runs = 0;
 
     // Initialize state for every test.
     random.reset(new FakeRandom(0.99));  // The test expects a value close to 1.
@@ -145,6 +156,7 @@ class RecurringTaskTest : public testing::Test {
 // Definitions for the static variables.
 TimeDelta TestTask::initial_delay;
 TimeDelta TestTask::timeout_delay;
+int TestTask::total_runs;
 TimeDelta RecurringTaskTest::initial_exp_backoff_delay;
 TimeDelta RecurringTaskTest::end_of_test_delay;
 const int RecurringTaskTest::kMaxExpBackoffFactor = 10;
@@ -158,7 +170,7 @@ TEST_F(RecurringTaskTest, PeriodicTask) {
    * the number of times as expected.
    */
   TestTask task(scheduler.get(), logger.get(), smearer.get(), NULL,
-                "PeriodicTask", kDefaultNumRuns);
+                "PeriodicTask", kDefaultNumRuns, Scheduler::NORMAL_PRIORITY);
   task.EnsureScheduled("testPeriodicTask");
 
   TimeDelta delay = TestTask::initial_delay + TestTask::timeout_delay;
@@ -185,7 +197,8 @@ TEST_F(RecurringTaskTest, ExponentialBackoffTask) {
    * exactly the number of times as expected.
    */
   TestTask task(scheduler.get(), logger.get(), smearer.get(),
-                delay_generator, "ExponentialBackoffTask", kDefaultNumRuns);
+                delay_generator, "ExponentialBackoffTask", kDefaultNumRuns,
+                Scheduler::NORMAL_PRIORITY);
   task.EnsureScheduled("testExponentialBackoffTask");
 
   // Pass enough time so that exactly one event runs, two events run etc.
@@ -214,7 +227,7 @@ TEST_F(RecurringTaskTest, OneShotTask) {
   // Call ensureScheduled multiple times; ensure that the event is not scheduled
   // multiple times.
   TestTask task(scheduler.get(), logger.get(), smearer.get(),
-                delay_generator, "OneShotTask", 1);
+                delay_generator, "OneShotTask", 1, Scheduler::NORMAL_PRIORITY);
   task.EnsureScheduled("testOneShotTask");
   task.EnsureScheduled("testOneShotTask-2");
   task.EnsureScheduled("testOneShotTask-3");
@@ -233,4 +246,23 @@ TEST_F(RecurringTaskTest, OneShotTask) {
   ASSERT_EQ(2, task.current_runs);
 }
 
+/* Tests that a task of a higher priority class runs before a task of a lower
+ * class that became ready at the same time, even if scheduled later.
+ */
+TEST_F(RecurringTaskTest, PriorityTask) {
+  TestTask low_task(scheduler.get(), logger.get(), smearer.get(), NULL,
+                    "LowPriorityTask", 1, Scheduler::LOW_PRIORITY);
+  TestTask high_task(scheduler.get(), logger.get(), smearer.get(),
+                     delay_generator, "HighPriorityTask", 1,
+                     Scheduler::HIGH_PRIORITY);
+  low_task.EnsureScheduled("testPriorityTask-low");
+  high_task.EnsureScheduled("testPriorityTask-high");
+
+  scheduler->PassTime(TestTask::initial_delay);
+  ASSERT_EQ(1, high_task.current_runs);
+  ASSERT_EQ(1, low_task.current_runs);
+  ASSERT_EQ(1, high_task.last_run_order);
+  ASSERT_EQ(2, low_task.last_run_order);
+}
+
 }  // namespace invalidation
@@ -21,35 +21,42 @@
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 #include "google/cacheinvalidation/impl/log-macro.h"
 #include "google/cacheinvalidation/impl/proto-helpers.h"
-#include "google/cacheinvalidation/impl/simple-registration-store.h"
+#include "google/cacheinvalidation/impl/flat-registration-store.h"
 
 namespace invalidation {
 
 RegistrationManager::RegistrationManager(
     Logger* logger, Statistics* statistics, DigestFunction* digest_function)
-    : desired_registrations_(new SimpleRegistrationStore(digest_function)),
+    : desired_registrations_(new FlatRegistrationStore(digest_function)),
       statistics_(statistics),
+      is_in_sync_with_server_(false),
+      sync_state_dirty_(true),
+      digest_function_(digest_function),
       logger_(logger) {
   // Initialize the server summary with a 0 size and the digest corresponding to
   // it.  Using defaultInstance would wrong since the server digest will not
   // match unnecessarily and result in an info message being sent.
   GetClientSummary(&last_known_server_summary_);
+  MarkSyncStateDirty();
 }
 
 void RegistrationManager::PerformOperations(
     const vector<ObjectIdP>& object_ids, RegistrationP::OpType reg_op_type,
     vector<ObjectIdP>* oids_to_send) {
-  // Record that we have pending operations on the objects.
-  vector<ObjectIdP>::const_iterator iter = object_ids.begin();
-  for (; iter != object_ids.end(); iter++) {
-    pending_operations_[*iter] = reg_op_type;
-  }
+  // Record that we have pending operations on the objects. The digests are
+  // computed once, for both the pending operations and the desired
+  // registrations.
+  vector<ObjectIdDigest> digests;
+  ObjectIdDigestUtils::GetDigests(object_ids, digest_function_, &digests);
+  desired_registrations_->SetPendingOperations(digests, object_ids,
+                                               reg_op_type);
   // Update the digest appropriately.
   if (reg_op_type == RegistrationP_OpType_REGISTER) {
-    desired_registrations_->Add(object_ids, oids_to_send);
+    desired_registrations_->Add(digests, object_ids, oids_to_send);
   } else {
-    desired_registrations_->Remove(object_ids, oids_to_send);
+    desired_registrations_->Remove(digests, object_ids, oids_to_send);
   }
+  MarkSyncStateDirty();
 }
 
 void RegistrationManager::GetRegistrations(
@@ -76,10 +83,11 @@ void RegistrationManager::HandleRegistrationStatus(
         registration_status.registration().object_id();
 
     // The object is no longer pending, since we have received a server status
-    // for it, so remove it from the pendingOperations map. (It may or may not
-    // have existed in the map, since we can receive spontaneous status messages
-    // from the server.)
-    pending_operations_.erase(object_id_proto);
+    // for it, so clear its pending operation. (It may or may not have had
+    // one, since we can receive spontaneous status messages from the server.)
+    ObjectIdDigest digest;
+    ObjectIdDigestUtils::GetDigest(object_id_proto, digest_function_, &digest);
+    desired_registrations_->ClearPendingOperation(digest);
 
     // We start off with the local-processing set as success, then potentially
     // fail.
@@ -89,7 +97,7 @@ void RegistrationManager::HandleRegistrationStatus(
     // "incompatibility" as defined above.
     if (registration_status.status().code() == StatusP_Code_SUCCESS) {
       bool app_wants_registration =
-          desired_registrations_->Contains(object_id_proto);
+          desired_registrations_->ContainsDigest(digest);
       bool is_op_registration =
           (registration_status.registration().op_type() ==
            RegistrationP_OpType_REGISTER);
@@ -97,7 +105,8 @@ void RegistrationManager::HandleRegistrationStatus(
       if (discrepancy_exists) {
         // Remove the registration and set isSuccess to false, which will cause
         // the caller to issue registration-failure to the application.
-        desired_registrations_->Remove(object_id_proto);
+        desired_registrations_->RemoveDigest(digest);
+        MarkSyncStateDirty();
         statistics_->RecordError(
             Statistics::ClientErrorType_REGISTRATION_DISCREPANCY);
         TLOG(logger_, INFO,
@@ -109,7 +118,8 @@ void RegistrationManager::HandleRegistrationStatus(
       }
     } else {
       // If the server operation failed, then local processing also fails.
-      desired_registrations_->Remove(object_id_proto);
+      desired_registrations_->RemoveDigest(digest);
+      MarkSyncStateDirty();
       TLOG(logger_, FINE, "Removing %s from committed",
            ProtoHelpers::ToString(object_id_proto).c_str());
       is_success = false;
@@ -119,8 +129,22 @@ void RegistrationManager::HandleRegistrationStatus(
 }
 
 void RegistrationManager::GetClientSummary(RegistrationSummary* summary) {
-  summary->set_num_registrations(desired_registrations_->size());
-  summary->set_registration_digest(desired_registrations_->GetDigest());
+  MaybeRefreshSyncState();
+  summary->CopyFrom(client_summary_);
+}
+
+void RegistrationManager::MaybeRefreshSyncState() {
+  if (!sync_state_dirty_) {
+    return;
+  }
+  client_summary_.set_num_registrations(desired_registrations_->size());
+  client_summary_.set_registration_digest(desired_registrations_->GetDigest());
+  is_in_sync_with_server_ =
+      (last_known_server_summary_.num_registrations() ==
+       client_summary_.num_registrations()) &&
+      (last_known_server_summary_.registration_digest() ==
+       client_summary_.registration_digest());
+  sync_state_dirty_ = false;
 }
 
 string RegistrationManager::ToString() {
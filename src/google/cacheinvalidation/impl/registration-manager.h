@@ -19,7 +19,6 @@
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_REGISTRATION_MANAGER_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_REGISTRATION_MANAGER_H_
 
-#include <map>
 #include <set>
 
 #include "google/cacheinvalidation/include/system-resources.h"
@@ -27,12 +26,12 @@
 #include "google/cacheinvalidation/deps/scoped_ptr.h"
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 #include "google/cacheinvalidation/impl/digest-store.h"
+#include "google/cacheinvalidation/impl/object-id-digest-utils.h"
 #include "google/cacheinvalidation/impl/proto-helpers.h"
 #include "google/cacheinvalidation/impl/statistics.h"
 
 namespace invalidation {
 
-using INVALIDATION_STL_NAMESPACE::map;
 using INVALIDATION_STL_NAMESPACE::set;
 
 class RegistrationManager {
@@ -47,13 +46,22 @@ class RegistrationManager {
    */
   void SetDigestStoreForTest(DigestStore<ObjectIdP>* digest_store) {
     desired_registrations_.reset(digest_store);
+    MarkSyncStateDirty();
     GetClientSummary(&last_known_server_summary_);
+    MarkSyncStateDirty();
   }
 
   void GetRegisteredObjectsForTest(vector<ObjectIdP>* registrations) {
     desired_registrations_->GetElements(kEmptyPrefix, 0, registrations);
   }
 
+  /* Returns whether the client currently wants to be registered for
+   * object_id.
+   */
+  bool IsRegistrationDesired(const ObjectIdP& object_id) {
+    return desired_registrations_->Contains(object_id);
+  }
+
   /* (Un)registers for object_ids. When the function returns, oids_to_send will
    * have been modified to contain those object ids for which registration
    * messages must be sent to the server.
@@ -94,14 +102,14 @@ class RegistrationManager {
    * all returned object ids.
    */
   void RemoveRegisteredObjects(vector<ObjectIdP>* result) {
-    // Add the formerly desired- and pending- registrations to result.
-    desired_registrations_->RemoveAll(result);
-    map<ObjectIdP, RegistrationP::OpType, ProtoCompareLess>::iterator
-        pending_iter = pending_operations_.begin();
-    for (; pending_iter != pending_operations_.end(); pending_iter++) {
-      result->push_back(pending_iter->first);
+    // Add the formerly pending- and desired- registrations to result.
+    vector<RegistrationP> pending_operations;
+    desired_registrations_->TakePendingOperations(&pending_operations);
+    for (size_t i = 0; i < pending_operations.size(); ++i) {
+      result->push_back(pending_operations[i].object_id());
     }
-    pending_operations_.clear();
+    desired_registrations_->RemoveAll(result);
+    MarkSyncStateDirty();
 
     // De-dup result.
     set<ObjectIdP, ProtoCompareLess> unique_oids(result->begin(),
@@ -132,19 +140,12 @@ class RegistrationManager {
   void InformServerRegistrationSummary(const RegistrationSummary& reg_summary,
     vector<RegistrationP>* upcalls) {
     last_known_server_summary_.CopyFrom(reg_summary);
+    MarkSyncStateDirty();
     if (IsStateInSyncWithServer()) {
       // If we are now in sync with the server, then the caller should make
       // inform-reg-status upcalls for all operations that we had pending, if
       // any; they are also no longer pending.
-      map<ObjectIdP, RegistrationP::OpType, ProtoCompareLess>::iterator
-          pending_iter = pending_operations_.begin();
-      for (; pending_iter != pending_operations_.end(); pending_iter++) {
-        RegistrationP reg_p;
-        ProtoHelpers::InitRegistrationP(pending_iter->first,
-            pending_iter->second, &reg_p);
-        upcalls->push_back(reg_p);
-      }
-      pending_operations_.clear();
+      desired_registrations_->TakePendingOperations(upcalls);
     }
   }
 
@@ -152,12 +153,8 @@ class RegistrationManager {
    * on the last received server summary (from InformServerRegistrationSummary).
    */
   bool IsStateInSyncWithServer() {
-    RegistrationSummary summary;
-    GetClientSummary(&summary);
-    return (last_known_server_summary_.num_registrations() ==
-            summary.num_registrations()) &&
-        (last_known_server_summary_.registration_digest() ==
-         summary.registration_digest());
+    MaybeRefreshSyncState();
+    return is_in_sync_with_server_;
   }
 
   string ToString();
@@ -166,7 +163,29 @@ class RegistrationManager {
   static const char* kEmptyPrefix;
 
  private:
-  /* The set of regisrations that the application has requested for. */
+  /* Records that the desired registrations or the server summary may have
+   * changed, so the cached client summary and sync state must be recomputed.
+   */
+  void MarkSyncStateDirty() {
+    sync_state_dirty_ = true;
+  }
+
+  /* Recomputes client_summary_ and is_in_sync_with_server_ if they are dirty.
+   */
+  void MaybeRefreshSyncState();
+
+  /* The set of regisrations that the application has requested for.
+   * <p>
+   * The store also keeps the object ids and operation types for which we have
+   * not yet issued any registration-status upcall to the listener. We need
+   * these so that we can synthesize success upcalls if registration sync,
+   * rather than a server message, communicates to us that we have a
+   * successful (un)registration. An object keeps only its latest pending
+   * operation type, rather than a set of RegistrationP, because a set would
+   * assume that we always get a response for every operation we issue, which
+   * isn't necessarily true (i.e., the server might send back an
+   * unregistration status in response to a registration request).
+   */
   scoped_ptr<DigestStore<ObjectIdP> > desired_registrations_;
 
   /* Statistics objects to track number of sent messages, etc. */
@@ -175,20 +194,19 @@ class RegistrationManager {
   /* Latest known server registration state summary. */
   RegistrationSummary last_known_server_summary_;
 
-  /*
-   * Map of object ids and operation types for which we have not yet issued any
-   * registration-status upcall to the listener. We need this so that we can
-   * synthesize success upcalls if registration sync, rather than a server
-   * message, communicates to us that we have a successful (un)registration.
-   * <p>
-   * This is a map from object id to type, rather than a set of RegistrationP,
-   * because a set of RegistrationP would assume that we always get a response
-   * for every operation we issue, which isn't necessarily true (i.e., the
-   * server might send back an unregistration status in response to a
-   * registration request).
+  /* Summary of desired_registrations_, valid if !sync_state_dirty_. */
+  RegistrationSummary client_summary_;
+
+  /* Whether client_summary_ matches last_known_server_summary_, valid if
+   * !sync_state_dirty_.
    */
-  map<ObjectIdP, RegistrationP::OpType, ProtoCompareLess>
-      pending_operations_;
+  bool is_in_sync_with_server_;
+
+  /* Whether client_summary_ and is_in_sync_with_server_ must be recomputed. */
+  bool sync_state_dirty_;
+
+  /* The function used to compute digests of object ids. */
+  DigestFunction* digest_function_;
 
   Logger* logger_;
 };
@@ -0,0 +1,153 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Paces the registrations sent to the server.
+
+#include "google/cacheinvalidation/impl/registration-pacer.h"
+
+#include <algorithm>
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::make_pair;
+using INVALIDATION_STL_NAMESPACE::min;
+
+RegistrationPacer::RegistrationPacer(int objects_per_second,
+                                     int max_per_message)
+    : objects_per_second_(objects_per_second),
+      max_per_message_(max_per_message), next_sequence_number_(0), tokens_(0),
+      has_refilled_(false) {
+  tokens_ = GetBatchSize();
+}
+
+void RegistrationPacer::Add(const ObjectIdP& object_id,
+                            RegistrationP::OpType op_type) {
+  OperationMap::iterator iter = pending_operations_.find(object_id);
+  if (iter == pending_operations_.end()) {
+    iter = pending_operations_.insert(
+        make_pair(object_id, PendingOperation())).first;
+  } else {
+    GetQueue(iter->second.op_type)->erase(iter->second.sequence_number);
+  }
+  iter->second.op_type = op_type;
+  iter->second.sequence_number = next_sequence_number_++;
+  GetQueue(op_type)->insert(make_pair(iter->second.sequence_number, iter));
+}
+
+void RegistrationPacer::AddSubtree(const RegistrationSubtree& subtree) {
+  // An empty subtree is still sent: it tells the server that the client has
+  // no registrations.
+  if (subtree.registered_object_size() == 0) {
+    pending_subtrees_.push_back(subtree);
+    return;
+  }
+  int part_size = GetBatchSize();
+  RegistrationSubtree* part = NULL;
+  for (int i = 0; i < subtree.registered_object_size(); ++i) {
+    const ObjectIdP& object_id = subtree.registered_object(i);
+    if (!pending_subtree_objects_.insert(object_id).second) {
+      continue;  // Already on its way to the server.
+    }
+    if ((part == NULL) ||
+        ((part_size > 0) && (part->registered_object_size() >= part_size))) {
+      pending_subtrees_.push_back(RegistrationSubtree());
+      part = &pending_subtrees_.back();
+    }
+    part->add_registered_object()->CopyFrom(object_id);
+  }
+}
+
+void RegistrationPacer::TakeRegistrations(
+    Time now, vector<RegistrationP>* registrations,
+    vector<RegistrationSubtree>* subtrees) {
+  tokens_ = GetAvailableTokens(now);
+  has_refilled_ = true;
+  last_refill_time_ = now;
+  int limit = GetQueueDepth();
+  if (objects_per_second_ > 0) {
+    limit = min(limit, static_cast<int>(tokens_));
+  }
+  if (max_per_message_ > 0) {
+    limit = min(limit, max_per_message_);
+  }
+  int taken = TakeFromQueue(limit, &pending_unregistrations_, registrations);
+  taken += TakeFromQueue(limit - taken, &pending_registrations_,
+                         registrations);
+
+  // Subtrees are not split further, so each waits until it fits whole.
+  while (!pending_subtrees_.empty() &&
+         (pending_subtrees_.front().registered_object_size() <=
+          limit - taken)) {
+    const RegistrationSubtree& subtree = pending_subtrees_.front();
+    for (int i = 0; i < subtree.registered_object_size(); ++i) {
+      pending_subtree_objects_.erase(subtree.registered_object(i));
+    }
+    taken += subtree.registered_object_size();
+    subtrees->push_back(subtree);
+    pending_subtrees_.pop_front();
+  }
+  tokens_ -= taken;
+}
+
+TimeDelta RegistrationPacer::GetDelayUntilReady(Time now) const {
+  if (IsEmpty() || (objects_per_second_ <= 0)) {
+    return TimeDelta();
+  }
+
+  // Wait for a full message's worth, rather than sending a trickle of small
+  // messages as single tokens become available.
+  double needed = min(GetQueueDepth(), GetBatchSize());
+  double missing = needed - GetAvailableTokens(now);
+  if (missing <= 0) {
+    return TimeDelta();
+  }
+  return TimeDelta::FromMilliseconds(
+      static_cast<int64>((missing * 1000 / objects_per_second_) + 1));
+}
+
+double RegistrationPacer::GetAvailableTokens(Time now) const {
+  if (objects_per_second_ <= 0) {
+    return GetQueueDepth();
+  }
+  double tokens = tokens_;
+  if (has_refilled_) {
+    tokens += (now - last_refill_time_).InMilliseconds() *
+        objects_per_second_ / 1000.0;
+  }
+  return min(tokens, static_cast<double>(GetBatchSize()));
+}
+
+int RegistrationPacer::GetBatchSize() const {
+  // Without a per-message cap, allow one second's worth at a time.
+  return (max_per_message_ > 0) ? max_per_message_ : objects_per_second_;
+}
+
+int RegistrationPacer::TakeFromQueue(int limit, OperationQueue* queue,
+                                     vector<RegistrationP>* registrations) {
+  int taken = 0;
+  while ((taken < limit) && !queue->empty()) {
+    OperationQueue::iterator last = queue->end();
+    --last;
+    OperationMap::iterator operation = last->second;
+    registrations->push_back(RegistrationP());
+    ProtoHelpers::InitRegistrationP(operation->first,
+        operation->second.op_type, &registrations->back());
+    pending_operations_.erase(operation);
+    queue->erase(last);
+    ++taken;
+  }
+  return taken;
+}
+
+}  // namespace invalidation
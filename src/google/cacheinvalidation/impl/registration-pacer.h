@@ -0,0 +1,150 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Paces the registrations sent to the server, so that a bulk registration of
+// many objects is spread over several messages instead of going out in a
+// single burst. Registrations are released at a configured number of objects
+// per second, at most a configured number per message. Unregistrations are
+// released first, then the most recently requested registrations, then the
+// registration sync subtrees, which count against the same limits.
+
+#ifndef GOOGLE_CACHEINVALIDATION_IMPL_REGISTRATION_PACER_H_
+#define GOOGLE_CACHEINVALIDATION_IMPL_REGISTRATION_PACER_H_
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "google/cacheinvalidation/deps/stl-namespace.h"
+#include "google/cacheinvalidation/deps/time.h"
+#include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
+#include "google/cacheinvalidation/impl/proto-helpers.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::deque;
+using INVALIDATION_STL_NAMESPACE::map;
+using INVALIDATION_STL_NAMESPACE::set;
+using INVALIDATION_STL_NAMESPACE::vector;
+
+class RegistrationPacer {
+ public:
+  /* Creates a pacer releasing objects_per_second registrations per second,
+   * and at most max_per_message at a time. Either limit is disabled if <= 0.
+   */
+  RegistrationPacer(int objects_per_second, int max_per_message);
+
+  /* Adds an operation of type op_type on object_id, replacing any pending
+   * operation on the same object.
+   */
+  void Add(const ObjectIdP& object_id, RegistrationP::OpType op_type);
+
+  /* Adds a registration sync subtree, split into parts of at most a
+   * message's worth of objects. Objects already pending in an earlier subtree
+   * are dropped.
+   */
+  void AddSubtree(const RegistrationSubtree& subtree);
+
+  /* Moves the registrations that may be sent at time now to registrations,
+   * unregistrations first and then the most recently requested ones, and the
+   * registration sync subtrees that may be sent with them to subtrees, in the
+   * order they were added.
+   */
+  void TakeRegistrations(Time now, vector<RegistrationP>* registrations,
+                         vector<RegistrationSubtree>* subtrees);
+
+  /* Returns the delay after time now until the next message's worth of
+   * pending registrations may be sent, or zero if they may be sent now.
+   */
+  TimeDelta GetDelayUntilReady(Time now) const;
+
+  /* Returns the number of pending registrations, including the objects of
+   * pending registration sync subtrees.
+   */
+  int GetQueueDepth() const {
+    return static_cast<int>(pending_operations_.size() +
+                            pending_subtree_objects_.size());
+  }
+
+  /* Returns whether no registrations or subtrees are pending. */
+  bool IsEmpty() const {
+    return pending_operations_.empty() && pending_subtrees_.empty();
+  }
+
+ private:
+  /* A pending operation and the order in which it was requested. */
+  struct PendingOperation {
+    RegistrationP::OpType op_type;
+    int64 sequence_number;
+  };
+
+  typedef map<ObjectIdP, PendingOperation, ProtoCompareLess> OperationMap;
+
+  /* Pending operations, ordered by sequence number. */
+  typedef map<int64, OperationMap::iterator> OperationQueue;
+
+  /* Returns the number of registrations that may be released at time now. */
+  double GetAvailableTokens(Time now) const;
+
+  /* Returns the number of registrations that make up a full message. */
+  int GetBatchSize() const;
+
+  /* Returns the queue holding operations of type op_type. */
+  OperationQueue* GetQueue(RegistrationP::OpType op_type) {
+    return (op_type == RegistrationP_OpType_UNREGISTER) ?
+        &pending_unregistrations_ : &pending_registrations_;
+  }
+
+  /* Moves up to limit operations from the most recent end of queue to
+   * registrations, and returns the number moved.
+   */
+  int TakeFromQueue(int limit, OperationQueue* queue,
+                    vector<RegistrationP>* registrations);
+
+  /* Rate at which registrations are released, per second. */
+  int objects_per_second_;
+
+  /* Maximum number of registrations released at a time. */
+  int max_per_message_;
+
+  /* Pending operation for each object. */
+  OperationMap pending_operations_;
+
+  /* Pending unregistrations and registrations, by sequence number. */
+  OperationQueue pending_unregistrations_;
+  OperationQueue pending_registrations_;
+
+  /* Pending registration sync subtrees, in the order they were added. */
+  deque<RegistrationSubtree> pending_subtrees_;
+
+  /* Objects in pending_subtrees_. */
+  set<ObjectIdP, ProtoCompareLess> pending_subtree_objects_;
+
+  /* Sequence number of the next operation added. */
+  int64 next_sequence_number_;
+
+  /* Number of registrations that could be released at last_refill_time_. */
+  double tokens_;
+
+  /* Whether any registrations have been released. */
+  bool has_refilled_;
+
+  /* Time at which tokens_ was last computed. */
+  Time last_refill_time_;
+};
+
+}  // namespace invalidation
+
+#endif  // GOOGLE_CACHEINVALIDATION_IMPL_REGISTRATION_PACER_H_
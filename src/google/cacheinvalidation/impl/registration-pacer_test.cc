@@ -0,0 +1,186 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the registration pacer.
+
+#include <string>
+#include <vector>
+
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/deps/time.h"
+#include "google/cacheinvalidation/impl/registration-pacer.h"
+
+namespace invalidation {
+
+using INVALIDATION_STL_NAMESPACE::string;
+using INVALIDATION_STL_NAMESPACE::vector;
+
+class RegistrationPacerTest : public testing::Test {
+ public:
+  // Returns an object id with the given name.
+  static ObjectIdP MakeObjectId(const string& name) {
+    ObjectIdP object_id;
+    object_id.set_source(4);
+    object_id.set_name(name);
+    return object_id;
+  }
+
+  // Adds registrations of |count| objects named "oid<i>" to |pacer|.
+  static void Register(int count, RegistrationPacer* pacer) {
+    for (int i = 0; i < count; ++i) {
+      pacer->Add(MakeObjectId("oid" + SimpleItoa(i)),
+                 RegistrationP_OpType_REGISTER);
+    }
+  }
+
+  Time now_;
+};
+
+// Tests that without limits, all pending registrations are released at once.
+TEST_F(RegistrationPacerTest, Unlimited) {
+  RegistrationPacer pacer(0, 0);
+  Register(100, &pacer);
+  ASSERT_EQ(100, pacer.GetQueueDepth());
+  ASSERT_EQ(0, pacer.GetDelayUntilReady(now_).InMilliseconds());
+  vector<RegistrationP> registrations;
+  vector<RegistrationSubtree> subtrees;
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(100, registrations.size());
+  ASSERT_TRUE(pacer.IsEmpty());
+}
+
+// Tests that registrations are released at most a message's worth at a time,
+// at the configured rate.
+TEST_F(RegistrationPacerTest, PacesBulkRegistration) {
+  RegistrationPacer pacer(100, 50);
+  Register(120, &pacer);
+  vector<RegistrationP> registrations;
+  vector<RegistrationSubtree> subtrees;
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(50, registrations.size());
+  ASSERT_EQ(70, pacer.GetQueueDepth());
+
+  // A full message's worth becomes available after half a second.
+  TimeDelta delay = pacer.GetDelayUntilReady(now_);
+  ASSERT_LE(500, delay.InMilliseconds());
+  ASSERT_GE(501, delay.InMilliseconds());
+  now_ += TimeDelta::FromMilliseconds(100);
+  registrations.clear();
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(10, registrations.size());
+
+  now_ += TimeDelta::FromMilliseconds(400);
+  registrations.clear();
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(40, registrations.size());
+  ASSERT_EQ(20, pacer.GetQueueDepth());
+}
+
+// Tests that unregistrations are released first, then the most recently
+// requested registrations, and that a later operation on an object replaces
+// the pending one.
+TEST_F(RegistrationPacerTest, Priorities) {
+  RegistrationPacer pacer(0, 2);
+  pacer.Add(MakeObjectId("old"), RegistrationP_OpType_REGISTER);
+  pacer.Add(MakeObjectId("gone"), RegistrationP_OpType_REGISTER);
+  pacer.Add(MakeObjectId("new"), RegistrationP_OpType_REGISTER);
+  pacer.Add(MakeObjectId("gone"), RegistrationP_OpType_UNREGISTER);
+  ASSERT_EQ(3, pacer.GetQueueDepth());
+
+  vector<RegistrationP> registrations;
+  vector<RegistrationSubtree> subtrees;
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(2, registrations.size());
+  ASSERT_EQ("gone", registrations[0].object_id().name());
+  ASSERT_EQ(RegistrationP_OpType_UNREGISTER, registrations[0].op_type());
+  ASSERT_EQ("new", registrations[1].object_id().name());
+  ASSERT_EQ(RegistrationP_OpType_REGISTER, registrations[1].op_type());
+
+  registrations.clear();
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(1, registrations.size());
+  ASSERT_EQ("old", registrations[0].object_id().name());
+  ASSERT_TRUE(pacer.IsEmpty());
+}
+
+// Tests that registration sync subtrees are split into a message's worth of
+// objects and released after the registrations, within the same limits.
+TEST_F(RegistrationPacerTest, PacesSubtrees) {
+  RegistrationPacer pacer(100, 50);
+  Register(10, &pacer);
+  RegistrationSubtree subtree;
+  for (int i = 0; i < 120; ++i) {
+    subtree.add_registered_object()->CopyFrom(
+        MakeObjectId("sync" + SimpleItoa(i)));
+  }
+  pacer.AddSubtree(subtree);
+  ASSERT_EQ(130, pacer.GetQueueDepth());
+
+  // The first 50 subtree objects do not fit along with the registrations.
+  vector<RegistrationP> registrations;
+  vector<RegistrationSubtree> subtrees;
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(10, registrations.size());
+  ASSERT_EQ(0, subtrees.size());
+  ASSERT_EQ(120, pacer.GetQueueDepth());
+
+  now_ += pacer.GetDelayUntilReady(now_);
+  registrations.clear();
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(0, registrations.size());
+  ASSERT_EQ(1, subtrees.size());
+  ASSERT_EQ(50, subtrees[0].registered_object_size());
+  ASSERT_EQ("sync0", subtrees[0].registered_object(0).name());
+
+  // The last part holds the remaining 20 objects.
+  now_ += pacer.GetDelayUntilReady(now_);
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  now_ += pacer.GetDelayUntilReady(now_);
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(3, subtrees.size());
+  ASSERT_EQ(20, subtrees[2].registered_object_size());
+  ASSERT_EQ("sync119", subtrees[2].registered_object(19).name());
+  ASSERT_TRUE(pacer.IsEmpty());
+}
+
+// Tests that objects already pending in a subtree are not queued again.
+TEST_F(RegistrationPacerTest, DropsDuplicateSubtreeObjects) {
+  RegistrationPacer pacer(100, 50);
+  RegistrationSubtree subtree;
+  for (int i = 0; i < 60; ++i) {
+    subtree.add_registered_object()->CopyFrom(
+        MakeObjectId("sync" + SimpleItoa(i)));
+  }
+  pacer.AddSubtree(subtree);
+  pacer.AddSubtree(subtree);
+  ASSERT_EQ(60, pacer.GetQueueDepth());
+
+  vector<RegistrationP> registrations;
+  vector<RegistrationSubtree> subtrees;
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(1, subtrees.size());
+  ASSERT_EQ(10, pacer.GetQueueDepth());
+
+  // Once sent, the objects may be queued again.
+  pacer.AddSubtree(subtree);
+  ASSERT_EQ(60, pacer.GetQueueDepth());
+  now_ += pacer.GetDelayUntilReady(now_);
+  pacer.TakeRegistrations(now_, &registrations, &subtrees);
+  ASSERT_EQ(2, subtrees.size());
+  ASSERT_EQ(10, subtrees[1].registered_object_size());
+  ASSERT_EQ("sync50", subtrees[1].registered_object(0).name());
+}
+
+}  // namespace invalidation
@@ -31,8 +31,8 @@ void SafeStorage::WriteKey(const string& key, const string& value,
 }
 
 void SafeStorage::WriteCallback(WriteKeyCallback* done, Status status) {
-  scheduler_->Schedule(
-      Scheduler::NoDelay(),
+  scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), callback_priority_,
       /* Owns 'done'. */ NewPermanentCallback(done, status));
 }
 
@@ -43,8 +43,8 @@ void SafeStorage::ReadKey(const string& key, ReadKeyCallback* done) {
 
 void SafeStorage::ReadCallback(ReadKeyCallback* done,
     StatusStringPair read_result) {
-  scheduler_->Schedule(
-      Scheduler::NoDelay(),
+  scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), callback_priority_,
       /* Owns 'done'. */ NewPermanentCallback(done, read_result));
 }
 
@@ -54,8 +54,8 @@ void SafeStorage::DeleteKey(const string& key, DeleteKeyCallback* done) {
 }
 
 void SafeStorage::DeleteCallback(DeleteKeyCallback* done, bool result) {
-  scheduler_->Schedule(
-      Scheduler::NoDelay(),
+  scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), callback_priority_,
       /* Owns 'done'. */ NewPermanentCallback(done, result));
 }
 
@@ -66,8 +66,8 @@ void SafeStorage::ReadAllKeys(ReadAllKeysCallback* key_callback) {
 
 void SafeStorage::ReadAllCallback(ReadAllKeysCallback* key_callback,
     StatusStringPair result) {
-  scheduler_->Schedule(
-      Scheduler::NoDelay(),
+  scheduler_->ScheduleWithPriority(
+      Scheduler::NoDelay(), callback_priority_,
       /* Owns 'key_callback'. */ NewPermanentCallback(key_callback, result));
 }
 
@@ -28,8 +28,11 @@ namespace invalidation {
 // given scheduler thread.
 class SafeStorage : public Storage {
  public:
-  /* Creates a new instance. Storage for |delegate| is owned by caller. */
-  explicit SafeStorage(Storage* delegate) : delegate_(delegate) {
+  /* Creates a new instance whose callbacks are scheduled in the
+   * |callback_priority| class. Storage for |delegate| is owned by caller.
+   */
+  SafeStorage(Storage* delegate, Scheduler::Priority callback_priority)
+      : delegate_(delegate), callback_priority_(callback_priority) {
   }
 
   virtual ~SafeStorage() {}
@@ -65,6 +68,9 @@ class SafeStorage : public Storage {
 
   /* The scheduler on which the callbacks are scheduled. */
   Scheduler* scheduler_;
+
+  /* The priority class in which the callbacks are scheduled. */
+  Scheduler::Priority callback_priority_;
 };
 
 }  // namespace invalidation
@@ -16,12 +16,13 @@
 
 #include "google/cacheinvalidation/impl/simple-registration-store.h"
 
-#include "google/cacheinvalidation/impl/object-id-digest-utils.h"
+#include "google/cacheinvalidation/impl/proto-helpers.h"
 
 namespace invalidation {
 
 bool SimpleRegistrationStore::Add(const ObjectIdP& oid) {
-  const string digest = ObjectIdDigestUtils::GetDigest(oid, digest_function_);
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(oid, digest_function_, &digest);
   bool will_add = (registrations_.find(digest) == registrations_.end());
   if (will_add) {
     registrations_[digest] = oid;
@@ -32,26 +33,40 @@ bool SimpleRegistrationStore::Add(const ObjectIdP& oid) {
 
 void SimpleRegistrationStore::Add(const vector<ObjectIdP>& oids,
                                   vector<ObjectIdP>* oids_to_send) {
+  vector<ObjectIdDigest> digests;
+  ObjectIdDigestUtils::GetDigests(oids, digest_function_, &digests);
+  Add(digests, oids, oids_to_send);
+}
+
+void SimpleRegistrationStore::Add(const vector<ObjectIdDigest>& oid_digests,
+                                  const vector<ObjectIdP>& oids,
+                                  vector<ObjectIdP>* oids_to_send) {
+  bool changed = false;
   for (size_t i = 0; i < oids.size(); ++i) {
     const ObjectIdP& oid = oids[i];
-    const string digest = ObjectIdDigestUtils::GetDigest(oid, digest_function_);
+    const ObjectIdDigest& digest = oid_digests[i];
     bool will_add = (registrations_.find(digest) == registrations_.end());
     if (will_add) {
       registrations_[digest] = oid;
       oids_to_send->push_back(oid);
+      changed = true;
     }
   }
-  if (!oids_to_send->empty()) {
+  if (changed) {
     // Only recompute the digest if we made changes.
     RecomputeDigest();
   }
 }
 
 bool SimpleRegistrationStore::Remove(const ObjectIdP& oid) {
-  const string digest = ObjectIdDigestUtils::GetDigest(oid, digest_function_);
-  bool will_remove = (registrations_.find(digest) != registrations_.end());
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(oid, digest_function_, &digest);
+  return RemoveDigest(digest);
+}
+
+bool SimpleRegistrationStore::RemoveDigest(const ObjectIdDigest& oid_digest) {
+  bool will_remove = (registrations_.erase(oid_digest) > 0);
   if (will_remove) {
-    registrations_.erase(digest);
     RecomputeDigest();
   }
   return will_remove;
@@ -59,41 +74,78 @@ bool SimpleRegistrationStore::Remove(const ObjectIdP& oid) {
 
 void SimpleRegistrationStore::Remove(const vector<ObjectIdP>& oids,
                                      vector<ObjectIdP>* oids_to_send) {
+  vector<ObjectIdDigest> digests;
+  ObjectIdDigestUtils::GetDigests(oids, digest_function_, &digests);
+  Remove(digests, oids, oids_to_send);
+}
+
+void SimpleRegistrationStore::Remove(
+    const vector<ObjectIdDigest>& oid_digests, const vector<ObjectIdP>& oids,
+    vector<ObjectIdP>* oids_to_send) {
+  bool changed = false;
   for (size_t i = 0; i < oids.size(); ++i) {
-    const ObjectIdP& oid = oids[i];
-    const string digest = ObjectIdDigestUtils::GetDigest(oid, digest_function_);
-    bool will_remove = (registrations_.find(digest) != registrations_.end());
-    if (will_remove) {
-      registrations_.erase(digest);
-      oids_to_send->push_back(oid);
+    if (registrations_.erase(oid_digests[i]) > 0) {
+      oids_to_send->push_back(oids[i]);
+      changed = true;
     }
   }
-  if (!oids_to_send->empty()) {
+  if (changed) {
     // Only recompute the digest if we made changes.
     RecomputeDigest();
   }
 }
 
 void SimpleRegistrationStore::RemoveAll(vector<ObjectIdP>* oids) {
-  for (map<string, ObjectIdP>::const_iterator iter = registrations_.begin();
+  for (map<ObjectIdDigest, ObjectIdP>::const_iterator iter =
+           registrations_.begin();
        iter != registrations_.end(); ++iter) {
     oids->push_back(iter->second);
   }
   registrations_.clear();
+  pending_operations_.clear();
   RecomputeDigest();
 }
 
+void SimpleRegistrationStore::SetPendingOperations(
+    const vector<ObjectIdDigest>& oid_digests, const vector<ObjectIdP>& oids,
+    RegistrationP::OpType op_type) {
+  for (size_t i = 0; i < oids.size(); ++i) {
+    ProtoHelpers::InitRegistrationP(oids[i], op_type,
+                                    &pending_operations_[oid_digests[i]]);
+  }
+}
+
+void SimpleRegistrationStore::ClearPendingOperation(
+    const ObjectIdDigest& oid_digest) {
+  pending_operations_.erase(oid_digest);
+}
+
+void SimpleRegistrationStore::TakePendingOperations(
+    vector<RegistrationP>* operations) {
+  for (map<ObjectIdDigest, RegistrationP>::const_iterator iter =
+           pending_operations_.begin();
+       iter != pending_operations_.end(); ++iter) {
+    operations->push_back(iter->second);
+  }
+  pending_operations_.clear();
+}
+
 bool SimpleRegistrationStore::Contains(const ObjectIdP& oid) {
-  return registrations_.find(
-      ObjectIdDigestUtils::GetDigest(oid, digest_function_)) !=
-      registrations_.end();
+  ObjectIdDigest digest;
+  ObjectIdDigestUtils::GetDigest(oid, digest_function_, &digest);
+  return ContainsDigest(digest);
+}
+
+bool SimpleRegistrationStore::ContainsDigest(
+    const ObjectIdDigest& oid_digest) {
+  return registrations_.find(oid_digest) != registrations_.end();
 }
 
 void SimpleRegistrationStore::GetElements(
     const string& oid_digest_prefix, int prefix_len,
     vector<ObjectIdP>* result) {
   // We always return all the registrations and let the Ticl sort it out.
-  for (map<string, ObjectIdP>::iterator iter = registrations_.begin();
+  for (map<ObjectIdDigest, ObjectIdP>::iterator iter = registrations_.begin();
        iter != registrations_.end(); ++iter) {
     result->push_back(iter->second);
   }
@@ -23,6 +23,7 @@
 #include "google/cacheinvalidation/deps/string_util.h"
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 #include "google/cacheinvalidation/impl/digest-store.h"
+#include "google/cacheinvalidation/impl/object-id-digest-utils.h"
 
 namespace invalidation {
 
@@ -42,15 +43,35 @@ class SimpleRegistrationStore : public DigestStore<ObjectIdP> {
   virtual void Add(const vector<ObjectIdP>& oids,
                    vector<ObjectIdP>* oids_to_send);
 
+  virtual void Add(const vector<ObjectIdDigest>& oid_digests,
+                   const vector<ObjectIdP>& oids,
+                   vector<ObjectIdP>* oids_to_send);
+
   virtual bool Remove(const ObjectIdP& oid);
 
+  virtual bool RemoveDigest(const ObjectIdDigest& oid_digest);
+
   virtual void Remove(const vector<ObjectIdP>& oids,
                       vector<ObjectIdP>* oids_to_send);
 
+  virtual void Remove(const vector<ObjectIdDigest>& oid_digests,
+                      const vector<ObjectIdP>& oids,
+                      vector<ObjectIdP>* oids_to_send);
+
   virtual void RemoveAll(vector<ObjectIdP>* oids);
 
+  virtual void SetPendingOperations(const vector<ObjectIdDigest>& oid_digests,
+                                    const vector<ObjectIdP>& oids,
+                                    RegistrationP::OpType op_type);
+
+  virtual void ClearPendingOperation(const ObjectIdDigest& oid_digest);
+
+  virtual void TakePendingOperations(vector<RegistrationP>* operations);
+
   virtual bool Contains(const ObjectIdP& oid);
 
+  virtual bool ContainsDigest(const ObjectIdDigest& oid_digest);
+
   virtual int size() {
     return registrations_.size();
   }
@@ -73,7 +94,10 @@ class SimpleRegistrationStore : public DigestStore<ObjectIdP> {
 
   /* All the registrations in the store mappd from the digest to the ibject id.
    */
-  map<string, ObjectIdP> registrations_;
+  map<ObjectIdDigest, ObjectIdP> registrations_;
+
+  /* The pending operations, mapped from the digest of their object id. */
+  map<ObjectIdDigest, RegistrationP> pending_operations_;
 
   /* The function used to compute digests of objects. */
   DigestFunction* digest_function_;
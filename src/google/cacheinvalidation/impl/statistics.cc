@@ -51,6 +51,10 @@ const char* Statistics::ListenerEventType_names[] = {
   "INFORM_REGISTRATION_STATUS",
   "INVALIDATE",
   "INVALIDATE_ALL",
+  "INVALIDATE_COALESCED",
+  "INVALIDATE_COLLAPSED",
+  "INVALIDATE_DOWNGRADED",
+  "INVALIDATE_SUPPRESSED",
   "INVALIDATE_UNKNOWN",
   "REISSUE_REGISTRATIONS",
 };
@@ -70,12 +74,23 @@ const char* Statistics::ClientErrorType_names[] = {
   "TOKEN_TRANSIENT_FAILURE",
 };
 
+const char* Statistics::GaugeType_names[] = {
+  "LISTENER_QUEUE_DEPTH",
+  "LISTENER_QUEUE_MAX_DEPTH",
+  "LISTENER_DEFERRED_ACKS",
+  "BATCHING_DELAY_MS",
+  "BATCHING_ENQUEUE_RATE",
+  "BATCHING_THROTTLE_HEADROOM",
+  "REGISTRATION_PACER_QUEUE_DEPTH",
+};
+
 Statistics::Statistics() {
   InitializeMap(sent_message_types_, SentMessageType_MAX + 1);
   InitializeMap(received_message_types_, ReceivedMessageType_MAX + 1);
   InitializeMap(incoming_operation_types_, IncomingOperationType_MAX + 1);
   InitializeMap(listener_event_types_, ListenerEventType_MAX + 1);
   InitializeMap(client_error_types_, ClientErrorType_MAX + 1);
+  InitializeMap(gauge_types_, GaugeType_MAX + 1);
 }
 
 void Statistics::GetNonZeroStatistics(
@@ -98,6 +113,9 @@ void Statistics::GetNonZeroStatistics(
   FillWithNonZeroStatistics(
       client_error_types_, ClientErrorType_MAX + 1, ClientErrorType_names,
       "ClientErrorType.", performance_counters);
+  FillWithNonZeroStatistics(
+      gauge_types_, GaugeType_MAX + 1, GaugeType_names, "GaugeType.",
+      performance_counters);
 }
 
 /* Modifies result to contain those statistics from map whose value is > 0. */
@@ -94,6 +94,10 @@ class Statistics {
     ListenerEventType_INFORM_REGISTRATION_STATUS,
     ListenerEventType_INVALIDATE,
     ListenerEventType_INVALIDATE_ALL,
+    ListenerEventType_INVALIDATE_COALESCED,
+    ListenerEventType_INVALIDATE_COLLAPSED,
+    ListenerEventType_INVALIDATE_DOWNGRADED,
+    ListenerEventType_INVALIDATE_SUPPRESSED,
     ListenerEventType_INVALIDATE_UNKNOWN,
     ListenerEventType_REISSUE_REGISTRATIONS,
   };
@@ -153,6 +157,34 @@ class Statistics {
       ClientErrorType_TOKEN_TRANSIENT_FAILURE;
   static const char* ClientErrorType_names[];
 
+  /* Sampled values (as opposed to event counts) maintained by the Ticl. */
+  enum GaugeType {
+    /* Number of listener upcalls scheduled but not yet run. */
+    GaugeType_LISTENER_QUEUE_DEPTH,
+
+    /* Largest value of GaugeType_LISTENER_QUEUE_DEPTH observed so far. */
+    GaugeType_LISTENER_QUEUE_MAX_DEPTH,
+
+    /* Number of acks held back while the listener backlog is collapsed. */
+    GaugeType_LISTENER_DEFERRED_ACKS,
+
+    /* Batching delay last chosen by the adaptive batching controller. */
+    GaugeType_BATCHING_DELAY_MS,
+
+    /* Estimated rate at which data is batched, per minute. */
+    GaugeType_BATCHING_ENQUEUE_RATE,
+
+    /* Percentage of the rate limits available when the delay was chosen. */
+    GaugeType_BATCHING_THROTTLE_HEADROOM,
+
+    /* Number of registrations held back by the registration pacer. */
+    GaugeType_REGISTRATION_PACER_QUEUE_DEPTH,
+  };
+  static const GaugeType GaugeType_MIN = GaugeType_LISTENER_QUEUE_DEPTH;
+  static const GaugeType GaugeType_MAX =
+      GaugeType_REGISTRATION_PACER_QUEUE_DEPTH;
+  static const char* GaugeType_names[];
+
   // Arrays for each type of Statistic to keep track of how many times each
   // event has occurred.
 
@@ -174,6 +206,16 @@ class Statistics {
     return received_message_types_[received_message_type];
   }
 
+  /* Returns the counter value for listener_event_type. */
+  int GetListenerEventCountForTest(ListenerEventType listener_event_type) {
+    return listener_event_types_[listener_event_type];
+  }
+
+  /* Returns the current value for gauge_type. */
+  int GetGaugeForTest(GaugeType gauge_type) {
+    return gauge_types_[gauge_type];
+  }
+
   /* Records the fact that a message of type sent_message_type has been sent. */
   void RecordSentMessage(SentMessageType sent_message_type) {
     ++sent_message_types_[sent_message_type];
@@ -207,6 +249,11 @@ class Statistics {
     ++client_error_types_[client_error_type];
   }
 
+  /* Sets the current value of gauge_type to value. */
+  void SetGauge(GaugeType gauge_type, int value) {
+    gauge_types_[gauge_type] = value;
+  }
+
   /* Modifies performance_counters to contain all the statistics that are
    * non-zero. Each pair has the name of the statistic event and the number of
    * times that event has occurred since the client started.
@@ -227,6 +274,7 @@ class Statistics {
   int incoming_operation_types_[IncomingOperationType_MAX + 1];
   int listener_event_types_[ListenerEventType_MAX + 1];
   int client_error_types_[ClientErrorType_MAX + 1];
+  int gauge_types_[GaugeType_MAX + 1];
 };
 
 }  // namespace invalidation
@@ -24,6 +24,7 @@
 namespace invalidation {
 
 using INVALIDATION_STL_NAMESPACE::max;
+using INVALIDATION_STL_NAMESPACE::min;
 
 Throttle::Throttle(
     const RepeatedPtrField<RateLimitP>& rate_limits, Scheduler* scheduler,
@@ -92,7 +93,7 @@ void Throttle::Fire() {
         timer_scheduled_ = true;
         scheduler_->Schedule(
             window_end_from_now,
-            NewPermanentCallback(this, &Throttle::RetryFire));
+            NewPooledCallback(this, &Throttle::RetryFire));
         return;
       }
     }
@@ -102,6 +103,10 @@ void Throttle::Fire() {
   listener_->Run();
 
   // Record the fact that we're triggering an event now.
+  RecordEvent();
+}
+
+void Throttle::RecordEvent() {
   recent_event_times_.push_back(scheduler_->GetCurrentTime());
 
   // Only save up to max_recent_events_ event times.
@@ -110,4 +115,29 @@ void Throttle::Fire() {
   }
 }
 
+double Throttle::GetHeadroom() const {
+  Time now = scheduler_->GetCurrentTime();
+  double headroom = 1.0;
+  for (size_t i = 0; i < static_cast<size_t>(rate_limits_.size()); ++i) {
+    const RateLimitP& rate_limit = rate_limits_.Get(i);
+    int count = rate_limit.count();
+    Time window_start =
+        now - TimeDelta::FromMilliseconds(rate_limit.window_ms());
+
+    // Count the calls in the current window, most recent first.
+    int num_calls = 0;
+    for (deque<Time>::const_reverse_iterator iter =
+             recent_event_times_.rbegin();
+         (iter != recent_event_times_.rend()) && (num_calls < count);
+         ++iter) {
+      if (*iter <= window_start) {
+        break;
+      }
+      ++num_calls;
+    }
+    headroom = min(headroom, static_cast<double>(count - num_calls) / count);
+  }
+  return headroom;
+}
+
 }  // namespace invalidation
@@ -55,6 +55,15 @@ class Throttle {
   // queued.
   void Fire();
 
+  // Records a call to the throttled function made directly rather than through
+  // Fire(), so that it counts against the rate limits.
+  void RecordEvent();
+
+  // Returns the fraction of the tightest rate limit that is still available at
+  // the current time, between 0 (calling the listener now would violate a
+  // limit) and 1 (no calls in any of the windows).
+  double GetHeadroom() const;
+
  private:
   // Retries a call to Fire() after some delay.
   void RetryFire() {
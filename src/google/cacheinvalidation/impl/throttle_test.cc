@@ -188,4 +188,46 @@ TEST_F(ThrottleTest, ThrottlingStorm) {
   ASSERT_EQ((kMessagesPerMinute * duration_minutes) + 1, call_count_);
 }
 
+/* Tests that the headroom reflects the tightest rate limit. */
+TEST_F(ThrottleTest, Headroom) {
+  scheduler_->StartScheduler();
+  Closure* listener =
+      NewPermanentCallback(this, &ThrottleTest::IncrementCounter);
+  scoped_ptr<Throttle> throttle(
+      new Throttle(rate_limits_, scheduler_.get(), listener));
+  ASSERT_EQ(1.0, throttle->GetHeadroom());
+
+  // The per-second limit is used up right after a call.
+  throttle->Fire();
+  ASSERT_EQ(1, call_count_);
+  ASSERT_EQ(0.0, throttle->GetHeadroom());
+
+  // A second later, only the per-minute limit is partly used.
+  scheduler_->PassTime(TimeDelta::FromSeconds(1));
+  ASSERT_DOUBLE_EQ(
+      static_cast<double>(kMessagesPerMinute - 1) / kMessagesPerMinute,
+      throttle->GetHeadroom());
+
+  // A minute later, all the limits are available again.
+  scheduler_->PassTime(TimeDelta::FromMinutes(1));
+  ASSERT_EQ(1.0, throttle->GetHeadroom());
+}
+
+/* Tests that calls recorded directly count against the rate limits. */
+TEST_F(ThrottleTest, RecordEvent) {
+  scheduler_->StartScheduler();
+  Closure* listener =
+      NewPermanentCallback(this, &ThrottleTest::IncrementCounter);
+  scoped_ptr<Throttle> throttle(
+      new Throttle(rate_limits_, scheduler_.get(), listener));
+  throttle->RecordEvent();
+  ASSERT_EQ(0.0, throttle->GetHeadroom());
+
+  // The per-second limit is used up, so a call through Fire() is deferred.
+  throttle->Fire();
+  ASSERT_EQ(0, call_count_);
+  scheduler_->PassTime(TimeDelta::FromSeconds(1));
+  ASSERT_EQ(1, call_count_);
+}
+
 }  // namespace invalidation
@@ -16,8 +16,8 @@
 
 #include "google/cacheinvalidation/impl/ticl-message-validator.h"
 
+#include "google/cacheinvalidation/deps/string_util.h"
 #include "google/cacheinvalidation/impl/log-macro.h"
-#include "google/cacheinvalidation/impl/proto-helpers.h"
 #include "google/cacheinvalidation/include/system-resources.h"
 
 namespace invalidation {
@@ -64,6 +64,13 @@ namespace invalidation {
 // Note that REQUIRE, ALLOW, ZERO_OR_MORE, and ONE_OR_MORE all perform recursive
 // validation of the mentioned fields.  A validation method must therefore be
 // defined for the type of the field, or there will be a link-time error.
+//
+// A failing constraint stores a short reason in |*error|, such as "version:
+// must be non-negative".  As the failure propagates out through the enclosing
+// fields, each level prefixes the name of its field (and the index, for
+// repeated fields), giving a path like "invalidation[3].version: must be
+// non-negative".  Nothing is logged until IsValid returns, and the message
+// itself is never stringified, so rejecting a large message stays cheap.
 
 
 // Macros:
@@ -71,18 +78,18 @@ namespace invalidation {
 // Macro to define a specialization of the |Validate| method for the given
 // |type|.  This must be followed by a method body in curly braces defining
 // constraints on |message|, which is bound to a value of the given type.  If
-// |message| is valid, no action is necessary; if invalid, a diagnostic message
-// should be logged via |logger_|, and |*result| should be set to false.
+// |message| is valid, no action is necessary; if invalid, |*error| should be
+// set to the reason, and |*result| should be set to false.
 #define DEFINE_VALIDATOR(type)                                          \
   template<>                                                            \
-  void TiclMessageValidator::Validate(const type& message, bool* result)
+  void TiclMessageValidator::Validate(const type& message, bool* result, \
+                                      string* error)
 
 // Expands into a conditional that checks whether |field| is present in
 // |message| and valid.
 #define REQUIRE(field)                                                  \
   if (!message.has_##field()) {                                         \
-    TLOG(logger_, SEVERE, "required field " #field " missing from %s",  \
-         ProtoHelpers::ToString(message).c_str());                      \
+    *error = #field ": required field missing";                         \
     *result = false;                                                    \
     return;                                                             \
   }                                                                     \
@@ -92,10 +99,9 @@ namespace invalidation {
 // |message|.  If so, validates |message.field()|; otherwise, does nothing.
 #define ALLOW(field)                                                    \
   if (message.has_##field()) {                                          \
-    Validate(message.field(), result);                                  \
+    Validate(message.field(), result, error);                           \
     if (!*result) {                                                     \
-      TLOG(logger_, SEVERE, "field " #field " failed validation in %s", \
-           ProtoHelpers::ToString(message).c_str());                    \
+      error->insert(0, #field ".");                                     \
       return;                                                           \
     }                                                                   \
   }
@@ -104,22 +110,25 @@ namespace invalidation {
 // |message|, then it is greater than or equal to |value|.
 #define GREATER_OR_EQUAL(field, value)                                  \
   if (message.has_##field() && (message.field() < value)) {             \
-    TLOG(logger_, SEVERE,                                               \
-         #field " must be greater than or equal to %d; was %d",         \
-         value, message.field());                                       \
+    *error = #field ": must be greater than or equal to " #value;       \
     *result = false;                                                    \
     return;                                                             \
   }
 
 // Expands into a conditional that checks that, if the specified numeric |field|
 // is present, that it is non-negative.
-#define NON_NEGATIVE(field) GREATER_OR_EQUAL(field, 0)
+#define NON_NEGATIVE(field)                                             \
+  if (message.has_##field() && (message.field() < 0)) {                 \
+    *error = #field ": must be non-negative";                           \
+    *result = false;                                                    \
+    return;                                                             \
+  }
 
 // Expands into a conditional that checks that, if the specified string |field|
 // is present, that it is non-empty.
 #define NON_EMPTY(field)                                                \
   if (message.has_##field() && message.field().empty()) {               \
-    TLOG(logger_, SEVERE, #field " must be non-empty");                 \
+    *error = #field ": must be non-empty";                              \
     *result = false;                                                    \
     return;                                                             \
   }
@@ -128,11 +137,9 @@ namespace invalidation {
 // valid.
 #define ZERO_OR_MORE(field)                                             \
   for (int i = 0; i < message.field##_size(); ++i) {                    \
-    Validate(message.field(i), result);                                 \
+    Validate(message.field(i), result, error);                          \
     if (!*result) {                                                     \
-      TLOG(logger_, SEVERE, "field " #field " #%d failed validation in %s", \
-           i, ProtoHelpers::ToString(message).c_str());                 \
-      *result = false;                                                  \
+      error->insert(0, StringPrintf(#field "[%d].", i));                \
       return;                                                           \
     }                                                                   \
   }
@@ -141,8 +148,7 @@ namespace invalidation {
 // repeated |field|, and that all are valid.
 #define ONE_OR_MORE(field)                                              \
   if (message.field##_size() == 0) {                                    \
-    TLOG(logger_, SEVERE, "at least one " #field " required in %s",     \
-         ProtoHelpers::ToString(message).c_str());                      \
+    *error = #field ": at least one required";                          \
     *result = false;                                                    \
     return;                                                             \
   }                                                                     \
@@ -152,8 +158,7 @@ namespace invalidation {
 #define CONDITION(expr)                                 \
   *result = expr;                                       \
   if (!*result) {                                       \
-    TLOG(logger_, SEVERE, #expr " not satisfied by %s", \
-       ProtoHelpers::ToString(message).c_str());        \
+    *error = #expr " not satisfied";                    \
     return;                                             \
   }
 
@@ -265,6 +270,16 @@ DEFINE_VALIDATOR(RateLimitP) {
 DEFINE_VALIDATOR(ProtocolHandlerConfigP) {
   ALLOW(batching_delay_ms);
   ZERO_OR_MORE(rate_limit);
+  ALLOW(validate_outbound_messages);
+  ALLOW(ack_batching_delay_ms);
+  ALLOW(ack_flush_threshold);
+  ALLOW(adaptive_batching);
+  ALLOW(min_batching_delay_ms);
+  ALLOW(max_batching_delay_ms);
+  ALLOW(registration_objects_per_second);
+  ALLOW(max_registrations_per_message);
+  CONDITION(message.min_batching_delay_ms() <=
+            message.max_batching_delay_ms());
 }
 
 DEFINE_VALIDATOR(ClientConfigP) {
@@ -281,6 +296,15 @@ DEFINE_VALIDATOR(ClientConfigP) {
   REQUIRE(protocol_handler_config);
   ALLOW(offline_heartbeat_threshold_ms);
   ALLOW(allow_suppression);
+  ALLOW(listener_backlog_high_watermark);
+  ALLOW(object_version_cache_size);
+  ALLOW(persist_object_version_cache);
+  ALLOW(registration_debounce_delay_ms);
+  ALLOW(max_registration_sync_chunk_size);
+  ALLOW(traffic_aware_heartbeats);
+  ALLOW(adaptive_heartbeats);
+  ALLOW(max_idle_heartbeat_interval_ms);
+  ALLOW(out_of_sync_heartbeat_interval_ms);
 }
 
 DEFINE_VALIDATOR(InfoMessage) {
@@ -366,4 +390,8 @@ DEFINE_VALIDATOR(ServerToClientMessage) {
   ALLOW(error_message);
 }
 
+void TiclMessageValidator::LogInvalidMessage(const string& error) {
+  TLOG(logger_, SEVERE, "Message failed validation: %s", error.c_str());
+}
+
 }  // namespace invalidation
@@ -17,10 +17,15 @@
 #ifndef GOOGLE_CACHEINVALIDATION_IMPL_TICL_MESSAGE_VALIDATOR_H_
 #define GOOGLE_CACHEINVALIDATION_IMPL_TICL_MESSAGE_VALIDATOR_H_
 
+#include <string>
+
+#include "google/cacheinvalidation/deps/stl-namespace.h"
 #include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
 
 namespace invalidation {
 
+using INVALIDATION_STL_NAMESPACE::string;
+
 class Logger;
 
 class TiclMessageValidator {
@@ -28,11 +33,24 @@ class TiclMessageValidator {
   TiclMessageValidator(Logger* logger) : logger_(logger) {}
 
   // Generic IsValid() method.  Delegates to the private |Validate| helper
-  // method.
+  // method, and logs the offending field if the message is invalid.
   template<typename T>
   bool IsValid(const T& message) {
+    string error;
+    if (IsValid(message, &error)) {
+      return true;
+    }
+    LogInvalidMessage(error);
+    return false;
+  }
+
+  // Like IsValid(), but instead of logging, stores in |*error| the path to the
+  // offending field and the constraint it violates, e.g.,
+  // "invalidation_message.invalidation[3].version: must be non-negative".
+  template<typename T>
+  bool IsValid(const T& message, string* error) {
     bool result = true;
-    Validate(message, &result);
+    Validate(message, &result, error);
     return result;
   }
 
@@ -43,8 +61,13 @@ class TiclMessageValidator {
   // the caller must initialize |*result| to |true|.  Following this pattern
   // allows the specific validation methods to be simpler (i.e., a method that
   // accepts all messages has an empty body instead of having to return |true|).
+  // On failure, |*error| is set to the reason; callers prefix it with the
+  // field they were validating, so that the top level gets the full path.
   template<typename T>
-  void Validate(const T& message, bool* result);
+  void Validate(const T& message, bool* result, string* error);
+
+  // Logs that a message failed validation with |error|.
+  void LogInvalidMessage(const string& error);
 
  private:
   Logger* logger_;
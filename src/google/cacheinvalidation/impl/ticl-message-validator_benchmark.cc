@@ -0,0 +1,100 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reports the cost of validating large server messages. Not run as part of
+// the unit tests.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "google/cacheinvalidation/include/system-resources.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
+#include "google/cacheinvalidation/impl/constants.h"
+#include "google/cacheinvalidation/impl/ticl-message-validator.h"
+
+namespace invalidation {
+
+// A logger that discards everything.
+class NullLogger : public Logger {
+ public:
+  virtual void Log(LogLevel level, const char* file, int line,
+                   const char* format, ...) {}
+
+  virtual void SetSystemResources(SystemResources* resources) {}
+};
+
+// Returns a valid server message carrying num_invalidations invalidations.
+static ServerToClientMessage MakeServerMessage(int num_invalidations) {
+  ServerToClientMessage message;
+  ServerHeader* header = message.mutable_header();
+  header->mutable_protocol_version()->mutable_version()->set_major_version(
+      Constants::kProtocolMajorVersion);
+  header->mutable_protocol_version()->mutable_version()->set_minor_version(
+      Constants::kProtocolMinorVersion);
+  header->set_client_token("token");
+  header->set_server_time_ms(1000);
+  InvalidationMessage* invalidations = message.mutable_invalidation_message();
+  for (int i = 0; i < num_invalidations; ++i) {
+    InvalidationP* invalidation = invalidations->add_invalidation();
+    invalidation->mutable_object_id()->set_source(4);
+    invalidation->mutable_object_id()->set_name(StringPrintf("object-%d", i));
+    invalidation->set_is_known_version(true);
+    invalidation->set_version(i);
+    invalidation->set_payload("payload");
+  }
+  return message;
+}
+
+// Returns the average processor time in microseconds taken to validate
+// message, over num_runs runs, or a negative value if any run did not give
+// expected.
+static double TimeValidation(TiclMessageValidator* validator,
+                             const ServerToClientMessage& message,
+                             int num_runs, bool expected) {
+  clock_t start = clock();
+  for (int i = 0; i < num_runs; ++i) {
+    if (validator->IsValid(message) != expected) {
+      return -1;
+    }
+  }
+  return (clock() - start) * 1e6 / CLOCKS_PER_SEC / num_runs;
+}
+
+// Reports the time taken to validate a message with 10000 invalidations, when
+// it is valid and when its last invalidation is not.
+static int RunBenchmark() {
+  const int kNumInvalidations = 10000;
+  const int kNumRuns = 50;
+  NullLogger logger;
+  TiclMessageValidator validator(&logger);
+  ServerToClientMessage message = MakeServerMessage(kNumInvalidations);
+  double valid_micros = TimeValidation(&validator, message, kNumRuns, true);
+  message.mutable_invalidation_message()->mutable_invalidation(
+      kNumInvalidations - 1)->set_version(-1);
+  double invalid_micros = TimeValidation(&validator, message, kNumRuns, false);
+  if ((valid_micros < 0) || (invalid_micros < 0)) {
+    fprintf(stderr, "Validator gave an unexpected result\n");
+    return 1;
+  }
+  printf("%d invalidations: %.0f us when valid, %.0f us when invalid\n",
+         kNumInvalidations, valid_micros, invalid_micros);
+  return 0;
+}
+
+}  // namespace invalidation
+
+int main(int argc, char** argv) {
+  return invalidation::RunBenchmark();
+}
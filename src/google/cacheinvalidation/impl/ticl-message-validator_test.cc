@@ -0,0 +1,144 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the message validator.
+
+#include "google/cacheinvalidation/include/system-resources.h"
+#include "google/cacheinvalidation/deps/googletest.h"
+#include "google/cacheinvalidation/deps/string_util.h"
+#include "google/cacheinvalidation/impl/client-protocol-namespace-fix.h"
+#include "google/cacheinvalidation/impl/constants.h"
+#include "google/cacheinvalidation/impl/ticl-message-validator.h"
+
+namespace invalidation {
+
+// A logger that discards everything.
+class NullLogger : public Logger {
+ public:
+  virtual void Log(LogLevel level, const char* file, int line,
+                   const char* format, ...) {}
+
+  virtual void SetSystemResources(SystemResources* resources) {}
+};
+
+class TiclMessageValidatorTest : public testing::Test {
+ public:
+  TiclMessageValidatorTest() : validator_(&logger_) {}
+
+  // Returns a valid server message carrying num_invalidations invalidations.
+  static ServerToClientMessage MakeServerMessage(int num_invalidations) {
+    ServerToClientMessage message;
+    ServerHeader* header = message.mutable_header();
+    header->mutable_protocol_version()->mutable_version()->set_major_version(
+        Constants::kProtocolMajorVersion);
+    header->mutable_protocol_version()->mutable_version()->set_minor_version(
+        Constants::kProtocolMinorVersion);
+    header->set_client_token("token");
+    header->set_server_time_ms(1000);
+    InvalidationMessage* invalidations =
+        message.mutable_invalidation_message();
+    for (int i = 0; i < num_invalidations; ++i) {
+      InvalidationP* invalidation = invalidations->add_invalidation();
+      invalidation->mutable_object_id()->set_source(4);
+      invalidation->mutable_object_id()->set_name(
+          StringPrintf("object-%d", i));
+      invalidation->set_is_known_version(true);
+      invalidation->set_version(i);
+      invalidation->set_payload("payload");
+    }
+    return message;
+  }
+
+  NullLogger logger_;
+  TiclMessageValidator validator_;
+};
+
+// Tests that well-formed messages are accepted and that a violated constraint
+// at any depth is detected.
+TEST_F(TiclMessageValidatorTest, ValidatesNestedFields) {
+  ServerToClientMessage message = MakeServerMessage(3);
+  EXPECT_TRUE(validator_.IsValid(message));
+
+  ServerToClientMessage bad_version = message;
+  bad_version.mutable_invalidation_message()->mutable_invalidation(2)->
+      set_version(-1);
+  EXPECT_FALSE(validator_.IsValid(bad_version));
+
+  ServerToClientMessage missing_name = message;
+  missing_name.mutable_invalidation_message()->mutable_invalidation(1)->
+      mutable_object_id()->clear_name();
+  EXPECT_FALSE(validator_.IsValid(missing_name));
+
+  ServerToClientMessage no_invalidations = message;
+  no_invalidations.mutable_invalidation_message()->clear_invalidation();
+  EXPECT_FALSE(validator_.IsValid(no_invalidations));
+
+  ServerToClientMessage empty_token = message;
+  empty_token.mutable_header()->set_client_token("");
+  EXPECT_FALSE(validator_.IsValid(empty_token));
+
+  InvalidationP invalidation = message.invalidation_message().invalidation(0);
+  EXPECT_TRUE(validator_.IsValid(invalidation));
+  invalidation.clear_is_known_version();
+  EXPECT_FALSE(validator_.IsValid(invalidation));
+}
+
+// Tests that a failure is reported as the path to the offending field.
+TEST_F(TiclMessageValidatorTest, ReportsErrorPath) {
+  ServerToClientMessage message = MakeServerMessage(5);
+  message.mutable_invalidation_message()->mutable_invalidation(3)->
+      mutable_object_id()->set_source(-2);
+  string error;
+  EXPECT_FALSE(validator_.IsValid(message, &error));
+  EXPECT_EQ("invalidation_message.invalidation[3].object_id.source: "
+            "must be non-negative", error);
+
+  message.clear_header();
+  EXPECT_FALSE(validator_.IsValid(message, &error));
+  EXPECT_EQ("header: required field missing", error);
+
+  RateLimitP rate_limit;
+  rate_limit.set_window_ms(1000);
+  rate_limit.set_count(1000);
+  EXPECT_FALSE(validator_.IsValid(rate_limit, &error));
+  EXPECT_EQ("message.window_ms() > message.count() not satisfied", error);
+}
+
+// Tests the custom conditions.
+TEST_F(TiclMessageValidatorTest, ChecksConditions) {
+  RateLimitP rate_limit;
+  rate_limit.set_window_ms(1000);
+  rate_limit.set_count(10);
+  EXPECT_TRUE(validator_.IsValid(rate_limit));
+  rate_limit.set_count(1000);
+  EXPECT_FALSE(validator_.IsValid(rate_limit));
+  rate_limit.set_window_ms(999);
+  rate_limit.set_count(1);
+  EXPECT_FALSE(validator_.IsValid(rate_limit));
+
+  ClientToServerMessage message;
+  ClientHeader* header = message.mutable_header();
+  header->mutable_protocol_version()->mutable_version()->set_major_version(
+      Constants::kProtocolMajorVersion);
+  header->mutable_protocol_version()->mutable_version()->set_minor_version(
+      Constants::kProtocolMinorVersion);
+  header->set_client_time_ms(1);
+  header->set_max_known_server_time_ms(0);
+  // Neither an initialize message nor a client token.
+  EXPECT_FALSE(validator_.IsValid(message));
+  header->set_client_token("token");
+  EXPECT_TRUE(validator_.IsValid(message));
+}
+
+}  // namespace invalidation
@@ -0,0 +1,119 @@
+// Copyright 2012 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Out-of-line parts of the public types: the shared invalidation payload and
+// its reference counting, kept here so that the public header does not depend
+// on the atomic operations.
+
+#include "google/cacheinvalidation/include/types.h"
+
+#include "google/cacheinvalidation/deps/atomicops.h"
+
+namespace invalidation {
+
+class InvalidationPayload {
+ public:
+  /* Returns a new payload with a single reference, holding the contents of
+   * data, which are moved into it (leaving data empty).
+   */
+  static InvalidationPayload* Create(string* data) {
+    InvalidationPayload* payload = new InvalidationPayload();
+    payload->data_.swap(*data);
+    return payload;
+  }
+
+  const string& data() const {
+    return data_;
+  }
+
+  /* Adds a reference to this payload. */
+  void Ref() {
+    NoBarrier_AtomicIncrement(&ref_count_, 1);
+  }
+
+  /* Drops a reference to this payload, deleting it if it was the last one. */
+  void Unref() {
+    if (Barrier_AtomicIncrement(&ref_count_, -1) == 0) {
+      delete this;
+    }
+  }
+
+ private:
+  InvalidationPayload() : ref_count_(1) {}
+
+  /* The number of invalidations referencing this payload. */
+  volatile AtomicWord ref_count_;
+
+  /* The payload bytes. */
+  string data_;
+
+  DISALLOW_COPY_AND_ASSIGN(InvalidationPayload);
+};
+
+namespace {
+
+/* Returns the payload of invalidations without payload bytes. It is created on
+ * first use and never destroyed, so no static constructor or destructor is
+ * involved.
+ */
+const string& GetEmptyPayload() {
+  static const string* empty_payload = new string();
+  return *empty_payload;
+}
+
+}  // namespace
+
+Invalidation::~Invalidation() {
+  if (payload_ != NULL) {
+    payload_->Unref();
+  }
+}
+
+Invalidation& Invalidation::operator=(const Invalidation& invalidation) {
+  if (invalidation.payload_ != NULL) {
+    invalidation.payload_->Ref();
+  }
+  if (payload_ != NULL) {
+    payload_->Unref();
+  }
+  is_initialized_ = invalidation.is_initialized_;
+  object_id_ = invalidation.object_id_;
+  version_ = invalidation.version_;
+  has_payload_ = invalidation.has_payload_;
+  payload_ = invalidation.payload_;
+  is_trickle_restart_ = invalidation.is_trickle_restart_;
+  return *this;
+}
+
+const string& Invalidation::payload() const {
+  return (payload_ != NULL) ? payload_->data() : GetEmptyPayload();
+}
+
+void Invalidation::Init(const ObjectId& object_id, int64 version,
+                        bool has_payload, string* payload,
+                        bool is_trickle_restart) {
+  is_initialized_ = true;
+  object_id_.Init(object_id.source(), object_id.name());
+  version_ = version;
+  has_payload_ = has_payload;
+  if (payload_ != NULL) {
+    payload_->Unref();
+  }
+  // Empty payloads are not allocated.
+  payload_ = ((payload != NULL) && !payload->empty()) ?
+      InvalidationPayload::Create(payload) : NULL;
+  is_trickle_restart_ = is_trickle_restart;
+}
+
+}  // namespace invalidation
@@ -113,6 +113,20 @@ class Scheduler : public ResourceComponent {
     return TimeDelta::FromMilliseconds(0);
   }
 
+  /* Classes of scheduled work, from the most to the least latency-critical. */
+  enum Priority {
+    /* Work on the invalidation delivery path: inbound messages, listener
+     * upcalls and acknowledgement flushes.
+     */
+    HIGH_PRIORITY,
+
+    /* Work that is neither latency-critical nor housekeeping. */
+    NORMAL_PRIORITY,
+
+    /* Housekeeping: heartbeats, registration sync and persistence. */
+    LOW_PRIORITY
+  };
+
   /* Schedules runnable to be run on scheduler's thread after at least
    * delay.
    * Callee owns the runnable and must delete it after the task has run
@@ -120,6 +134,16 @@ class Scheduler : public ResourceComponent {
    */
   virtual void Schedule(TimeDelta delay, Closure* runnable) = 0;
 
+  /* Like Schedule, but in the given priority class: a scheduler may run ready
+   * work of a higher class before ready work of a lower class, even if the
+   * latter became ready earlier. Work scheduled with Schedule is of class
+   * NORMAL_PRIORITY. The default implementation ignores the priority.
+   */
+  virtual void ScheduleWithPriority(TimeDelta delay, Priority priority,
+                                    Closure* runnable) {
+    Schedule(delay, runnable);
+  }
+
   /* Returns whether the current code is executing on the scheduler's thread.
    */
   virtual bool IsRunningOnThread() const = 0;
@@ -259,6 +283,24 @@ class SystemResources {
    * application.
    */
   virtual Scheduler* listener_scheduler() = 0;
+
+  /* Returns the number of additional schedulers across which invalidation
+   * events for distinct objects may be spread, so that the application can
+   * process them in parallel. Events for a given object always go to the same
+   * scheduler, in order; all other events go to listener_scheduler(). The
+   * default of zero delivers every event on listener_scheduler().
+   */
+  virtual int listener_shard_count() {
+    return 0;
+  }
+
+  /* Returns the scheduler for listener shard |shard|.
+   *
+   * REQUIRES: 0 <= shard < listener_shard_count().
+   */
+  virtual Scheduler* listener_shard_scheduler(int shard) {
+    return NULL;
+  }
 };
 
 }  // namespace invalidation
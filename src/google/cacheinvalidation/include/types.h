@@ -211,21 +211,27 @@ class ObjectId {
   string name_;
 };
 
+/* An immutable payload buffer, shared through reference counting by all the
+ * copies of an invalidation. The payload bytes are stored once and released
+ * when the last copy of the invalidation is destroyed. Defined by the library.
+ */
+class InvalidationPayload;
+
 /* A class to represent an invalidation for a given object/version and an
- * optional payload.
+ * optional payload. Copies of an invalidation share its payload bytes.
  */
 class Invalidation {
  public:
-  Invalidation() : is_initialized_(false) {}
+  Invalidation() : is_initialized_(false), payload_(NULL) {}
 
   /* Creates a restarted invalidation for the given object and version. */
-  Invalidation(const ObjectId& object_id, int64 version) {
+  Invalidation(const ObjectId& object_id, int64 version) : payload_(NULL) {
     Init(object_id, version, true);
   }
 
   /* Creates an invalidation for the given object, version, and payload. */
   Invalidation(const ObjectId& object_id, int64 version,
-               const string& payload) {
+               const string& payload) : payload_(NULL) {
     Init(object_id, version, payload, true);
   }
 
@@ -234,17 +240,33 @@ class Invalidation {
    * and restarted flag.
    */
   Invalidation(const ObjectId& object_id, int64 version, const string& payload,
-               bool is_trickle_restart) {
+               bool is_trickle_restart) : payload_(NULL) {
     Init(object_id, version, payload, is_trickle_restart);
   }
 
+  Invalidation(const Invalidation& invalidation) : payload_(NULL) {
+    *this = invalidation;
+  }
+
+  ~Invalidation();
+
+  Invalidation& operator=(const Invalidation& invalidation);
 
   void Init(const ObjectId& object_id, int64 version, bool is_trickle_restart) {
-    Init(object_id, version, false, "", is_trickle_restart);
+    Init(object_id, version, false, NULL, is_trickle_restart);
   }
 
   void Init(const ObjectId& object_id, int64 version, const string& payload,
             bool is_trickle_restart) {
+    string payload_copy(payload);
+    Init(object_id, version, true, &payload_copy, is_trickle_restart);
+  }
+
+  /* Like the above, but moves the contents of payload into this invalidation
+   * (leaving payload empty) instead of copying them.
+   */
+  void Init(const ObjectId& object_id, int64 version, string* payload,
+            bool is_trickle_restart) {
     Init(object_id, version, true, payload, is_trickle_restart);
   }
 
@@ -260,9 +282,7 @@ class Invalidation {
     return has_payload_;
   }
 
-  const string& payload() const {
-    return payload_;
-  }
+  const string& payload() const;
 
   // This method is for internal use only.
   bool is_trickle_restart_for_internal_use() const {
@@ -279,15 +299,11 @@ class Invalidation {
   }
 
  private:
+  /* Initializes this invalidation, moving the contents of payload (if not
+   * NULL) into a new shared payload.
+   */
   void Init(const ObjectId& object_id, int64 version, bool has_payload,
-            const string& payload, bool is_trickle_restart) {
-    is_initialized_ = true;
-    object_id_.Init(object_id.source(), object_id.name());
-    version_ = version;
-    has_payload_ = has_payload;
-    payload_ = payload;
-    is_trickle_restart_ = is_trickle_restart;
-  }
+            string* payload, bool is_trickle_restart);
 
   /* Whether this invalidation has been initialized. */
   bool is_initialized_;
@@ -301,8 +317,10 @@ class Invalidation {
   /* Whether or not the invalidation includes a payload. */
   bool has_payload_;
 
-  /* Optional payload for the client. */
-  string payload_;
+  /* Optional payload for the client, shared with the copies of this
+   * invalidation; NULL if the payload is absent or empty.
+   */
+  InvalidationPayload* payload_;
 
   /* Flag whether the trickle restarts at this invalidation. */
   bool is_trickle_restart_;
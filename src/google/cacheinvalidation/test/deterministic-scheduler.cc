@@ -19,19 +19,24 @@ namespace invalidation {
 void DeterministicScheduler::StopScheduler() {
   run_state_.Stop();
   // Delete any tasks that haven't been run.
-  while (!work_queue_.empty()) {
-    TaskEntry top_elt = work_queue_.top();
-    work_queue_.pop();
-    delete top_elt.task;
+  for (int i = 0; i < kNumPriorities; ++i) {
+    while (!work_queues_[i].empty()) {
+      TaskEntry top_elt = work_queues_[i].top();
+      work_queues_[i].pop();
+      delete top_elt.task;
+    }
   }
 }
 
-void DeterministicScheduler::Schedule(TimeDelta delay, Closure* task) {
+void DeterministicScheduler::ScheduleWithPriority(
+    TimeDelta delay, Priority priority, Closure* task) {
   CHECK(IsCallbackRepeatable(task));
   CHECK(run_state_.IsStarted());
-  TLOG(logger_, INFO, "(Now: %d) Enqueuing %p with delay %d",
-       current_time_.ToInternalValue(), task, delay.InMilliseconds());
-  work_queue_.push(TaskEntry(GetCurrentTime() + delay, current_id_++, task));
+  TLOG(logger_, INFO, "(Now: %d) Enqueuing %p with delay %d, priority %d",
+       current_time_.ToInternalValue(), task, delay.InMilliseconds(),
+       priority);
+  work_queues_[priority].push(
+      TaskEntry(GetCurrentTime() + delay, current_id_++, task));
 }
 
 void DeterministicScheduler::PassTime(TimeDelta delta_time, TimeDelta step) {
@@ -63,14 +68,19 @@ void DeterministicScheduler::RunReadyTasks() {
 }
 
 bool DeterministicScheduler::RunNextTask() {
-  if (!work_queue_.empty()) {
+  // Run the first ready task of the highest priority class that has one.
+  for (int i = 0; i < kNumPriorities; ++i) {
+    std::priority_queue<TaskEntry>* work_queue = &work_queues_[i];
+    if (work_queue->empty()) {
+      continue;
+    }
     // The queue is not empty, so get the first task and see if its scheduled
     // execution time has passed.
-    TaskEntry top_elt = work_queue_.top();
+    TaskEntry top_elt = work_queue->top();
     if (top_elt.time <= GetCurrentTime()) {
       // The task is scheduled to run in the past or present, so remove it
       // from the queue and run the task.
-      work_queue_.pop();
+      work_queue->pop();
       TLOG(logger_, FINE, "(Now: %d) Running task %p",
            current_time_.ToInternalValue(), top_elt.task);
       top_elt.task->Run();
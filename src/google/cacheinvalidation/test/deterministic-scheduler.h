@@ -73,7 +73,13 @@ class DeterministicScheduler : public Scheduler {
 
   void StopScheduler();
 
-  virtual void Schedule(TimeDelta delay, Closure* task);
+  virtual void Schedule(TimeDelta delay, Closure* task) {
+    ScheduleWithPriority(delay, NORMAL_PRIORITY, task);
+  }
+
+  // Ready tasks of a higher priority run before ready tasks of a lower one.
+  virtual void ScheduleWithPriority(TimeDelta delay, Priority priority,
+                                    Closure* task);
 
   virtual bool IsRunningOnThread() const {
     return running_internal_;
@@ -128,8 +134,12 @@ class DeterministicScheduler : public Scheduler {
   // queue.
   bool running_internal_;
 
-  // A priority queue on which the actual tasks are enqueued.
-  std::priority_queue<TaskEntry> work_queue_;
+  // The number of priority classes.
+  static const int kNumPriorities = LOW_PRIORITY + 1;
+
+  // Priority queues on which the actual tasks are enqueued, one per priority
+  // class.
+  std::priority_queue<TaskEntry> work_queues_[kNumPriorities];
 
   // A logger.
   Logger* logger_;
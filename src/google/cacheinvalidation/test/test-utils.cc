@@ -26,7 +26,6 @@
 namespace invalidation {
 
 using ::google::protobuf::io::StringOutputStream;
-using ::testing::DeleteArg;
 using ::testing::StrictMock;
 
 // Creates an Action InvokeNetworkStatusCallback<k>() that calls the Run method
@@ -49,6 +48,7 @@ void UnitTestBase::SetUp() {
   InitZeroRegistrationSummary(reg_summary.get());
   InitSystemResources();  // Set up system resources
   message_callback = NULL;
+  network_status_callback = NULL;
 
   // Start the scheduler and resources.
   internal_scheduler->StartScheduler();
@@ -60,6 +60,10 @@ void UnitTestBase::TearDown() {
     delete message_callback;
     message_callback = NULL;
   }
+  if (network_status_callback != NULL) {
+    delete network_status_callback;
+    network_status_callback = NULL;
+  }
 }
 
 void UnitTestBase::InitSystemResources() {
@@ -98,9 +102,10 @@ void UnitTestBase::InitCommonExpectations() {
 
   // It will also add a network status receiver.  The network channel takes
   // ownership. Invoke it once with |true| just to exercise that code path,
-  // then delete it since we won't need it anymore.
+  // and save it so that tests can change the network status.
   EXPECT_CALL(*network, AddNetworkStatusReceiver(_))
-      .WillOnce(DoAll(InvokeNetworkStatusCallback<0>(), DeleteArg<0>()));
+      .WillOnce(DoAll(InvokeNetworkStatusCallback<0>(),
+                      SaveArg<0>(&network_status_callback)));
 }
 
 void UnitTestBase::InitRegistrationMessage(const vector<ObjectIdP>& oids,
@@ -239,6 +244,11 @@ void UnitTestBase::ProcessIncomingMessage(const ServerToClientMessage& message,
   internal_scheduler->PassTime(delay);
 }
 
+void UnitTestBase::ChangeNetworkStatus(bool is_online, TimeDelta delay) {
+  network_status_callback->Run(is_online);
+  internal_scheduler->PassTime(delay);
+}
+
 Matcher<ClientHeader> UnitTestBase::ClientHeaderMatches(
     const ClientHeader* header) {
   return AllOf(Property(&ClientHeader::protocol_version,
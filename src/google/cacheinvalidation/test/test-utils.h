@@ -233,6 +233,10 @@ class UnitTestBase : public testing::Test {
   void ProcessIncomingMessage(const ServerToClientMessage& message,
       TimeDelta delay);
 
+  // Tells the client that the network is online or not, through the network
+  // status callback, and passes time in the internal scheduler by |delay|.
+  void ChangeNetworkStatus(bool is_online, TimeDelta delay);
+
   // Returns true iff the messages are equal (with lists interpreted as sets).
   bool CompareMessages(
       const ::google::protobuf::MessageLite& expected,
@@ -300,6 +304,10 @@ class UnitTestBase : public testing::Test {
   // network.
   MessageCallback* message_callback;
 
+  // Network status callback installed by the client.  Captured by the mock
+  // network.
+  NetworkStatusCallback* network_status_callback;
+
   // Registration summary to be placed in messages from the client to the server
   // and vice-versa.
   scoped_ptr<RegistrationSummary> reg_summary;